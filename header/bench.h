@@ -0,0 +1,91 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "./logic.h"
+
+// Options of a benchmark run, all of them can be set on the command line
+struct BenchOptions {
+	// Grid sizes of the sweep (number of grid elements in each direction)
+	std::vector<int> sizes = {64, 128, 256, 512, 1024, 2048};
+
+	// Every kernel is repeated until it ran for at least this many seconds per size
+	double min_time = 0.25;
+
+	// Only run the kernels whose name is in this list, all kernels if it is empty
+	std::vector<std::string> kernels;
+
+	// Gauss Seidel iterations of the diffusion, the same number Logic::step uses
+	int iterations = 16;
+
+	// Solver settings passed to Physics, see HeadlessOptions
+	ProjectionSolver projection = ProjectionSolver::GaussSeidel;
+	Multigrid::Cycle cycle = Multigrid::VCycle;
+	float tolerance = 1e-4f;
+	Relaxation relaxation = Relaxation::GaussSeidel;
+	int threads = 1;
+
+	// Files for the machine readable results, nothing is written if empty
+	std::string json;
+	std::string csv;
+};
+
+// Timing of one kernel at one grid size
+struct BenchResult {
+	std::string kernel;
+	int size;
+
+	// Number of timed calls and the fastest time per call over all batches
+	long calls;
+	double seconds;
+
+	// Grid cells processed per second, i.e. size * size / seconds
+	double cells_per_second;
+
+	// Bytes the kernel has to move per cell and call (see Bench::run) and the resulting bandwidth
+	double bytes_per_cell;
+	double bytes_per_second;
+};
+
+// Micro-benchmarks of the Physics kernels and of Logic::step over a sweep of grid sizes
+class Bench {
+	private:
+		BenchOptions _options;
+
+		std::vector<BenchResult> _results;
+
+		// Should the kernel with the given name run?
+		bool selected(const std::string& kernel) const;
+
+		// Time kernel until min_time is reached and store the result
+		void measure(const std::string& kernel, int size, double bytes_per_cell, const std::function<void()>& kernel_call);
+
+		// Bytes per cell of one pressure solve with the current settings, iterations as reported by Physics
+		double projectionBytes(Physics& physics) const;
+
+	public:
+		// Names of all kernels in the order they are run
+		static const std::vector<std::string>& kernelNames();
+
+		// Parse the command line, throws std::invalid_argument on unknown or malformed options
+		static BenchOptions parse(int argc, char** argv);
+
+		// Print the available command line options
+		static void usage(const char* program);
+
+		Bench(const BenchOptions& options);
+
+		// Run the sweep, print one line per kernel and size to std::cout and write the result files
+		void run();
+
+		const std::vector<BenchResult>& results() const { return _results; }
+
+		// Write the results as JSON (one object per kernel and size) or as CSV with a header line
+		void writeJson(std::ostream& out) const;
+		void writeCsv(std::ostream& out) const;
+};
+
+#endif
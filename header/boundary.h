@@ -0,0 +1,130 @@
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+#include "./grid.h"
+
+// Condition Physics::setBnd writes into the ghost cells of a field
+enum class Boundary {
+	// Scalar fields (density, pressure, divergence): the ghost cells copy the interior cell next to the wall
+	Scalar,
+	// Velocity in x direction: negated on the left and right walls, so no fluid passes them
+	VelocityX,
+	// Velocity in y direction: negated on the top and bottom walls
+	VelocityY,
+	// The interior wraps around: the ghost cells hold the interior cells of the opposite side
+	Periodic,
+	// Outflow: every field keeps the value next to the wall and nothing is reflected, so fluid leaves the box
+	Open
+};
+
+// Boundaries of a complete simulation, Physics maps the wall boundary of each field onto the domain
+enum class Domain {
+	// Closed box, density and pressure use Boundary::Scalar and the velocity components reflect on their walls
+	Walls,
+	// Every field is periodic in both directions
+	Periodic,
+	// Every field uses Boundary::Open
+	Open
+};
+
+// Compile-time properties of each boundary. Kernels are instantiated for them by withBoundary, so the signs are
+// constants and the periodic copy is a separate loop instead of a test inside every iteration.
+// horizontal is the sign on the top and bottom walls, vertical the one on the left and right walls.
+struct ScalarBoundary {
+	static constexpr bool periodic = false;
+	static constexpr float horizontal = 1.0f;
+	static constexpr float vertical = 1.0f;
+};
+
+struct VelocityXBoundary {
+	static constexpr bool periodic = false;
+	static constexpr float horizontal = 1.0f;
+	static constexpr float vertical = -1.0f;
+};
+
+struct VelocityYBoundary {
+	static constexpr bool periodic = false;
+	static constexpr float horizontal = -1.0f;
+	static constexpr float vertical = 1.0f;
+};
+
+struct PeriodicBoundary {
+	static constexpr bool periodic = true;
+	static constexpr float horizontal = 1.0f;
+	static constexpr float vertical = 1.0f;
+};
+
+// For a scalar field the outflow copy is the same as ScalarBoundary, the velocity is not reflected
+struct OpenBoundary {
+	static constexpr bool periodic = false;
+	static constexpr float horizontal = 1.0f;
+	static constexpr float vertical = 1.0f;
+};
+
+// Call body(policy) with the policy of the boundary
+template <typename Body>
+void withBoundary(Boundary boundary, Body&& body) {
+	switch (boundary) {
+		case Boundary::VelocityX:
+			body(VelocityXBoundary());
+			break;
+		case Boundary::VelocityY:
+			body(VelocityYBoundary());
+			break;
+		case Boundary::Periodic:
+			body(PeriodicBoundary());
+			break;
+		case Boundary::Open:
+			body(OpenBoundary());
+			break;
+		default:
+			body(ScalarBoundary());
+	}
+}
+
+// Boundary of a field in the domain, field is the boundary the field has in a closed box
+inline Boundary domainBoundary(Domain domain, Boundary field) {
+	switch (domain) {
+		case Domain::Periodic:
+			return Boundary::Periodic;
+		case Domain::Open:
+			return Boundary::Open;
+		default:
+			return field;
+	}
+}
+
+// Grid dimensions known at compile time (Size > 0) or taken from the field (Size == 0). With a constant size the
+// loops of a kernel have constant bounds and the neighbours constant offsets, which the compiler unrolls and
+// vectorizes for that size only.
+template <int Size>
+struct Shape {
+	static constexpr int size(const Grid&) { return Size; }
+	static constexpr int stride(const Grid&) { return Grid::rowStride(Size); }
+};
+
+template <>
+struct Shape<0> {
+	static int size(const Grid& grid) { return grid.size(); }
+	static int stride(const Grid& grid) { return grid.stride(); }
+};
+
+// Grid sizes the kernels are specialized for, set with -DFLUIDSIM_FIXED_SIZES=70,256,... (default: SIZE of the
+// interactive simulation, 0: none). Every other size runs the kernels instantiated for Shape<0>.
+template <int... Sizes>
+struct SizeList {};
+
+template <typename Body>
+void withShape(int, Body&& body, SizeList<>) {
+	body(Shape<0>());
+}
+
+template <typename Body, int First, int... Rest>
+void withShape(int size, Body&& body, SizeList<First, Rest...>) {
+	if (size == First)
+		body(Shape<First>());
+	else
+		withShape(size, body, SizeList<Rest...>());
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include "./logic.h"
+
+// Complete solver state in a file that can be memory-mapped. One header page with the parameters of the simulation
+// is followed by the memory of the GridArena of Logic, byte for byte including the row padding:
+//
+//   CheckpointHeader, zero padded to CHECKPOINT_DATA_OFFSET bytes
+//   the fields in the layout of GridArena::layoutBytes, each one in its own precision
+//
+// As the fields start on a page boundary, restoring maps them straight into the arena of the new Logic instead of
+// reading them. Numbers are stored in the byte order of the machine, checkpoints are meant to restart a run on the
+// same kind of machine.
+const char CHECKPOINT_MAGIC[8] = {'F', 'L', 'U', 'I', 'D', 'C', 'K', 'P'};
+const std::uint32_t CHECKPOINT_VERSION = 4;
+
+// Most fields a checkpoint can describe
+const std::size_t CHECKPOINT_MAX_FIELDS = 16;
+const std::size_t CHECKPOINT_DATA_OFFSET = 4096;
+
+struct CheckpointHeader {
+	char magic[8];
+	std::uint32_t version;
+
+	// Offset of the fields in the file, CHECKPOINT_DATA_OFFSET
+	std::uint32_t data_offset;
+
+	// Layout of the arena: grid elements in each direction, floats per row and number of fields
+	std::uint32_t size;
+	std::uint32_t stride;
+	std::uint32_t fields;
+
+	// Boundaries of the simulation, the values of the Domain enum (0 is the closed box)
+	std::uint32_t domain;
+
+	// Bytes of the arena following the header page
+	std::uint64_t data_bytes;
+
+	// Number of steps the simulation made before the checkpoint
+	std::int64_t step;
+
+	// Parameters of Logic
+	float dt;
+	float diffusion;
+	float viscosity;
+
+	// Solver settings of Physics (ProjectionSolver, Multigrid::Cycle, Relaxation) and of the multigrid backend
+	std::uint32_t projection;
+	std::uint32_t cycle;
+	std::uint32_t relaxation;
+	float tolerance;
+	std::uint32_t max_cycles;
+
+	// Stopping criteria of the Gauss Seidel solvers, ResidualNorm and warm start of the pressure solve
+	std::uint32_t diffusion_iterations;
+	float diffusion_tolerance;
+	std::uint32_t projection_sweeps;
+	float projection_tolerance;
+	std::uint32_t residual_norm;
+	std::uint32_t warm_start;
+
+	// Precision of every field, the values of the Precision enum
+	std::uint8_t precisions[CHECKPOINT_MAX_FIELDS];
+
+	// AdvectionScheme of Physics
+	std::uint32_t advection;
+};
+
+// Saves and restores the state of a Logic instance
+class Checkpoint {
+	public:
+		// Write the state after the given step. The file is written under a temporary name and renamed once it is
+		// complete, so a crash while writing leaves the previous checkpoint intact. A Logic restored from the old file
+		// keeps working, its mapping still refers to the replaced file. Throws std::runtime_error on write errors.
+		static void save(const std::string& path, Logic& logic, long step);
+
+		// Read the header of a checkpoint, throws std::runtime_error if the file is no valid checkpoint
+		static CheckpointHeader header(const std::string& path);
+
+		// Continue the simulation saved in the file. The fields are mapped, not read, so restoring takes the same
+		// time for every grid size and the pages are only loaded when the solver first touches them.
+		// The solver settings are restored as well, the number of threads is left to the caller.
+		static Logic restore(const std::string& path, long& step);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef COMMUNICATOR_H
+#define COMMUNICATOR_H
+
+#include <cstddef>
+#include <functional>
+#include <sys/types.h>
+#include <vector>
+
+// Message passing between the processes of one machine, modelled on the MPI calls the solver needs
+// (MPI_Comm_rank / size, MPI_Barrier, MPI_Sendrecv, MPI_Allgatherv, MPI_Allreduce). Communicator::run forks the
+// processes like mpirun does and runs the same function in each of them.
+//
+// The processes share one anonymous mapping created before the fork. It holds a barrier and one mailbox of a fixed
+// capacity per process. A process writes what it sends into its own mailbox, all processes meet at the barrier, the
+// receivers copy the data out of the mailbox of the sender and meet at the barrier again before the mailboxes are
+// reused. Every call is therefore collective: all processes have to make the same calls in the same order, which is
+// what the solver does anyway. The data only crosses memory once, there is no socket or kernel copy in between.
+//
+// If a process fails (an exception or a crash), the others notice it in their next barrier and throw
+// std::runtime_error instead of waiting forever.
+class Communicator {
+	public:
+		// Rank that does not exist, a sendrecv with it sends or receives nothing (MPI_PROC_NULL)
+		static const int NO_RANK = -1;
+
+		// Operation of allreduce
+		enum Reduce { Sum, Max };
+
+	private:
+		// Barrier, failure flag and mailbox headers at the start of the shared mapping
+		struct Shared;
+
+		Shared* _shared;
+		std::size_t _mapping_bytes;
+		int _rank;
+		int _size;
+		std::size_t _capacity;
+
+		// Process ids of the other processes, only known to rank 0, and whether one of them failed
+		std::vector<pid_t> _children;
+		bool _child_failed;
+
+		Communicator(Shared* shared, std::size_t mapping_bytes, int rank, int size, std::size_t capacity);
+
+		// Mailbox of the given rank
+		unsigned char* mailbox(int rank) const;
+
+		// Tell the other processes that this one failed
+		void fail();
+
+		// Rank 0 checks if another process ended while the others still wait for it
+		void checkChildren();
+
+	public:
+		// Fork processes - 1 processes, run body(communicator) in all of them and wait for them. Messages may be up to
+		// capacity bytes long. The calling process is rank 0, the others leave with _exit once body returns.
+		// Rethrows the exception of rank 0, and throws std::runtime_error if another process failed.
+		static void run(int processes, std::size_t capacity, const std::function<void(Communicator&)>& body);
+
+		~Communicator();
+
+		Communicator(const Communicator&) = delete;
+		Communicator& operator=(const Communicator&) = delete;
+
+		int rank() const { return _rank; }
+		int size() const { return _size; }
+
+		// Largest number of bytes a single process can send in one call
+		std::size_t capacity() const { return _capacity; }
+
+		// Wait until all processes reached the barrier
+		void barrier();
+
+		// Send bytes to dest and receive receive_bytes from source in one step, either may be NO_RANK. The message of
+		// source has to be addressed to this process.
+		void sendrecv(const void* send, std::size_t send_bytes, int dest, void* receive, std::size_t receive_bytes,
+			int source);
+
+		// Every process contributes bytes[rank] bytes, all processes receive the contribution of rank k at
+		// receive + offsets[k]. The receive buffer may contain the own contribution already.
+		void allgatherv(const void* send, void* receive, const std::vector<std::size_t>& bytes,
+			const std::vector<std::size_t>& offsets);
+
+		// Combine count values of every process element-wise, in rank order so that all processes get the same result
+		void allreduce(double* values, int count, Reduce operation);
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <vector>
+#include "./communicator.h"
+#include "./grid.h"
+#include "./headless.h"
+#include "./logic.h"
+#include "./physics.h"
+
+// One time step of Logic split across the processes of a Communicator. Every process holds full size fields but only
+// computes its own slab of rows: the interior rows are split evenly, rank 0 also owns the top boundary row and the
+// last rank the bottom one. The steps are the ones of Logic::step with red-black relaxation for the diffusion and the
+// pressure, whose colours only read the cells of the other colour:
+//   - every colour is followed by an exchange of the ghost rows (the first row of the neighbours) via sendrecv
+//   - setBnd runs on the own rows only, see Physics::setBnd
+//   - the residual norms are collected per row and summed in row order on every process
+//   - advection backtraces over any distance, so the advected fields are gathered completely before it
+// The rows are computed by the same kernels as in a single process, so the fields are bit-identical to a Logic with
+// Relaxation::RedBlack and ProjectionSolver::RedBlack, independent of the number of processes.
+class DistributedLogic {
+	private:
+		Communicator& _communicator;
+
+		Physics _physics;
+
+		int _size;
+		float _dt;
+		float _diffusion_coefficient;
+		float _viscosity;
+
+		// First row of every rank and the end of the last one (size + 1 entries), and the own rows [_first, _last)
+		std::vector<int> _rows;
+		int _first;
+		int _last;
+
+		// Same fields as Logic
+		GridArena _arena;
+		Grid _velocity_x;
+		Grid _velocity_y;
+		Grid _previous_velocity_x;
+		Grid _previous_velocity_y;
+		Grid _previous_density;
+		Grid _density;
+		Grid _pressure_diffused;
+		Grid _pressure_advected;
+		Grid _divergence;
+
+		int _diffusion_iterations;
+
+		SolverStatistics _statistics;
+
+		// Norms per row and the squares and maxima of all rows as pairs, exchanged by sumRows
+		std::vector<double> _row_squares;
+		std::vector<float> _row_max;
+		std::vector<double> _row_pairs;
+
+		// Bytes and offsets of the rows of every rank for allgatherv
+		std::vector<std::size_t> _field_bytes;
+		std::vector<std::size_t> _field_offsets;
+		std::vector<std::size_t> _pair_bytes;
+		std::vector<std::size_t> _pair_offsets;
+
+		// Own interior rows
+		int interiorFirst() const { return _first > 1 ? _first : 1; }
+		int interiorLast() const { return _last < _size - 1 ? _last : _size - 1; }
+
+		// Receive the rows next to the own ones from the neighbouring ranks
+		void exchange(Grid& x);
+
+		// Sum the per-row norms of all ranks in row order
+		void sumRows(double& squares, float& largest);
+
+		// Red-black relaxation like Physics::relaxRedBlack, returns the iterations and the residual
+		void relax(Boundary b, Grid& x, Grid& x0, float a, int& iterations, float& residual);
+
+		// Projection like Physics::project with ProjectionSolver::RedBlack
+		void project(Grid& vx, Grid& vy, Grid& p, Grid& div, int& iterations, float& residual);
+
+	public:
+		// Rows of every rank for a grid of the given size, throws std::invalid_argument if a rank would get no interior row
+		static std::vector<int> split(int size, int processes);
+
+		// Mailbox capacity the communicator needs for a grid of the given size
+		static std::size_t capacity(int size, int processes);
+
+		// Constructor, called by every process of the communicator with the same parameters
+		DistributedLogic(Communicator& communicator, int size, float dt, float diff, float visc);
+
+		// Sources are added by every process, each one keeps the part in its own rows
+		void addDensity(float x, float y, float amount);
+		void addVelocity(float x, float y, float px, float py);
+
+		// The tracer particles are not distributed, Distributed rejects scripts with particle sources
+		void addParticles(float, float, int) {}
+
+		// One simulation step, a collective call
+		void step();
+
+		// Fade the density of the own rows like Logic::fadeDensity
+		void fadeDensity();
+
+		// Copy the rows of all ranks into the fields of every process, a collective call
+		void gather(Grid& x);
+
+		// Sum of the density, its maximum and the kinetic energy over the complete grid, a collective call
+		void totals(double& mass, double& max_density, double& kinetic_energy);
+
+		int size() const { return _size; }
+		int firstRow() const { return _first; }
+		int lastRow() const { return _last; }
+
+		// Maximum number of iterations of each diffusion solve (default 16)
+		void setDiffusionIterations(int iterations) { _diffusion_iterations = iterations; }
+
+		// Tolerances, sweeps, residual norm and warm start of the solvers. The relaxation and the projection solver are
+		// always red-black, the thread pool and active tiles are not used.
+		Physics& physics() { return _physics; }
+
+		// Iterations and residuals of the linear solvers in the last step, the same on every process
+		const SolverStatistics& statistics() const { return _statistics; }
+
+		// Fields of the process, only the own rows are up to date unless they were gathered
+		Grid& density() { return _density; }
+		Grid& velocity_x() { return _velocity_x; }
+		Grid& velocity_y() { return _velocity_y; }
+};
+
+// Options of fluid_distributed, every option of fluid_headless sets the simulation
+struct DistributedOptions {
+	HeadlessOptions simulation;
+
+	// Number of processes the grid is split across
+	int processes = 2;
+
+	// Compare the result with a single process Logic and fail if the largest difference relative to the largest value
+	// of a field exceeds the tolerance
+	bool verify = false;
+	float verify_tolerance = 1e-5f;
+
+	// Run with 1, 2, 4, ... processes up to processes and report speedup and parallel efficiency
+	bool scaling = false;
+};
+
+// Runs a headless simulation with DistributedLogic
+class Distributed {
+	private:
+		DistributedOptions _options;
+
+		SourceScript _script;
+
+		// Simulate with the given number of processes and return the statistics of the run. If fields is not null, the
+		// density and the velocity in x and y are copied into its first three fields.
+		HeadlessResult simulate(int processes, GridArena* fields);
+
+	public:
+		// Parse the command line, throws std::invalid_argument on unknown, malformed or unsupported options
+		static DistributedOptions parse(int argc, char** argv);
+
+		// Print the available command line options
+		static void usage(const char* program);
+
+		// Constructor, loads the source script
+		Distributed(const DistributedOptions& options);
+
+		// Run the simulation and print the throughput, the verification and the scaling table to std::cout. Throws
+		// std::runtime_error if the verification fails.
+		void run();
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "./headless.h"
+
+// Options of an ensemble run. Every option of fluid_headless is accepted as well and sets the base options all members
+// start from.
+struct EnsembleOptions {
+	// Options shared by all members
+	HeadlessOptions base;
+
+	// File with one member per line, see Ensemble. Without it the ensemble is the single member "run".
+	std::string members;
+
+	// Every member is run for every combination of these values, an empty list keeps the value of the member
+	std::vector<float> dt_values;
+	std::vector<float> diffusion_values;
+	std::vector<float> viscosity_values;
+	std::vector<std::string> scripts;
+
+	// Number of threads running members (0: one per hardware thread, never more than there are members)
+	int jobs = 0;
+
+	// Write the frames of every member without its own --frames to <frames_dir>/<member>.frames
+	std::string frames_dir;
+
+	// Files for the machine readable results, nothing is written if empty
+	std::string json;
+	std::string csv;
+};
+
+// One simulation of the ensemble
+struct EnsembleMember {
+	std::string name;
+	HeadlessOptions options;
+};
+
+// Summary of one member after its run
+struct EnsembleResult {
+	EnsembleMember member;
+
+	// Thread that ran the member
+	int thread;
+
+	// Statistics of the run, only valid if error is empty
+	HeadlessResult result;
+	std::string error;
+};
+
+// Runs many independent simulations in one process, e.g. a sweep over dt, diffusion and viscosity. Every member owns
+// its Logic and with it its own GridArena, and runs single threaded from start to end on one thread of a
+// WorkStealingPool. The members are started in the order of decreasing cost (cells times steps), so the long runs do
+// not end up last, and idle threads steal the members left in the queues of the busy ones.
+//
+// A member file holds one member per line, a name followed by fluid_headless options that are applied on top of the
+// base options. Lines starting with '#' are comments:
+//   # name   options
+//   calm     --viscosity 0.0001 --script calm.txt
+//   storm    --viscosity 0.001 --script storm.txt --size 256
+class Ensemble {
+	private:
+		EnsembleOptions _options;
+
+		std::vector<EnsembleMember> _members;
+		std::vector<EnsembleResult> _results;
+
+		// Threads used and members stolen by idle threads in the last run
+		int _threads;
+		long _steals;
+
+		// Wall clock time of the complete ensemble
+		double _seconds;
+
+		// Members of the file (or the base member) expanded by the value lists
+		void buildMembers();
+
+	public:
+		// Parse the command line, throws std::invalid_argument on unknown or malformed options
+		static EnsembleOptions parse(int argc, char** argv);
+
+		// Print the available command line options
+		static void usage(const char* program);
+
+		// Read the member file and expand the sweep, throws std::runtime_error if the file cannot be read and
+		// std::invalid_argument for malformed members
+		Ensemble(const EnsembleOptions& options);
+
+		// Run all members, print one line per member and the throughput of the ensemble to std::cout and write the
+		// result files. Throws std::runtime_error after writing the results if a member failed.
+		void run();
+
+		const std::vector<EnsembleMember>& members() const { return _members; }
+		const std::vector<EnsembleResult>& results() const { return _results; }
+
+		// Write the results as JSON (one object per member) or as CSV with a header line
+		void writeJson(std::ostream& out) const;
+		void writeCsv(std::ostream& out) const;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+// Radix-2 complex fast Fourier transform of a fixed power-of-two length, bundled so that the spectral solver needs no
+// external library. The bit reversal and the twiddle factors are computed once in the constructor.
+//   forward: X(k) = sum over j of x(j) exp(-2 pi i j k / n)
+//   inverse: x(j) = sum over k of X(k) exp(+2 pi i j k / n), without the factor 1 / n
+// The butterflies multiply the real and imaginary parts directly instead of using the operator of std::complex,
+// which checks for infinities and NaNs on every multiplication.
+class FFT {
+	private:
+		int _n;
+
+		// Index with reversed bits for every index, only the pairs with j < reversed[j] are swapped
+		std::vector<int> _reversed;
+
+		// exp(-2 pi i k / n) for k < n / 2
+		std::vector<std::complex<float>> _twiddles;
+
+		void transform(std::complex<float>* data, bool inverse) const;
+
+	public:
+		// Transform of length n, throws std::invalid_argument unless n is a power of two
+		explicit FFT(int n = 1);
+
+		// True if n is a power of two (including 1)
+		static bool supports(int n);
+
+		int length() const { return _n; }
+
+		// In-place transforms of n consecutive values
+		void forward(std::complex<float>* data) const { transform(data, false); }
+		void inverse(std::complex<float>* data) const { transform(data, true); }
+};
+
+#endif
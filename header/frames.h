@@ -0,0 +1,235 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./grid.h"
+#include "./logic.h"
+
+// Time series of simulation fields in a chunked binary file. All numbers are stored in the byte order of the
+// machine that wrote the file (little endian on every supported platform).
+//
+//   FrameFileHeader
+//   field names, FRAME_NAME_LENGTH bytes each, zero padded
+//   for every frame: FrameChunkHeader, then for every field a uint64_t byte count and the data padded to 8 bytes
+//
+// The data of a field covers the size x size cells row by row without the row padding of a Grid.
+// A file that was cut off while writing stays readable up to the last complete frame.
+
+// Storage of the field values
+enum class FrameEncoding {
+	// 4 bytes per cell, lossless
+	Float32,
+	// IEEE half precision, 2 bytes per cell, relative error below 0.05%
+	Half16,
+	// Half precision values XORed with the previous frame and run-length encoded, keyframes store plain halves
+	Delta16
+};
+
+const char FRAME_FILE_MAGIC[8] = {'F', 'L', 'U', 'I', 'D', 'F', 'R', 'M'};
+const std::uint32_t FRAME_FILE_VERSION = 1;
+const std::uint32_t FRAME_CHUNK_MAGIC = 0x4d415246; // "FRAM"
+const std::size_t FRAME_NAME_LENGTH = 16;
+
+struct FrameFileHeader {
+	char magic[8];
+	std::uint32_t version;
+
+	// Number of grid elements in each direction and number of fields per frame
+	std::uint32_t size;
+	std::uint32_t fields;
+
+	// FrameEncoding of all fields
+	std::uint32_t encoding;
+
+	// Simulation steps between two frames and frames between two keyframes of the delta encoding
+	std::uint32_t every;
+	std::uint32_t keyframe_interval;
+
+	// Time step of the simulation
+	float dt;
+
+	std::uint32_t reserved[7];
+};
+
+struct FrameChunkHeader {
+	std::uint32_t magic;
+
+	// FRAME_KEYFRAME if the frame can be decoded without the frames before it
+	std::uint32_t flags;
+
+	// Simulation step the frame was taken after
+	std::int64_t step;
+
+	// Bytes of all fields following this header
+	std::uint64_t bytes;
+};
+
+const std::uint32_t FRAME_KEYFRAME = 1;
+
+// Settings of a frame export
+struct FrameOptions {
+	// Output file, no frames are written if empty
+	std::string path;
+
+	// Write a frame after every this many steps
+	int every = 1;
+
+	// Fields to store, any of FrameWriter::fieldNames()
+	std::vector<std::string> fields = {"density"};
+
+	FrameEncoding encoding = FrameEncoding::Half16;
+
+	// Frames between two keyframes of the delta encoding
+	int keyframe_interval = 32;
+
+	// Number of frames that can wait for the writer thread
+	int queue = 8;
+
+	// If the queue is full, drop the frame instead of waiting for the writer thread
+	bool drop = false;
+};
+
+// Writes frames on a background thread. capture() only copies the fields into a free buffer of a fixed pool and hands
+// it to the writer thread, which encodes it and writes it to disk. The simulation therefore only waits if all buffers
+// are queued (or drops the frame with FrameOptions::drop).
+class FrameWriter {
+	private:
+		// Copy of the selected fields of one step, size * size floats per field
+		struct Frame {
+			long step;
+			std::vector<float> values;
+		};
+
+		FrameOptions _options;
+		int _size;
+		std::size_t _cells;
+
+		// Index of every selected field in fieldNames()
+		std::vector<int> _field_ids;
+
+		std::FILE* _file;
+
+		// Buffers owned by the simulation (free) and by the writer thread (pending), protected by the mutex
+		std::vector<Frame> _frames;
+		std::deque<int> _free;
+		std::deque<int> _pending;
+
+		std::mutex _mutex;
+		std::condition_variable _queued;
+		std::condition_variable _released;
+		bool _stop;
+
+		// First write error of the writer thread, reported by capture() and close()
+		std::string _error;
+
+		long _written;
+		long _dropped;
+
+		// Writer thread state: halves of the previous frame for the delta encoding, the converted and run-length
+		// encoded values of one field and the encoded chunk of all fields
+		std::vector<std::uint16_t> _previous;
+		std::vector<std::uint16_t> _halves;
+		std::vector<std::uint16_t> _encoded;
+		std::vector<unsigned char> _chunk;
+
+		std::thread _thread;
+
+		void work();
+
+		// Encode and write one frame, throws std::runtime_error if the file cannot be written
+		void writeFrame(const Frame& frame);
+		void writeBytes(const void* data, std::size_t bytes);
+
+	public:
+		// Names of the fields that can be exported
+		static const std::vector<std::string>& fieldNames();
+
+		// Create the file, write its header and start the writer thread. Throws std::invalid_argument for unknown
+		// fields and std::runtime_error if the file cannot be created.
+		FrameWriter(const FrameOptions& options, int size, float dt);
+		~FrameWriter();
+
+		FrameWriter(const FrameWriter&) = delete;
+		FrameWriter& operator=(const FrameWriter&) = delete;
+
+		// Should a frame be written after the given step (counted from 1)?
+		bool due(long step) const { return step % _options.every == 0; }
+
+		// Copy the selected fields and queue them for writing. Returns false if the frame was dropped.
+		bool capture(const Logic& logic, long step);
+
+		// Write all queued frames and close the file, throws std::runtime_error if writing failed
+		void close();
+
+		// Frames written to disk and frames dropped because the queue was full
+		long written();
+		long dropped();
+};
+
+// Random access to the frames of a file written by FrameWriter. The file is memory-mapped, opening it only scans the
+// chunk headers, and reading a frame decodes it straight from the mapping.
+class FrameReader {
+	private:
+		struct Entry {
+			long step;
+			bool keyframe;
+
+			// Offset of the data of every field in the file and its size in bytes
+			std::vector<std::size_t> offsets;
+			std::vector<std::size_t> bytes;
+		};
+
+		const unsigned char* _data;
+		std::size_t _length;
+
+		FrameFileHeader _header;
+		std::vector<std::string> _fields;
+		std::vector<Entry> _entries;
+
+		// Decoded halves of the last delta frame read per field, sequential reads only apply one delta
+		std::vector<std::vector<std::uint16_t>> _decoded;
+		std::vector<long> _decoded_frame;
+
+		// Decode the halves of a delta encoded field, frame by frame from the last keyframe
+		const std::uint16_t* decodeDelta(std::size_t frame, int field);
+
+	public:
+		// Map the file and index its frames, throws std::runtime_error if it is no frame file
+		FrameReader(const std::string& path);
+		~FrameReader();
+
+		FrameReader(const FrameReader&) = delete;
+		FrameReader& operator=(const FrameReader&) = delete;
+
+		int size() const { return static_cast<int>(_header.size); }
+		float dt() const { return _header.dt; }
+		int every() const { return static_cast<int>(_header.every); }
+		FrameEncoding encoding() const { return static_cast<FrameEncoding>(_header.encoding); }
+		const std::vector<std::string>& fields() const { return _fields; }
+
+		// Index of the field with the given name, throws std::invalid_argument if the file does not contain it
+		int field(const std::string& name) const;
+
+		// Number of complete frames and the step of a frame
+		std::size_t frames() const { return _entries.size(); }
+		long step(std::size_t frame) const { return _entries.at(frame).step; }
+		bool keyframe(std::size_t frame) const { return _entries.at(frame).keyframe; }
+
+		// Bytes the field takes in the given frame
+		std::size_t bytes(std::size_t frame, int field) const { return _entries.at(frame).bytes.at(field); }
+
+		// Decode a field of a frame into size * size floats, row by row
+		void read(std::size_t frame, int field, float* values);
+
+		// Decode a field of a frame into a grid of the same size
+		void read(std::size_t frame, int field, Grid& grid);
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "./half.h"
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// Alignment of every field in bytes. 64 bytes is one cache line and one AVX-512 register,
+// so every field starts on a boundary suitable for aligned vector loads.
+const std::size_t GRID_ALIGNMENT = 64;
+
+// Number format a field is stored in. The kernels always compute in float, reduced precision fields are converted when
+// they are loaded and stored, which halves the memory and the memory traffic of the field.
+enum class Precision {
+	Float,
+	// IEEE 754 half: 11 significant bits, largest value 65504
+	Half,
+	// Upper half of a float: 8 significant bits, the range of a float
+	BFloat16
+};
+
+// Element type of every precision and its conversion to and from float. Kernels are instantiated for each of them by
+// withStorage, so a float field compiles to the same code as a plain float array.
+struct FloatStorage {
+	typedef float Element;
+	static float load(Element value) { return value; }
+	static Element store(float value) { return value; }
+};
+
+struct HalfStorage {
+	typedef std::uint16_t Element;
+#if defined(__F16C__)
+	static float load(Element value) { return _cvtsh_ss(value); }
+	static Element store(float value) { return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT); }
+#else
+	static float load(Element value) { return halfToFloat(value); }
+	static Element store(float value) { return floatToHalf(value); }
+#endif
+};
+
+struct BFloat16Storage {
+	typedef std::uint16_t Element;
+	static float load(Element value) { return bfloat16ToFloat(value); }
+	static Element store(float value) { return floatToBFloat16(value); }
+};
+
+// Call body(storage) with the storage type of the precision
+template <typename Body>
+void withStorage(Precision precision, Body&& body) {
+	switch (precision) {
+		case Precision::Half:
+			body(HalfStorage());
+			break;
+		case Precision::BFloat16:
+			body(BFloat16Storage());
+			break;
+		default:
+			body(FloatStorage());
+	}
+}
+
+// Bytes of one element and the name used on the command line ("float", "half" or "bf16")
+std::size_t elementBytes(Precision precision);
+const char* precisionName(Precision precision);
+
+// Precision for a name, throws std::invalid_argument for unknown names
+Precision parsePrecision(const std::string& name);
+
+// Non-owning view onto one scalar field of size x size grid elements, stored row by row.
+// The outer ring of elements (x or y equal to 0 or size - 1) is the ghost-cell halo, it holds the
+// boundary values written by Physics::setBnd. The interior elements 1 .. size - 2 therefore always
+// have all four neighbours and stencils need no bounds checks.
+// Rows are padded to a multiple of GRID_ALIGNMENT floats so that every row of a float field starts aligned, the padding
+// stays zero. The index of an element is the same for every precision.
+// The memory behind a Grid is owned by a GridArena.
+class Grid {
+	private:
+		// First element of the field
+		void* _data;
+
+		// Number of grid elements in each direction (x and y are both equal)
+		int _size;
+
+		// Distance between the first elements of two neighbouring rows in elements
+		int _stride;
+
+		Precision _precision;
+
+	public:
+		// Constructor for an empty view and for a view onto existing memory
+		Grid();
+		Grid(float* data, int size, int stride);
+		Grid(void* data, int size, int stride, Precision precision);
+
+		// Row stride used for fields of the given size
+		static constexpr int rowStride(int size) {
+			const int floats_per_line = GRID_ALIGNMENT / sizeof(float);
+			return (size + floats_per_line - 1) / floats_per_line * floats_per_line;
+		}
+
+		// Element access with an index computed by index() or clampedIndex(), only for Precision::Float
+		float& operator[](int index) { return static_cast<float*>(_data)[index]; }
+		const float& operator[](int index) const { return static_cast<const float*>(_data)[index]; }
+
+		// Element access for every precision
+		float load(int index) const;
+		void store(int index, float value);
+
+		// Convert count consecutive elements starting at index to and from floats
+		void load(int index, int count, float* values) const;
+		void store(int index, int count, const float* values);
+
+		// Set count consecutive elements starting at index to zero
+		void zero(int index, int count);
+
+		// Index of the element (x, y), both have to lie in [0, size - 1]
+		int index(int x, int y) const { return y * _stride + x; }
+
+		// Index of the element (x, y) after moving coordinates outside of the grid onto its closest edge.
+		// Only needed for positions that can leave the domain, e.g. user input.
+		int clampedIndex(int x, int y) const {
+			x = x < 0 ? 0 : (x > _size - 1 ? _size - 1 : x);
+			y = y < 0 ? 0 : (y > _size - 1 ? _size - 1 : y);
+			return index(x, y);
+		}
+
+		// Number of grid elements in each direction
+		int size() const { return _size; }
+
+		// Distance between two rows, the element below index is index + stride()
+		int stride() const { return _stride; }
+
+		// Total number of grid elements, i.e. size * size
+		int cells() const { return _size * _size; }
+
+		// Number of stored elements including the row padding, i.e. size * stride
+		int elements() const { return _size * _stride; }
+
+		Precision precision() const { return _precision; }
+
+		// Raw access to the underlying memory of a float field
+		float* data() { return static_cast<float*>(_data); }
+		const float* data() const { return static_cast<const float*>(_data); }
+
+		// Raw access with the element type of the storage, e.g. values<HalfStorage>() inside withStorage
+		template <typename Storage>
+		typename Storage::Element* values() { return static_cast<typename Storage::Element*>(_data); }
+		template <typename Storage>
+		const typename Storage::Element* values() const { return static_cast<const typename Storage::Element*>(_data); }
+
+		// Iteration over all stored floats of a float field including the (zero) row padding
+		float* begin() { return data(); }
+		float* end() { return data() + elements(); }
+		const float* begin() const { return data(); }
+		const float* end() const { return data() + elements(); }
+
+		// Set every element of the field to the given value
+		void fill(float value);
+};
+
+// Owns a single aligned allocation that holds a fixed number of equally sized fields.
+// All fields of a simulation live next to each other in one arena, each one starting
+// on a GRID_ALIGNMENT boundary. Every field has its own precision.
+class GridArena {
+	private:
+		// Start of the aligned allocation
+		unsigned char* _memory;
+
+		// Number of grid elements in each direction
+		int _size;
+
+		// Distance between the first elements of two neighbouring rows in elements
+		int _row_stride;
+
+		// Precision and offset in bytes of every field, and the size of the allocation
+		std::vector<Precision> _precisions;
+		std::vector<std::size_t> _offsets;
+		std::size_t _bytes;
+
+		// Memory mapped from a file by map() instead of allocated
+		bool _mapped;
+
+		// Arena for the given memory, used by map()
+		GridArena(unsigned char* memory, int size, const std::vector<Precision>& precisions, bool mapped);
+
+		void release();
+
+	public:
+		// Allocate memory for the given number of float fields or for fields of the given precisions, all initialized
+		// to zero
+		GridArena(int size, int fields);
+		GridArena(int size, const std::vector<Precision>& precisions);
+		~GridArena();
+
+		// An arena owns its memory, so it can only be moved
+		GridArena(const GridArena&) = delete;
+		GridArena& operator=(const GridArena&) = delete;
+		GridArena(GridArena&& other) noexcept;
+		GridArena& operator=(GridArena&& other) noexcept;
+
+		// Map fields stored in a file (e.g. by Checkpoint) instead of allocating them. The offset has to be a multiple of
+		// the page size. The mapping is private: pages are only read from the file when they are first touched and
+		// changes never go back to the file. Throws std::runtime_error if the file is too short or cannot be mapped.
+		static GridArena map(const std::string& path, std::size_t offset, int size, const std::vector<Precision>& precisions);
+
+		// Size in bytes of an arena with fields of the given precisions
+		static std::size_t layoutBytes(int size, const std::vector<Precision>& precisions);
+
+		// View onto the field with the given index (0 <= index < fields)
+		Grid field(int index);
+
+		// All fields including the row padding, bytes() bytes long
+		const void* data() const { return _memory; }
+
+		int size() const { return _size; }
+		int stride() const { return _row_stride; }
+		int fields() const { return static_cast<int>(_precisions.size()); }
+		Precision precision(int field) const { return _precisions[field]; }
+		const std::vector<Precision>& precisions() const { return _precisions; }
+
+		// Size of the complete allocation in bytes
+		std::size_t bytes() const { return _bytes; }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// Conversion between float and IEEE 754 half precision (1 sign, 5 exponent and 10 mantissa bits) stored in a uint16_t.
+// Floats are rounded to the nearest half (ties to even), values beyond the half range become infinity.
+// The scalar versions give the same results as the F16C instructions, which are used for arrays when available.
+
+inline std::uint16_t floatToHalf(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	std::uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	std::uint16_t half;
+	if (bits >= 0x47800000u) {
+		// Too large for a half, infinity or NaN
+		half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+	} else if (bits < 0x38800000u) {
+		// Subnormal half or zero: adding 0.5 aligns the 10 mantissa bits at the bottom of the float and lets the
+		// floating point addition do the rounding
+		const std::uint32_t magic_bits = 126u << 23;
+		float magic, sum;
+		std::memcpy(&magic, &magic_bits, sizeof(magic));
+		std::memcpy(&sum, &bits, sizeof(sum));
+		sum += magic;
+		std::uint32_t sum_bits;
+		std::memcpy(&sum_bits, &sum, sizeof(sum_bits));
+		half = static_cast<std::uint16_t>(sum_bits - magic_bits);
+	} else {
+		// Normal half: rebias the exponent and round the 13 dropped mantissa bits to even
+		std::uint32_t odd = (bits >> 13) & 1;
+		bits += (static_cast<std::uint32_t>(15 - 127) << 23) + 0xfff + odd;
+		half = static_cast<std::uint16_t>(bits >> 13);
+	}
+	return static_cast<std::uint16_t>(half | (sign >> 16));
+}
+
+inline float halfToFloat(std::uint16_t half) {
+	const std::uint32_t exponent_mask = 0x7c00u << 13;
+	std::uint32_t bits = (half & 0x7fffu) << 13;
+	std::uint32_t exponent = bits & exponent_mask;
+	bits += static_cast<std::uint32_t>(127 - 15) << 23;
+
+	float value;
+	if (exponent == exponent_mask) {
+		// Infinity or NaN
+		bits += static_cast<std::uint32_t>(128 - 16) << 23;
+		std::memcpy(&value, &bits, sizeof(value));
+	} else if (exponent == 0) {
+		// Subnormal half: renormalize by subtracting the implicit one again
+		const std::uint32_t magic_bits = 113u << 23;
+		float magic;
+		std::memcpy(&magic, &magic_bits, sizeof(magic));
+		bits += 1u << 23;
+		std::memcpy(&value, &bits, sizeof(value));
+		value -= magic;
+	} else {
+		std::memcpy(&value, &bits, sizeof(value));
+	}
+
+	std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+	std::memcpy(&bits, &value, sizeof(bits));
+	bits |= sign;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Conversion between float and bfloat16, the upper half of a float (1 sign, 8 exponent and 7 mantissa bits). It keeps the
+// range of a float with less precision than a half. Floats are rounded to the nearest bfloat16 (ties to even).
+inline std::uint16_t floatToBFloat16(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	if ((bits & 0x7fffffffu) > 0x7f800000u)
+		return static_cast<std::uint16_t>((bits >> 16) | 0x40);
+	bits += 0x7fffu + ((bits >> 16) & 1);
+	return static_cast<std::uint16_t>(bits >> 16);
+}
+
+inline float bfloat16ToFloat(std::uint16_t bfloat16) {
+	std::uint32_t bits = static_cast<std::uint32_t>(bfloat16) << 16;
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Convert count values, eight at a time with F16C
+inline void floatsToHalves(const float* values, std::uint16_t* halves, std::size_t count) {
+	std::size_t k = 0;
+#if defined(__F16C__)
+	for (; k + 8 <= count; k += 8) {
+		__m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(values + k), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(halves + k), packed);
+	}
+#endif
+	for (; k < count; k++)
+		halves[k] = floatToHalf(values[k]);
+}
+
+inline void halvesToFloats(const std::uint16_t* halves, float* values, std::size_t count) {
+	std::size_t k = 0;
+#if defined(__F16C__)
+	for (; k + 8 <= count; k += 8)
+		_mm256_storeu_ps(values + k, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + k))));
+#endif
+	for (; k < count; k++)
+		values[k] = halfToFloat(halves[k]);
+}
+
+inline void floatsToBFloat16s(const float* values, std::uint16_t* bfloat16s, std::size_t count) {
+	for (std::size_t k = 0; k < count; k++)
+		bfloat16s[k] = floatToBFloat16(values[k]);
+}
+
+inline void bfloat16sToFloats(const std::uint16_t* bfloat16s, float* values, std::size_t count) {
+	for (std::size_t k = 0; k < count; k++)
+		values[k] = bfloat16ToFloat(bfloat16s[k]);
+}
+
+#endif
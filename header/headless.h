@@ -0,0 +1,210 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "./frames.h"
+#include "./logic.h"
+
+// Options of a headless run, all of them can be set on the command line
+struct HeadlessOptions {
+	// Number of grid elements in each direction
+	int size = SIZE;
+
+	// Number of simulation steps to run
+	int steps = 1000;
+
+	// Time step, diffusion coefficient and viscosity passed to Logic
+	float dt = 0.1f;
+	float diffusion = 0.0f;
+	float viscosity = 0.0005f;
+
+	// Backend and cycle type for the pressure equation
+	ProjectionSolver projection = ProjectionSolver::GaussSeidel;
+	Multigrid::Cycle cycle = Multigrid::VCycle;
+
+	// Relative residual tolerance of the pressure solve (multigrid and Gauss Seidel) and maximum Gauss Seidel sweeps
+	float tolerance = 1e-4f;
+	int projection_iterations = 1;
+
+	// Maximum number of iterations and relative residual tolerance of the diffusion (0: always run all iterations)
+	int diffusion_iterations = 16;
+	float diffusion_tolerance = 1e-4f;
+
+	// Norm of the Gauss Seidel residuals and warm start of the pressure solve from the previous pressure
+	ResidualNorm residual_norm = ResidualNorm::L2;
+	bool warm_start = true;
+
+	// Scheme of the advection of the velocity and the density
+	AdvectionScheme advection = AdvectionScheme::SemiLagrangian;
+
+	// Boundaries of the box: closed walls, periodic in both directions or open outflow
+	Domain domain = Domain::Walls;
+
+	// Relaxation scheme of the diffusion and number of threads used by it
+	Relaxation relaxation = Relaxation::GaussSeidel;
+	int threads = 1;
+
+	// Only simulate the tiles where the density or the speed exceed the threshold, see ActiveTiles
+	bool active_tiles = false;
+	float tile_threshold = 1e-3f;
+
+	// Storage precision of the transported fields, see FieldPrecisions
+	FieldPrecisions precisions;
+
+	// Repeat the run with all fields in float afterwards and report how far the reduced precision run deviates
+	bool accuracy = false;
+
+	// Apply Logic::fadeDensity after every step like the interactive simulation does
+	bool fade = true;
+
+	// Tracer particles seeded uniformly over the box before the first step, and their lifetime (0: forever)
+	int particles = 0;
+	float particle_lifetime = 0.0f;
+
+	// Optional file with the sources to inject, see SourceScript
+	std::string script;
+
+	// Print per-stage statistics and write a Chrome trace, both need a build with FLUIDSIM_PROFILE
+	bool profile = false;
+	std::string trace;
+
+	// Export of the fields to a frame file, disabled if frames.path is empty
+	FrameOptions frames;
+
+	// Checkpoint file written every checkpoint_every steps (0: never), on SIGUSR1 and at the end of the run
+	std::string checkpoint;
+	int checkpoint_every = 0;
+
+	// Continue the run saved in this checkpoint, steps then counts the total steps including the restored ones
+	std::string restore;
+};
+
+// One entry of a source script. The source is applied before every step in [first_step, last_step].
+struct SourceEvent {
+	enum Type { Density, Velocity, Particles };
+
+	Type type;
+	int first_step;
+	int last_step;
+
+	// Grid position of the source
+	float x;
+	float y;
+
+	// Amount of density, velocity in x and y direction, or number of particles
+	float amount_x;
+	float amount_y;
+};
+
+// Replaces the mouse input of the interactive simulation. Each non-empty line of a script has the form
+//   <step>[-<last step>] density <x> <y> <amount>
+//   <step>[-<last step>] velocity <x> <y> <velocity x> <velocity y>
+//   <step>[-<last step>] particles <x> <y> <count>
+// where the step may also be '*' to apply the source before every step. Lines starting with '#' are comments.
+class SourceScript {
+	private:
+		std::vector<SourceEvent> _events;
+
+	public:
+		// Parse the script file, throws std::runtime_error with the line number on malformed input
+		static SourceScript load(const std::string& path);
+
+		// Add all sources which are active in the given step to the simulation (Logic or DistributedLogic), a last step
+		// of -1 means every step
+		template <typename Simulation>
+		void apply(Simulation& simulation, int step) const {
+			for (const SourceEvent& event : _events) {
+				if (step < event.first_step || (event.last_step >= 0 && step > event.last_step))
+					continue;
+				if (event.type == SourceEvent::Density)
+					simulation.addDensity(event.x, event.y, event.amount_x);
+				else if (event.type == SourceEvent::Particles)
+					simulation.addParticles(event.x, event.y, static_cast<int>(event.amount_x));
+				else
+					simulation.addVelocity(event.x, event.y, event.amount_x, event.amount_y);
+			}
+		}
+
+		const std::vector<SourceEvent>& events() const { return _events; }
+};
+
+// Outcome of a headless run
+struct HeadlessResult {
+	// Steps made by this run (without the restored ones) and their wall clock time
+	long steps;
+	double seconds;
+
+	// Sum and maximum of the density and kinetic energy 0.5 * (u^2 + v^2) summed over the grid after the last step
+	double mass;
+	double max_density;
+	double kinetic_energy;
+
+	// Mean iterations per step and last relative residual of the diffusion and the pressure solves
+	double diffusion_iterations;
+	double projection_iterations;
+	float diffusion_residual;
+	float projection_residual;
+
+	// Mean number of active tiles per step, 0 without active tiles
+	double active_tiles;
+
+	// Tracer particles alive after the last step
+	long particles;
+
+	// Frames written and dropped by the frame export
+	long frames_written;
+	long frames_dropped;
+};
+
+// Parse a precision specification of the command line: a single precision for all transported fields or a comma
+// separated list of field=precision with the fields velocity, previous-velocity, density and previous-density.
+// Throws std::invalid_argument on unknown fields or precisions.
+FieldPrecisions parseFieldPrecisions(const std::string& text);
+
+// Runs the solver at full speed without a window and reports its throughput
+class Headless {
+	private:
+		HeadlessOptions _options;
+
+		SourceScript _script;
+
+		// Step the run starts with, non-zero after restoring a checkpoint
+		long _first_step;
+
+		Logic _logic;
+
+		// Writes the frames on its own thread while the simulation continues
+		std::unique_ptr<FrameWriter> _frames;
+
+	public:
+		// Parse the command line on top of the given options, throws std::invalid_argument on unknown or malformed
+		// options
+		static HeadlessOptions parse(int argc, char** argv, HeadlessOptions options = HeadlessOptions());
+
+		// Print the available command line options
+		static void usage(const char* program);
+
+		// Convert the value of a command line option, the complete text has to be a number. Throws
+		// std::invalid_argument otherwise, also used by the tools that pass their other options on to parse
+		static int toInt(const std::string& option, const std::string& text);
+		static float toFloat(const std::string& option, const std::string& text);
+
+		// Constructor, loads the source script and restores the checkpoint if one is given
+		Headless(const HeadlessOptions& options);
+
+		// Run all steps, close the frame file and write the final checkpoint without printing anything. Several
+		// instances can simulate on different threads, SIGUSR1 checkpoints are only requested by run().
+		HeadlessResult simulate();
+
+		// Run all steps and print steps per second to std::cout
+		void run();
+
+		const HeadlessOptions& options() const { return _options; }
+
+		// The simulation, its fields hold the state after the last step once simulate() returned
+		const Logic& logic() const { return _logic; }
+};
+
+#endif
@@ -1,11 +1,36 @@
 #ifndef LOGIC_H
 #define LOGIC_H
 
+#include<memory>
 #include<vector>
-#include<SFML/Graphics.hpp>
+#include "./particles.h"
 #include "./physics.h"
+#include "./grid.h"
+#include "./tiles.h"
 #include "./const.h"
-#include <array>
+
+// Work done by the linear solvers in one step of Logic
+struct SolverStatistics {
+	// Iterations of the three diffusion solves and of the two pressure solves together
+	int diffusion_iterations;
+	int projection_iterations;
+
+	// Largest relative residual of the diffusion solves and of the pressure solves
+	float diffusion_residual;
+	float projection_residual;
+};
+
+// Storage precision of the transported fields of Logic. The pressure and the divergence are always stored in float:
+// the projection iterates on them until the residual tolerance, which a 16 bit pressure could not reach.
+struct FieldPrecisions {
+	Precision velocity = Precision::Float;
+	Precision previous_velocity = Precision::Float;
+	Precision density = Precision::Float;
+	Precision previous_density = Precision::Float;
+
+	// Precisions of the FIELDS fields of the arena of a Logic instance in the order of Logic
+	std::vector<Precision> fields() const;
+};
 
 // This class makes the computation of the fluid behaviour
 class Logic {
@@ -26,37 +51,106 @@ class Logic {
 		// Viscosity attribute
 		float _viscosity;
 
+		// One aligned allocation holding all fields below
+		GridArena _arena;
+
 		// Velocity in x and y
-		std::array<float, SIZE*SIZE> _velocity_x;
-		std::array<float, SIZE*SIZE> _velocity_y;
+		Grid _velocity_x;
+		Grid _velocity_y;
 
 		// Change of velocity in x and y direction
-		std::array<float, SIZE*SIZE> _previous_velocity_x;
-		std::array<float, SIZE*SIZE> _previous_velocity_y;
+		Grid _previous_velocity_x;
+		Grid _previous_velocity_y;
 
 		// Density and previous density at a given spot
-		std::array<float, SIZE*SIZE> _previous_density;
-		std::array<float, SIZE*SIZE> _density;
+		Grid _previous_density;
+		Grid _density;
+
+		// Pressure of the last projection of the diffused and of the advected velocity. The right hand sides of the two
+		// projections differ, so each one starts from its own result of the previous step.
+		Grid _pressure_diffused;
+		Grid _pressure_advected;
+
+		// Divergence removed by the last projection
+		Grid _divergence;
+
+		// Maximum number of iterations of each diffusion solve
+		int _diffusion_iterations;
+
+		// Tiles holding smoke or motion, the kernels process the complete grid if there are none
+		std::unique_ptr<ActiveTiles> _tiles;
+
+		// Tracers carried by the velocity field, none until they are seeded
+		Particles _particles;
+
+		SolverStatistics _statistics;
 			
 	public:
-		// Constructor
-		Logic(float dt, float diff, float visc);
+		// Number of fields stored in the arena of a Logic instance
+		static const int FIELDS = 9;
+
+		// Constructor, size is the number of grid elements in each direction. All fields are stored in float unless
+		// other precisions are given.
+		Logic(int size, float dt, float diff, float visc, const FieldPrecisions& precisions = FieldPrecisions());
+
+		// Continue a simulation whose fields are stored in the given arena (e.g. restored by Checkpoint).
+		// Throws std::invalid_argument if the arena does not hold FIELDS fields or the pressure or divergence is not
+		// stored in float.
+		Logic(GridArena arena, float dt, float diff, float visc);
 
 		// Adds density at the spot where the mouse is clicked
 		void addDensity(float x, float y, float amount);
 		
 		// Adds velocity to the fluid elements where the mouse is dragged over
 		void addVelocity(float x, float y, float px, float py);
+
+		// Seeds count tracer particles spread over the cell at (x, y)
+		void addParticles(float x, float y, int count);
 		
 		// Makes one simulation step by solving the physical behaviour 
 		void step();
 		
-		// Refreshe the image displayed during simulation
-		void render(sf::RenderWindow& win);
-		
 		// Let the density fade over time so to not fill the complete image
 		// UNPHYSICAL BEHAVIOR!!
-		void fadeDensity(int size);
+		void fadeDensity();
+
+		// Number of grid elements in each direction
+		int size() const { return _size; }
+
+		// Maximum number of iterations of each diffusion solve (default 16), see Physics for the tolerances
+		void setDiffusionIterations(int iterations) { _diffusion_iterations = iterations; }
+		int diffusionIterations() const { return _diffusion_iterations; }
+
+		// Only simulate the tiles where the density or the speed exceed the threshold and their surroundings, see
+		// ActiveTiles. Disabled by default, the complete grid is simulated then.
+		void setActiveTiles(bool enabled, float threshold = 1e-3f);
+		const ActiveTiles* activeTiles() const { return _tiles.get(); }
+
+		// Iterations and residuals of the linear solvers in the last step
+		const SolverStatistics& statistics() const { return _statistics; }
+
+		// Parameters passed to the constructor
+		float dt() const { return _dt; }
+		float diffusion() const { return _diffusion_coefficient; }
+		float viscosity() const { return _viscosity; }
+
+		// Storage precision of the transported fields
+		FieldPrecisions precisions() const;
+
+		// Memory of all fields, the complete state of the simulation besides the parameters
+		const GridArena& arena() const { return _arena; }
+
+		// Solver settings and statistics of the physics kernels
+		Physics& physics() { return _physics; }
+
+		// Tracer particles, advected at the end of every step. They are not part of the arena and not checkpointed.
+		Particles& particles() { return _particles; }
+		const Particles& particles() const { return _particles; }
+
+		// Read access to the current state of the simulation
+		const Grid& density() const { return _density; }
+		const Grid& velocity_x() const { return _velocity_x; }
+		const Grid& velocity_y() const { return _velocity_y; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include <vector>
+#include "./grid.h"
+
+// Geometric multigrid solver for the pressure equation of Physics::project
+//   4 p(i,j) - p(i+1,j) - p(i-1,j) - p(i,j+1) - p(i,j-1) = div(i,j)
+// on the interior cells with zero-gradient (Neumann) boundaries, i.e. the outer ring of cells copies its neighbour.
+// Each level halves the number of interior cells, smoothing is done with red-black Gauss Seidel sweeps.
+class Multigrid {
+	public:
+		// V-cycles starting from the given pressure, or a full multigrid pass followed by V-cycles.
+		// The full multigrid pass builds its own initial guess and ignores the given pressure.
+		enum Cycle { VCycle, FullMultigrid };
+
+		// Outcome of one solve
+		struct Result {
+			// Number of V-cycles used (the full multigrid pass counts as one)
+			int iterations;
+
+			// L2 norm of the residual relative to the L2 norm of the right hand side
+			float residual;
+		};
+
+	private:
+		// One level of the grid hierarchy, level 0 works directly on the fields passed to solve
+		struct Level {
+			// Number of interior cells in each direction
+			int n;
+
+			// Memory of the coarse level fields and of the residual
+			GridArena arena;
+
+			Grid p;
+			Grid rhs;
+			Grid residual;
+
+			// Coarse grid correction interpolated to this level
+			Grid correction;
+
+			Level(int interior, int fields);
+		};
+
+		std::vector<Level> _levels;
+
+		Cycle _cycle;
+
+		// Stop as soon as the relative residual drops below the tolerance or after the maximum number of cycles
+		float _tolerance;
+		int _max_cycles;
+
+		// Red-black sweeps before and after the coarse grid correction
+		int _pre_smoothing;
+		int _post_smoothing;
+
+		// Create the grid hierarchy for a field of the given size (including the boundary cells)
+		void build(int size);
+
+		void smooth(Level& level, int sweeps);
+		void solveCoarsest(Level& level);
+		void vcycle(int index);
+
+		// Residual of the pressure equation, returns its L2 norm
+		float computeResidual(Level& level);
+
+		// Transfer between the levels: average the residual to the coarse level, interpolate the coarse pressure bilinearly
+		void restrictResidual(const Level& fine, Level& coarse);
+		void restrictRhs(const Level& fine, Level& coarse);
+		void prolongate(Level& coarse, Level& fine, Grid& target);
+
+		// Add the interpolated coarse grid correction with the step length that minimizes the energy norm of the error
+		void correct(Level& level);
+
+	public:
+		Multigrid();
+
+		void setCycle(Cycle cycle) { _cycle = cycle; }
+		void setTolerance(float tolerance) { _tolerance = tolerance; }
+		void setMaxCycles(int cycles) { _max_cycles = cycles; }
+		void setSmoothing(int pre, int post) { _pre_smoothing = pre; _post_smoothing = post; }
+
+		Cycle cycle() const { return _cycle; }
+		float tolerance() const { return _tolerance; }
+		int maxCycles() const { return _max_cycles; }
+		int preSmoothing() const { return _pre_smoothing; }
+		int postSmoothing() const { return _post_smoothing; }
+
+		// Number of levels of the current hierarchy
+		int levels() const { return static_cast<int>(_levels.size()); }
+
+		// Solve for p, the current content of p is used as initial guess.
+		// The mean of div is removed first, as only a right hand side without mean has a solution with Neumann boundaries.
+		Result solve(Grid& p, Grid& div);
+};
+
+#endif
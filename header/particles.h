@@ -0,0 +1,98 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+#include "./boundary.h"
+#include "./grid.h"
+#include "./thread_pool.h"
+
+// Passive tracer particles carried along by the velocity field. The positions are grid coordinates like the backtrace of
+// Physics::advect: x is the column and y the row of the grid, the cell (i, j) is centred at (i, j).
+// The particles are stored as a structure of arrays in one pooled allocation: x, y and age each fill CHUNK-aligned
+// arrays of capacity() floats, so the advection streams through three contiguous arrays with aligned vector loads.
+// The particles are kept sorted by row, see SORT_INTERVAL. The pool only grows. Seeding writes into the free end of the
+// arrays and retiring compacts the live particles, so a steady stream of particles allocates nothing after the first
+// steps.
+class Particles {
+	public:
+		// Particles per chunk: the capacity is a multiple of it and the thread pool splits the advection into chunks
+		static const int CHUNK = 4096;
+
+		// Advections between two sorts. The particles of a row gather the velocity of the same two rows, which stay in
+		// the cache. Without the sort every particle of a large grid misses the cache, so after random seeding the
+		// advection is several times slower. In a few steps the particles only move a few rows, so the order stays
+		// nearly sorted in between.
+		static const int SORT_INTERVAL = 8;
+
+	private:
+		// Frees the aligned pool
+		struct AlignedDelete {
+			void operator()(float* memory) const { ::operator delete(memory, std::align_val_t(GRID_ALIGNMENT)); }
+		};
+
+		std::unique_ptr<float, AlignedDelete> _memory;
+
+		// Pool of the same capacity the sort scatters into, swapped with _memory afterwards (allocated on first use)
+		std::unique_ptr<float, AlignedDelete> _scratch;
+
+		// Number of live particles and of particles the pool has room for
+		int _count;
+		int _capacity;
+
+		// Particles whose age reaches the lifetime are retired at the end of the next advection
+		float _lifetime;
+
+		// State of the xorshift generator of the seeded positions, the same seeds give the same particles
+		std::uint32_t _random;
+
+		// Particles marked for retirement during the last advection, per chunk
+		std::vector<int> _expired;
+
+		// Advections since the last sort, and the first particle of every row during a sort
+		int _unsorted;
+		std::vector<int> _rows;
+
+		// Random number in [0, 1)
+		float random();
+
+		// Make room for at least count particles, keeping the live ones
+		void reserve(int count);
+
+		// Remove the particles whose age reached the lifetime, the order of the others is kept
+		void retire();
+
+		// Counting sort of the particles by the grid row they are in, keeping the order within a row
+		void sort(int size);
+
+	public:
+		Particles();
+
+		// Seed count particles uniformly distributed over the rectangle [x0, x1) x [y0, y1) with age 0
+		void seed(float x0, float y0, float x1, float y1, int count);
+
+		// Move every particle by one time step of the velocity field with the midpoint rule (RK2), sampling the velocity
+		// bilinearly. The chunks are split across the pool if one is given. Walls keep the particles inside the box,
+		// a periodic domain wraps them around and an open domain retires the particles that leave it.
+		void advect(const Grid& vx, const Grid& vy, float dt, Domain domain, ThreadPool* pool);
+
+		// Remove all particles, the pool keeps its memory
+		void clear() { _count = 0; }
+
+		// Age in time units after which a particle is retired (default: never)
+		void setLifetime(float lifetime) { _lifetime = lifetime; }
+		float lifetime() const { return _lifetime; }
+
+		int count() const { return _count; }
+		int capacity() const { return _capacity; }
+
+		// Positions and ages of the live particles, count() values each
+		const float* x() const { return _memory.get(); }
+		const float* y() const { return _memory.get() + _capacity; }
+		const float* age() const { return _memory.get() + 2 * static_cast<std::size_t>(_capacity); }
+};
+
+#endif
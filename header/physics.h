@@ -1,28 +1,261 @@
-#include "./const.h"
-#include <array>
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include "./boundary.h"
+#include "./grid.h"
+#include "./multigrid.h"
+#include "./spectral.h"
+#include "./thread_pool.h"
+#include "./tiles.h"
 #include <cmath>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <memory>
+
+
+// Backends for the pressure equation solved in Physics::project
+enum class ProjectionSolver {
+	// One lexicographic Gauss Seidel sweep
+	GaussSeidel,
+	// Geometric multigrid until the residual tolerance is reached
+	Multigrid,
+	// Red-black Gauss Seidel sweeps, the rows of one colour are split across the thread pool
+	RedBlack,
+	// Exact projection in Fourier space, only for periodic domains of 2^k + 2 cells (see Spectral)
+	Spectral
+};
 
+// Relaxation schemes for the linear systems of diffuse
+enum class Relaxation {
+	// Lexicographic Gauss Seidel, every cell depends on the cells updated before it (single threaded)
+	GaussSeidel,
+	// Red-black Gauss Seidel, all cells of one colour are independent and split by rows across the thread pool
+	RedBlack,
+	// Direct solve in Fourier space, only for periodic domains of 2^k + 2 cells (see Spectral)
+	Spectral
+};
+
+// Schemes of Physics::advect. The corrected schemes assume a divergence free velocity, with a projection that stops far
+// from convergence their corrections add mass.
+enum class AdvectionScheme {
+	// One bilinear backtrace, first order and strongly diffusive
+	SemiLagrangian,
+	// Forward and backward backtrace, the result is corrected by half the error of the round trip (second order)
+	MacCormack,
+	// Back and Forth Error Compensation and Correction: the source is corrected by half the error of the round trip and
+	// advected once more (second order, one backtrace more than MacCormack)
+	BFECC
+};
 
+// Norm of the residual checked by the Gauss Seidel solvers, always relative to the same norm of the right hand side
+enum class ResidualNorm {
+	// Root of the sum of squares over the interior cells
+	L2,
+	// Largest absolute value over the interior cells
+	Max
+};
+
+// One field moved by Physics::advect: d is interpolated from d0, b is its boundary in a closed box
+struct AdvectedField {
+	Boundary b;
+	Grid d;
+	Grid d0;
+};
+
+// All methods take the size of the simulation from the fields they work on
 class Physics {
 private:
+	// Solver used for the pressure equation in project
+	ProjectionSolver _projection_solver = ProjectionSolver::GaussSeidel;
+
+	// Multigrid hierarchy, only built once the multigrid backend is used
+	Multigrid _multigrid;
+
+	// Transforms of the spectral diffusion and projection, only set up once one of them is used
+	Spectral _spectral;
+
+	// Relaxation scheme of the diffusion solvers
+	Relaxation _relaxation = Relaxation::GaussSeidel;
+
+	// Scheme of advect, and the float fields of the intermediate passes of the corrected schemes (two for every advected
+	// field, allocated on first use)
+	AdvectionScheme _advection = AdvectionScheme::SemiLagrangian;
+	std::unique_ptr<GridArena> _advection_fields;
+
+	// Tiles of the intermediate fields that may hold values, see ActiveTiles: all of them after a pass over the complete
+	// grid, otherwise the tiles that were active in a pass since they were last cleared
+	std::vector<unsigned char> _advection_written;
+
+	// Worker threads for the red-black relaxation, created by setThreads
+	std::unique_ptr<ThreadPool> _pool;
+
+	// The diffusion stops once the relative residual drops below this tolerance (0: always run all iterations)
+	float _diffusion_tolerance = 1e-4f;
+
+	// Maximum number of Gauss Seidel sweeps of the pressure solve and relative residual at which it stops early
+	int _projection_sweeps = 1;
+	float _projection_tolerance = 1e-4f;
+
+	ResidualNorm _residual_norm = ResidualNorm::L2;
+
+	// Start the pressure solve from the pressure passed in (the one of the previous solve) instead of zero
+	bool _warm_start = true;
+
+	// Boundaries of the simulation, see domainBoundary
+	Domain _domain = Domain::Walls;
+
+	// Tiles the diffusion and the advection are restricted to, the complete grid if nullptr
+	const ActiveTiles* _tiles = nullptr;
+
+	// Iterations and relative residual of the last diffusion solve
+	int _diffusion_iterations = 0;
+	float _diffusion_residual = 0;
+
+	// Iterations and relative residual of the last pressure solve
+	int _projection_iterations = 0;
+	float _projection_residual = 0;
+
+	// Gauss Seidel iterations for x = (x0 + a * sum of the neighbours of x) / (1 + 4a) with the current relaxation
+	// scheme, until the residual tolerance or the maximum number of iterations is reached
+	void relax(Boundary b, Grid& x, Grid& x0, float a, int max_iterations);
+	void relaxLexicographic(Boundary b, Grid& x, Grid& x0, float a, int max_iterations);
+	void relaxRedBlack(Boundary b, Grid& x, Grid& x0, float a, int max_iterations);
+
+	// Direct solve of the same system with Spectral, b has to be periodic
+	void relaxSpectral(Boundary b, Grid& x, Grid& x0, float a);
+
+	// MacCormack or BFECC advection of the fields, built from advectRows passes
+	void advectCorrected(AdvectedField* fields, int count, const Grid& vx, const Grid& vy, float dt);
+
+	// Zero the tiles of the intermediate fields that hold values but are no longer active, so that the sparse passes
+	// read zeros outside of the active tiles like in the fields themselves
+	void clearAdvectionFields();
+
+	// Call rows(first, last) for chunks of [first, last) on the thread pool, or once without a pool
+	void parallelRows(int first, int last, const std::function<void(int, int)>& rows);
+public:
 	// Ensure that no smoke can exist the simulation box. 
 	// Set horizontal density to zero on vertical walls, analog on horizontal walls
-	void setBnd(int b, std::array<float, SIZE*SIZE>& x, int N);
-public:
-	// Viscous diffusion of the velocity field in x and y direction according to the Navier Stokes PDE
-	void diffuse_velocity(int b, std::array<float, SIZE*SIZE>& x, std::array<float, SIZE*SIZE>& x0, float diff, float dt, int iter, int N);
-	
-	// Diffuse the smoke density according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-	void diffuse_density(int b, std::array<float, SIZE*SIZE>& x, std::array<float, SIZE*SIZE>& x0, float diff, float dt, int iter, int N);
+	// The boundary is applied as given, independent of the domain.
+	void setBnd(Boundary b, Grid& x);
+
+	// Building blocks of the kernels for the rows [first, last) of the grid, used by the thread pool and by
+	// DistributedLogic. Rows of the same pass can run in parallel, the norms and changes are collected per row in
+	// row_squares and row_max (indexed by the row) so that summing them in row order gives the same result for any
+	// split of the rows.
+
+	// Boundary values of the rows [first, last), a range containing row 0 or N - 1 has to contain row 1 or N - 2 too.
+	// Periodic boundaries copy rows across the grid and throw std::invalid_argument unless the range is the complete grid.
+	void setBnd(Boundary b, Grid& x, int first, int last);
+
+	// Squares and maxima of the absolute values of the interior cells of every row
+	void normRows(const Grid& x, int first, int last, double* row_squares, float* row_max) const;
+
+	// One colour (0 or 1) of a red-black diffusion sweep, adds the squared changes and their maximum
+	void relaxRows(Grid& x, const Grid& x0, float a, int colour, int first, int last, double* row_squares,
+		float* row_max) const;
+
+	// Divergence of the velocity and its norms (overwrites the rows), clears the pressure without warm starts
+	void divergenceRows(const Grid& vx, const Grid& vy, Grid& p, Grid& div, int first, int last, double* row_squares,
+		float* row_max) const;
+
+	// One colour of a red-black pressure sweep, adds the squared changes and their maximum
+	void pressureRows(Grid& p, const Grid& div, int colour, int first, int last, double* row_squares,
+		float* row_max) const;
+
+	// Subtract the pressure gradient from the velocity
+	void gradientRows(Grid& vx, Grid& vy, const Grid& p, int first, int last) const;
+
+	// Semi-Lagrangian advection of the interior cells, without the boundary values
+	void advectRows(AdvectedField* fields, int count, const Grid& vx, const Grid& vy, float dt, int first,
+		int last) const;
+
+	// Residual norm relative to the right hand side from the accumulated squares and maxima of both
+	float relativeResidual(double residual_squares, float residual_max, double rhs_squares, float rhs_max) const;
+
+	// Select the backend for the pressure equation
+	void setProjectionSolver(ProjectionSolver solver) { _projection_solver = solver; }
+	ProjectionSolver projectionSolver() const { return _projection_solver; }
+
+	// Select the scheme of advect
+	void setAdvection(AdvectionScheme scheme) { _advection = scheme; }
+	AdvectionScheme advection() const { return _advection; }
+
+	// Select the relaxation scheme of the diffusion solvers
+	void setRelaxation(Relaxation relaxation) { _relaxation = relaxation; }
+	Relaxation relaxation() const { return _relaxation; }
+
+	// Number of threads used by the red-black relaxation, the spectral solvers and the advection (1 runs on the calling
+	// thread only)
+	void setThreads(int threads);
+	int threads() const { return _pool ? _pool->threads() : 1; }
+
+	// The worker threads, nullptr for a single thread. Other kernels of the simulation (e.g. Particles) share them.
+	ThreadPool* pool() { return _pool.get(); }
+
+	// Settings of the multigrid backend (cycle type, residual tolerance, maximum number of cycles)
+	Multigrid& multigrid() { return _multigrid; }
+
+	// Relative residual at which the diffusion stops before its maximum number of iterations (0: never)
+	void setDiffusionTolerance(float tolerance) { _diffusion_tolerance = tolerance; }
+	float diffusionTolerance() const { return _diffusion_tolerance; }
+
+	// Maximum number of sweeps and relative residual at which the Gauss Seidel pressure solve stops (0: never)
+	void setProjectionSweeps(int sweeps) { _projection_sweeps = sweeps; }
+	int projectionSweeps() const { return _projection_sweeps; }
+	void setProjectionTolerance(float tolerance) { _projection_tolerance = tolerance; }
+	float projectionTolerance() const { return _projection_tolerance; }
+
+	// Norm of the residual checked by the Gauss Seidel solvers, the multigrid backend always uses the L2 norm
+	void setResidualNorm(ResidualNorm norm) { _residual_norm = norm; }
+	ResidualNorm residualNorm() const { return _residual_norm; }
+
+	// Only diffuse, advect and correct the velocity in the active tiles (nullptr: the complete grid). All other tiles have
+	// to be zero in the fields passed to the kernels. The pressure solve itself always covers the complete grid,
+	// pressure is not local. The tiles are not owned and have to outlive their use.
+	void setActiveTiles(const ActiveTiles* tiles);
+	const ActiveTiles* activeTiles() const { return _tiles; }
+
+	// Start every pressure solve from the pressure of the previous one
+	void setWarmStart(bool warm_start) { _warm_start = warm_start; }
+	bool warmStart() const { return _warm_start; }
+
+	// Boundaries of the simulation (default Domain::Walls). diffuse, advect and project apply domainBoundary to the
+	// boundary of every field, and a periodic domain also wraps the backtrace of the advection around the grid.
+	// The multigrid backend only supports closed and open domains, its levels copy the cells next to the walls, and the
+	// spectral solvers only periodic ones.
+	void setDomain(Domain domain) { _domain = domain; }
+	Domain domain() const { return _domain; }
+
+	// Number of iterations and relative residual of the last diffusion solve. The residual is estimated from the changes
+	// of the last iteration. A sweep updates each cell from neighbours it already changed, so this is an upper estimate:
+	// the lexicographic sweep reports about twice the true residual before or after the iteration.
+	int diffusionIterations() const { return _diffusion_iterations; }
+	float diffusionResidual() const { return _diffusion_residual; }
+
+	// Number of iterations (sweeps or V-cycles) of the last pressure solve
+	int projectionIterations() const { return _projection_iterations; }
+
+	// Residual of the last pressure solve relative to the divergence. The Gauss Seidel sweeps report the same upper
+	// estimate as diffusionResidual, so they stop later than their tolerance asks. Multigrid computes the true residual.
+	float projectionResidual() const { return _projection_residual; }
+
+	// Viscous diffusion of a velocity component or diffusion of the smoke density according to the Navier Stokes and
+	// the smoke density PDE (see Jos Stam, Figure 1, equation 2), b is the boundary of the field in a closed box.
+	// iter is the maximum number of iterations, the solver stops earlier once the diffusion tolerance is reached.
+	void diffuse(Boundary b, Grid& x, Grid& x0, float diff, float dt, int iter);
 	
 	// Force mass conservation and ensure that the velocity field remains divergence-free.
-	void project(std::array<float, SIZE*SIZE>& vx, std::array<float, SIZE*SIZE>& vy, std::array<float, SIZE*SIZE>& p, std::array<float, SIZE*SIZE>& div, int N);
-	
-	// Self-Advection of the velocity in x and y direction according to the Navier Stokes PDE
-	// Self-Advection is the movement of the velocity field along itself
-	void advect_velocity(int b, std::array<float, SIZE*SIZE>& d, std::array<float, SIZE*SIZE>& d0, std::array<float, SIZE*SIZE>& vx, std::array<float, SIZE*SIZE>& vy, float dt, int N); 
+	// With warm starts p has to hold the pressure of the previous solve (or zero), it is left as the new pressure.
+	void project(Grid& vx, Grid& vy, Grid& p, Grid& div);
 	
-	// Advection of the smoke in the velocity field according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-	void advect_density(int b, std::array<float, SIZE*SIZE>& d, std::array<float, SIZE*SIZE>& d0, std::array<float, SIZE*SIZE>& vx, std::array<float, SIZE*SIZE>& vy, float dt, int N); 
+	// Semi-Lagrangian advection of several fields along the velocity field (vx, vy): the self-advection of the
+	// velocity and the advection of the smoke. The backtrace is computed once per cell and shared by all fields (at
+	// most four). Uses AVX-512 or AVX2 gathers when compiled for them. The corrected schemes (see AdvectionScheme) run
+	// the same kernels forward and backward in time and clamp the result to the four values the first order scheme
+	// interpolates from, so they add no new extrema.
+	void advect(std::initializer_list<AdvectedField> fields, Grid& vx, Grid& vy, float dt);
 };
+
+#endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Instrumentation of the solver. The macros below only do something if the code is compiled with
+// -DFLUIDSIM_PROFILE, otherwise they expand to nothing and the solver has no overhead at all.
+//   PROFILE_SCOPE("name")         times the enclosing block as stage "name"
+//   PROFILE_VALUE("name", value)  records a sample of a solver quantity, e.g. a residual
+// Names have to be string literals, the trace keeps pointers to them.
+#ifdef FLUIDSIM_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_VALUE(name, value) Profiler::instance().record(name, value)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_VALUE(name, value) ((void)0)
+#endif
+
+// Collects rolling statistics per stage and optionally a trace of every timed scope
+class Profiler {
+	public:
+		// Statistics over the most recent samples of one stage or value
+		struct Statistics {
+			// Number of samples recorded since the last reset
+			long count;
+
+			// Minimum, mean and 99th percentile of the samples in the rolling window, and the last sample
+			double min;
+			double mean;
+			double p99;
+			double last;
+		};
+
+		// Was the code compiled with the instrumentation?
+		static bool enabled();
+
+		static Profiler& instance();
+
+		// Microseconds since the profiler was created
+		double now() const;
+
+		// Record a timed scope (in microseconds) and add it to the trace if tracing is on
+		void recordDuration(const char* name, double start, double duration);
+
+		// Record a sample of a solver quantity
+		void record(const char* name, double value);
+
+		// Statistics of all stages in the order they were first recorded
+		std::vector<std::pair<std::string, Statistics>> statistics();
+
+		// Print one line per stage, durations in milliseconds
+		void report(std::ostream& out);
+
+		// Collect every timed scope for writeTrace, at most max_events of them
+		void setTracing(bool tracing, std::size_t max_events = 1000000);
+
+		// Write the collected scopes in the Chrome trace event format (chrome://tracing, Perfetto)
+		void writeTrace(const std::string& path);
+
+		// Forget all samples and trace events
+		void reset();
+
+	private:
+		// Number of samples kept per stage for min / mean / p99
+		static const std::size_t WINDOW = 1024;
+
+		struct Stage {
+			std::string name;
+
+			// Durations are reported in milliseconds, values as recorded
+			bool timed;
+			long count;
+			double last;
+
+			// Ring buffer of the most recent samples
+			std::vector<double> window;
+		};
+
+		struct TraceEvent {
+			const char* name;
+			double start;
+			double duration;
+			std::size_t thread;
+		};
+
+		std::mutex _mutex;
+		std::chrono::steady_clock::time_point _origin;
+		std::vector<Stage> _stages;
+
+		bool _tracing;
+		std::size_t _max_events;
+		std::vector<TraceEvent> _events;
+
+		Profiler();
+
+		// Sample of a stage, the mutex has to be held
+		void add(const char* name, double value, bool timed);
+
+		// Small number identifying the calling thread in the trace
+		static std::size_t threadId();
+};
+
+// Times the enclosing scope, created by PROFILE_SCOPE
+class ProfileScope {
+	private:
+		const char* _name;
+		double _start;
+
+	public:
+		ProfileScope(const char* name) : _name(name), _start(Profiler::instance().now()) {}
+		~ProfileScope() {
+			Profiler& profiler = Profiler::instance();
+			profiler.recordDuration(_name, _start, profiler.now() - _start);
+		}
+
+		ProfileScope(const ProfileScope&) = delete;
+		ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#endif
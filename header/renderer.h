@@ -0,0 +1,73 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstdint>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "./grid.h"
+
+// Draws the simulation as one texture: every grid element is mapped to one RGBA pixel,
+// the pixels are uploaded to a single sf::Texture and drawn as one scaled sprite.
+// The tracer particles are drawn on top of it as one vertex array of points, a second draw call for all of them.
+class Renderer {
+	public:
+		// Field shown in the window
+		enum Colormap {
+			// Green smoke on black, like the original per-cell rectangles
+			Density,
+			// Blue (at rest) to red (fast) velocity magnitude
+			VelocityMagnitude,
+			// Blue (clockwise) to red (counter clockwise) vorticity
+			Vorticity
+		};
+
+	private:
+		// Number of grid elements in each direction and pixels per grid element in the window
+		int _size;
+		int _scale;
+
+		Colormap _colormap;
+
+		// Value mapped to full intensity for the velocity magnitude and vorticity colormaps
+		float _velocity_range;
+		float _vorticity_range;
+
+		// RGBA bytes of the current frame, size * size pixels
+		std::vector<std::uint8_t> _pixels;
+
+		sf::Texture _texture;
+		sf::Sprite _sprite;
+
+		// Maps the grid (x, y) onto the window (y, x) scaled by _scale, which is the orientation
+		// in which the simulation has always been displayed
+		sf::Transform _transform;
+
+		// One point per tracer particle, in grid coordinates like the sprite
+		sf::VertexArray _particles;
+
+		void mapDensity(const Grid& density);
+		void mapVelocityMagnitude(const Grid& vx, const Grid& vy);
+		void mapVorticity(const Grid& vx, const Grid& vy);
+
+	public:
+		// Constructor, size is the number of grid elements in each direction
+		Renderer(int size, int scale);
+
+		void setColormap(Colormap colormap) { _colormap = colormap; }
+		Colormap colormap() const { return _colormap; }
+
+		// Values shown with full intensity in the velocity magnitude and vorticity colormaps
+		void setVelocityRange(float range) { _velocity_range = range; }
+		void setVorticityRange(float range) { _vorticity_range = range; }
+
+		// Map the fields with the current colormap and upload the pixels into the texture
+		void update(const Grid& density, const Grid& vx, const Grid& vy);
+
+		// Replace the points with the positions of count particles
+		void updateParticles(const float* x, const float* y, std::size_t count);
+
+		// Draw the texture and the particles into the window with one draw call each
+		void draw(sf::RenderWindow& window);
+};
+
+#endif
@@ -1,6 +1,12 @@
+#include<atomic>
+#include<chrono>
+#include<thread>
 #include<vector>
 #include<iostream>
+#include<SFML/Graphics.hpp>
 #include "./logic.h"
+#include "./renderer.h"
+#include "./snapshot.h"
 
 class Simulation {
 	private:
@@ -9,6 +15,21 @@ class Simulation {
 		
 		// Creates the logic behind the animation
 		Logic logic;
+
+		// Draws the fields of the logic into the window
+		Renderer renderer;
+
+		// Completed steps from the solver thread to the render thread
+		SnapshotBuffer snapshots;
+
+		// Mouse input from the render thread to the solver thread
+		InputQueue inputs;
+
+		// Cleared by the render thread to stop the solver thread
+		std::atomic<bool> running;
+
+		// Loop of the solver thread
+		void solve();
 	
 	public:
 		// Constructor for initialization of window, container, options 
@@ -0,0 +1,101 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "./grid.h"
+#include "./logic.h"
+
+// Copy of the fields of one completed simulation step
+struct FieldSnapshot {
+	GridArena arena;
+
+	Grid density;
+	Grid velocity_x;
+	Grid velocity_y;
+
+	// Positions of the tracer particles, the vectors keep their capacity between two captures
+	std::vector<float> particles_x;
+	std::vector<float> particles_y;
+
+	// Number of the step the fields belong to
+	long step;
+
+	FieldSnapshot(int size);
+
+	// Copy the current state of the logic into the snapshot
+	void capture(const Logic& logic, long step_number);
+};
+
+// Lock-free triple buffer that hands the latest snapshot from the solver thread to the render thread.
+// The solver always owns one snapshot to write into, the renderer one to read from, and the third one
+// holds the newest completed frame. Neither side ever waits for the other, frames the renderer is
+// too slow for are overwritten, unless the solver waits for the renderer with waitUntilConsumed.
+class SnapshotBuffer {
+	private:
+		// Marks the middle slot as written since the renderer took the last frame
+		static const int FRESH = 4;
+
+		std::vector<FieldSnapshot> _slots;
+
+		// Slot written by the solver, slot read by the renderer and the exchanged middle slot (plus FRESH flag)
+		int _back;
+		int _front;
+		std::atomic<int> _middle;
+
+		// Signalled by consume and stop, for the solver waiting in waitUntilConsumed
+		std::mutex _mutex;
+		std::condition_variable _consumed;
+		bool _stopped;
+
+	public:
+		SnapshotBuffer(int size);
+
+		// Solver side: snapshot to fill, then publish it as the newest frame
+		FieldSnapshot& back() { return _slots[_back]; }
+		void publish();
+
+		// Solver side: block until the renderer took the last published frame or stop was called. Waiting before every
+		// publish paces the solver to one step per displayed frame, while the next step is still computed during the
+		// rendering of the previous one.
+		void waitUntilConsumed();
+
+		// Release a solver waiting in waitUntilConsumed, it does not wait again
+		void stop();
+
+		// Renderer side: take the newest frame if there is one that was not consumed yet.
+		// Returns false if no new frame was published since the last call, front() stays valid either way.
+		bool consume();
+		const FieldSnapshot& front() const { return _slots[_front]; }
+};
+
+// Input recorded by the render thread and applied by the solver thread before its next step
+struct InputEvent {
+	enum Type { Density, Velocity, Particles };
+
+	Type type;
+
+	// Grid position and amount, velocity events use amount_x and amount_y, particle events seed amount_x particles
+	float x;
+	float y;
+	float amount_x;
+	float amount_y;
+};
+
+// Queue of input events from the render thread to the solver thread. The solver takes all events at once,
+// so the lock is only held for a push or a swap of two vectors.
+class InputQueue {
+	private:
+		std::mutex _mutex;
+		std::vector<InputEvent> _events;
+
+	public:
+		void push(const InputEvent& event);
+
+		// Move all queued events into events (which is cleared first)
+		void drain(std::vector<InputEvent>& events);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include <complex>
+#include <vector>
+#include "./fft.h"
+#include "./grid.h"
+#include "./thread_pool.h"
+
+// Direct solvers for the diffusion and the projection of Physics on a periodic domain (Jos Stam, "A Simple Fluid Solver
+// based on the FFT"). The n = size - 2 interior cells are one period of the domain, n has to be a power of two.
+// In Fourier space the five point stencils of the finite difference solvers become multiplications, so both steps are
+// solved exactly in one forward and one inverse 2D transform, independent of any tolerance:
+//   - diffusion: X = X0 / (1 + a (4 - 2 cos(kx) - 2 cos(ky))), the solution of the system Gauss Seidel relaxes
+//   - projection: the velocity loses its component along (sin(kx), sin(ky)), the symbol of the central differences of
+//     Physics::project, so the divergence Physics measures vanishes up to rounding
+// The ghost cells are written directly with the interior cells of the opposite side, no Physics::setBnd is needed.
+class Spectral {
+	private:
+		// Number of interior cells in each direction, the period of the domain
+		int _n;
+
+		FFT _fft;
+
+		// Interior of the fields row by row, and the spectrum after the forward transform. The spectrum is transposed:
+		// row kx holds the column frequencies ky, so both passes of the transform run over contiguous rows.
+		std::vector<std::complex<float>> _data;
+		std::vector<std::complex<float>> _spectrum;
+
+		// cos and sin of 2 pi k / n
+		std::vector<float> _cos;
+		std::vector<float> _sin;
+
+		// Prepare the transforms for fields of the given size
+		void build(int size);
+
+		// 2D transforms between _data and _spectrum, the inverse is not scaled by 1 / n^2
+		void forward(ThreadPool* pool);
+		void inverse(ThreadPool* pool);
+
+		// Copy the interior of a field into _data, as real values or into the imaginary parts, and back scaled by
+		// 1 / n^2 together with the periodic ghost cells
+		void load(const Grid& x, bool imaginary, ThreadPool* pool);
+		void store(Grid& x, bool imaginary, ThreadPool* pool);
+
+	public:
+		Spectral();
+
+		// True if the interior of a field of the given size is a power of two
+		static bool supports(int size);
+
+		// Solve (1 + 4a) x - a * sum of the neighbours of x = x0 for a periodic x. Throws std::invalid_argument for
+		// unsupported sizes.
+		void diffuse(Grid& x, const Grid& x0, float a, ThreadPool* pool);
+
+		// Remove the divergence of the velocity field. Both components share one complex transform, vx as the real and
+		// vy as the imaginary part. Throws std::invalid_argument for unsupported sizes.
+		void project(Grid& vx, Grid& vy, ThreadPool* pool);
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent set of worker threads for data parallel loops over the rows of a grid.
+// The threads are created once and sleep between two loops, so a loop only costs a wake up.
+class ThreadPool {
+	private:
+		// Worker threads, the thread calling parallel_for works on the first chunk itself
+		std::vector<std::thread> _workers;
+
+		std::mutex _mutex;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+
+		// Loop body and range of the current loop
+		const std::function<void(int, int)>* _body;
+		int _begin;
+		int _end;
+
+		// Incremented for every loop so that the workers can tell a new loop from a spurious wake up
+		unsigned long _generation;
+
+		// Number of workers still busy with the current loop
+		int _pending;
+
+		bool _stop;
+
+		void work(int index);
+
+		// Range of the chunk processed by the given thread
+		void chunk(int index, int& begin, int& end) const;
+
+	public:
+		// Create a pool that uses the given total number of threads (including the calling one)
+		ThreadPool(int threads);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Total number of threads working on a loop
+		int threads() const { return static_cast<int>(_workers.size()) + 1; }
+
+		// Split [begin, end) into one contiguous chunk per thread, call body(chunk_begin, chunk_end)
+		// for every non-empty chunk and return once all chunks are done
+		void parallel_for(int begin, int end, const std::function<void(int, int)>& body);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <initializer_list>
+#include <vector>
+#include "./grid.h"
+
+// Run of consecutive grid elements [begin, end) of one row
+struct TileSpan {
+	int begin;
+	int end;
+};
+
+// Splits the grid into TILE x TILE tiles and tracks which of them hold any smoke or motion. A tile is hot when the
+// density or the speed of one of its elements exceeds the threshold. The active tiles are the hot tiles grown by the
+// distance the advection can move values in one step plus one tile of halo, so nothing a step transports or diffuses
+// leaves the active tiles by more than the halo.
+//
+// The kernels only process the active tiles and rely on all other tiles being zero: update() clears every tile that
+// turns inactive, and a tile stays untouched while it is inactive. Sources added by the user mark their tile with
+// touch() so that it is scanned in the next update. Only active and touched tiles are ever scanned, so the cost of
+// the tracking scales with the active area as well.
+class ActiveTiles {
+	private:
+		// Number of grid elements in each direction and number of tiles in each direction
+		int _size;
+		int _tiles;
+
+		// Density and speed above which a tile is hot
+		float _threshold;
+
+		// Active flag of every tile (row by row), hot flags of the last update, tiles touched by sources and the hot
+		// tiles grown along x during an update
+		std::vector<unsigned char> _active;
+		std::vector<unsigned char> _hot;
+		std::vector<unsigned char> _touched;
+		std::vector<unsigned char> _grown;
+
+		// Runs of active tiles of every row of tiles in grid elements, clipped to the grid
+		std::vector<std::vector<TileSpan>> _spans;
+
+		int _active_count;
+
+		// Tiles the hot tiles were grown by in the last update
+		int _radius;
+
+		// Is any element of the tile above the threshold? Also records the largest speed in the tile
+		bool scan(int tx, int ty, const Grid& density, const Grid& vx, const Grid& vy, float& speed) const;
+
+		// Rebuild the spans from the active flags
+		void buildSpans();
+
+	public:
+		// Edge length of a tile in grid elements
+		static const int TILE = 16;
+
+		// All tiles start active, so the first update scans the complete grid (e.g. after restoring a checkpoint)
+		ActiveTiles(int size, float threshold);
+
+		// Mark the tile holding the element (x, y) for the next update, coordinates outside are clamped like
+		// Grid::clampedIndex
+		void touch(int x, int y);
+
+		// Find the hot tiles among the active and touched ones, grow them by the advection distance of one step with
+		// the time step dt and zero the given fields in every tile that turns inactive
+		void update(const Grid& density, const Grid& vx, const Grid& vy, float dt, std::initializer_list<Grid> fields);
+
+		// Runs of active elements in row y (0 <= y < size), they may include the halo columns 0 and size - 1
+		const std::vector<TileSpan>& spans(int y) const { return _spans[y / TILE]; }
+
+		bool active(int tx, int ty) const { return _active[ty * _tiles + tx] != 0; }
+		float threshold() const { return _threshold; }
+		int radius() const { return _radius; }
+
+		// Number of tiles in each direction, active tiles and their share of all tiles
+		int tiles() const { return _tiles; }
+		int activeCount() const { return _active_count; }
+		float activeFraction() const { return static_cast<float>(_active_count) / (_tiles * _tiles); }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs a batch of independent tasks of very different length (e.g. whole simulations) on a fixed number of threads.
+// Every thread owns a deque of tasks. It works through its own deque from the front and, once that is empty, steals
+// from the back of the deque that has the most tasks left. A thread only has to wait when there is nothing left to
+// steal, so long and short tasks even out without a central queue that all threads contend for.
+//
+// Unlike ThreadPool, which splits one loop into equal chunks, the tasks here run to completion on one thread.
+class WorkStealingPool {
+	private:
+		// Tasks of one thread, the owner pops from the front and thieves take from the back
+		struct Queue {
+			std::mutex mutex;
+			std::deque<std::function<void(int)>> tasks;
+		};
+
+		int _threads;
+		std::vector<std::unique_ptr<Queue>> _queues;
+
+		// Tasks taken from the deque of another thread during the last run
+		std::atomic<long> _steals;
+
+		// Next task of the given thread, its own or a stolen one. Returns false if all deques are empty.
+		bool next(int thread, std::function<void(int)>& task);
+
+	public:
+		// Pool for the given total number of threads including the calling one
+		WorkStealingPool(int threads);
+
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		int threads() const { return _threads; }
+
+		// Run all tasks and return once they are done. Task k starts in the deque of thread k % threads, so tasks sorted
+		// by decreasing length are spread evenly. A task receives the index of the thread running it. The calling
+		// thread works as thread 0, the others only exist during the call. The first exception thrown by a task is
+		// rethrown once all threads have stopped, the remaining tasks are still run.
+		void run(std::vector<std::function<void(int)>> tasks);
+
+		// Number of tasks stolen during the last run
+		long steals() const { return _steals; }
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "../header/bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+// Time step, viscosity and diffusion coefficient of the benchmarked kernels, the defaults of fluid_headless
+static const float DT = 0.1f;
+static const float VISCOSITY = 0.0005f;
+static const float DIFFUSION = 0.0001f;
+
+// Every stream of floats costs 4 bytes per cell for reading and 4 bytes per cell for writing
+static const double FLOAT_BYTES = sizeof(float);
+
+const std::vector<std::string>& Bench::kernelNames() {
+	static const std::vector<std::string> names = {
+		"diffuse_velocity", "diffuse_density", "project", "advect_velocity", "advect_density", "advect_particles", "setBnd",
+		"step"
+	};
+	return names;
+}
+
+// Print the available command line options
+void Bench::usage(const char* program) {
+	std::cout << "Usage: " << program << " [options]\n"
+		<< "  --sizes N,N,...   grid sizes of the sweep (default 64,128,256,512,1024,2048)\n"
+		<< "  --kernels K,...   only run these kernels:";
+	for (const std::string& name : kernelNames())
+		std::cout << " " << name;
+	std::cout << "\n"
+		<< "  --min-time T      run every kernel for at least T seconds per size (default 0.25)\n"
+		<< "  --iterations N    Gauss Seidel iterations of the diffusion (default 16)\n"
+		<< "  --projection P    pressure solver: gauss-seidel (default), red-black, multigrid or fmg\n"
+		<< "  --tolerance T     relative residual tolerance of the multigrid solver (default 1e-4)\n"
+		<< "  --relaxation R    diffusion solver: gauss-seidel (default) or red-black\n"
+		<< "  --threads N       threads used by the red-black relaxation and the advection (default 1)\n"
+		<< "  --json FILE       write the results as JSON to FILE\n"
+		<< "  --csv FILE        write the results as CSV to FILE\n";
+}
+
+// Convert the value of a command line option, the complete text has to be a number
+static int toInt(const std::string& option, const std::string& text) {
+	std::size_t used = 0;
+	int value = 0;
+	try {
+		value = std::stoi(text, &used);
+	} catch (const std::exception&) {
+		used = 0;
+	}
+	if (used == 0 || used != text.size())
+		throw std::invalid_argument("malformed value '" + text + "' for " + option);
+	return value;
+}
+
+static double toDouble(const std::string& option, const std::string& text) {
+	std::size_t used = 0;
+	double value = 0;
+	try {
+		value = std::stod(text, &used);
+	} catch (const std::exception&) {
+		used = 0;
+	}
+	if (used == 0 || used != text.size())
+		throw std::invalid_argument("malformed value '" + text + "' for " + option);
+	return value;
+}
+
+// Split a comma separated list, empty entries are dropped
+static std::vector<std::string> split(const std::string& text) {
+	std::vector<std::string> items;
+	std::istringstream in(text);
+	std::string item;
+	while (std::getline(in, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+// Parse the command line into the options of the benchmark
+BenchOptions Bench::parse(int argc, char** argv) {
+	BenchOptions options;
+	for (int k = 1; k < argc; k++) {
+		std::string option = argv[k];
+
+		// All options take exactly one value
+		auto value = [&]() -> std::string {
+			if (k + 1 >= argc)
+				throw std::invalid_argument("missing value for " + option);
+			return argv[++k];
+		};
+
+		if (option == "--sizes") {
+			options.sizes.clear();
+			for (const std::string& size : split(value()))
+				options.sizes.push_back(toInt(option, size));
+		}
+		else if (option == "--kernels") {
+			options.kernels = split(value());
+			for (const std::string& kernel : options.kernels)
+				if (std::find(kernelNames().begin(), kernelNames().end(), kernel) == kernelNames().end())
+					throw std::invalid_argument("unknown kernel '" + kernel + "'");
+		}
+		else if (option == "--min-time")
+			options.min_time = toDouble(option, value());
+		else if (option == "--iterations")
+			options.iterations = toInt(option, value());
+		else if (option == "--projection") {
+			std::string solver = value();
+			if (solver == "gauss-seidel") {
+				options.projection = ProjectionSolver::GaussSeidel;
+			} else if (solver == "multigrid") {
+				options.projection = ProjectionSolver::Multigrid;
+				options.cycle = Multigrid::VCycle;
+			} else if (solver == "fmg") {
+				options.projection = ProjectionSolver::Multigrid;
+				options.cycle = Multigrid::FullMultigrid;
+			} else if (solver == "red-black") {
+				options.projection = ProjectionSolver::RedBlack;
+			} else {
+				throw std::invalid_argument("unknown projection solver '" + solver + "'");
+			}
+		}
+		else if (option == "--tolerance")
+			options.tolerance = static_cast<float>(toDouble(option, value()));
+		else if (option == "--relaxation") {
+			std::string relaxation = value();
+			if (relaxation == "gauss-seidel")
+				options.relaxation = Relaxation::GaussSeidel;
+			else if (relaxation == "red-black")
+				options.relaxation = Relaxation::RedBlack;
+			else
+				throw std::invalid_argument("unknown relaxation '" + relaxation + "'");
+		}
+		else if (option == "--threads")
+			options.threads = toInt(option, value());
+		else if (option == "--json")
+			options.json = value();
+		else if (option == "--csv")
+			options.csv = value();
+		else
+			throw std::invalid_argument("unknown option " + option);
+	}
+
+	if (options.sizes.empty())
+		throw std::invalid_argument("--sizes must name at least one size");
+	for (int size : options.sizes)
+		if (size < 3)
+			throw std::invalid_argument("--sizes must be at least 3");
+	if (options.min_time <= 0)
+		throw std::invalid_argument("--min-time must be positive");
+	if (options.iterations < 1)
+		throw std::invalid_argument("--iterations must be at least 1");
+	if (options.threads < 1)
+		throw std::invalid_argument("--threads must be at least 1");
+	return options;
+}
+
+Bench::Bench(const BenchOptions& options) : _options(options) {}
+
+bool Bench::selected(const std::string& kernel) const {
+	return _options.kernels.empty()
+		|| std::find(_options.kernels.begin(), _options.kernels.end(), kernel) != _options.kernels.end();
+}
+
+// Apply the solver settings of the options to a Physics instance. The diffusion always runs all iterations, so that
+// the timings do not depend on how quickly the benchmarked state converges.
+static void configure(Physics& physics, const BenchOptions& options) {
+	physics.setDiffusionTolerance(0);
+	physics.setProjectionSolver(options.projection);
+	physics.multigrid().setCycle(options.cycle);
+	physics.multigrid().setTolerance(options.tolerance);
+	physics.setRelaxation(options.relaxation);
+	physics.setThreads(options.threads);
+}
+
+// Batches of calls are doubled until one batch takes a tenth of min_time, then batches are repeated until min_time
+// is reached. The fastest batch is reported, which is the least disturbed by the rest of the machine.
+void Bench::measure(const std::string& kernel, int size, double bytes_per_cell, const std::function<void()>& kernel_call) {
+	auto time = [&](long calls) {
+		auto start = std::chrono::steady_clock::now();
+		for (long k = 0; k < calls; k++)
+			kernel_call();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	// Warm up the caches and build lazily allocated state such as the multigrid hierarchy
+	kernel_call();
+
+	long batch = 1;
+	while (time(batch) < _options.min_time / 10)
+		batch *= 2;
+
+	double best = std::numeric_limits<double>::max();
+	double elapsed = 0;
+	long calls = 0;
+	while (elapsed < _options.min_time) {
+		double seconds = time(batch);
+		best = std::min(best, seconds / batch);
+		elapsed += seconds;
+		calls += batch;
+	}
+
+	double cells = static_cast<double>(size) * size;
+	BenchResult result = {kernel, size, calls, best, cells / best, bytes_per_cell, cells * bytes_per_cell / best};
+	_results.push_back(result);
+
+	std::cout << std::left << std::setw(18) << kernel << std::right
+		<< std::setw(7) << size
+		<< std::setw(10) << calls
+		<< std::setw(14) << std::fixed << std::setprecision(3) << best * 1e6
+		<< std::setw(14) << std::setprecision(1) << result.cells_per_second * 1e-6
+		<< std::setw(12) << std::setprecision(2) << bytes_per_cell
+		<< std::setw(10) << std::setprecision(2) << result.bytes_per_second * 1e-9 << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+}
+
+// The divergence pass reads both velocities and writes the divergence and the zeroed pressure, the gradient pass reads
+// the pressure and updates both velocities. A Gauss Seidel sweep reads the divergence and updates the pressure.
+// A V-cycle is counted as its smoothing sweeps plus the residual and the correction on the fine level, the coarser
+// levels add a third on top of that.
+double Bench::projectionBytes(Physics& physics) const {
+	double passes = 4 + 5;
+	if (physics.projectionSolver() == ProjectionSolver::Multigrid) {
+		const Multigrid& multigrid = physics.multigrid();
+		double sweeps = multigrid.preSmoothing() + multigrid.postSmoothing() + 2;
+		passes += physics.projectionIterations() * sweeps * 3 * 4.0 / 3.0;
+	} else {
+		passes += 3 * physics.projectionIterations();
+	}
+	return passes * FLOAT_BYTES;
+}
+
+// Bytes per cell are the compulsory memory traffic of the streams a kernel touches, assuming that the neighbours of a
+// stencil and the gathered values of the advection are served from the cache. The GB/s column is therefore a lower
+// bound of the bandwidth the kernel really uses, it becomes meaningful once the fields no longer fit into the cache.
+void Bench::run() {
+	std::cout << std::left << std::setw(18) << "kernel" << std::right
+		<< std::setw(7) << "size" << std::setw(10) << "calls" << std::setw(14) << "us/call"
+		<< std::setw(14) << "Mcells/s" << std::setw(12) << "bytes/cell" << std::setw(10) << "GB/s" << std::endl;
+
+	double diffuse_bytes = _options.iterations * 3 * FLOAT_BYTES;
+	double advect_bytes = 4 * FLOAT_BYTES;
+
+	for (int size : _options.sizes) {
+		Physics physics;
+		configure(physics, _options);
+
+		// Velocity, previous velocity, density, previous density, pressure and divergence
+		GridArena arena(size, 8);
+		Grid vx = arena.field(0);
+		Grid vy = arena.field(1);
+		Grid previous_vx = arena.field(2);
+		Grid previous_vy = arena.field(3);
+		Grid density = arena.field(4);
+		Grid previous_density = arena.field(5);
+		Grid pressure = arena.field(6);
+		Grid divergence = arena.field(7);
+
+		// A smooth vortex that moves the fluid by about two cells per step, and a smooth density pattern.
+		// The values only matter for the multigrid backend, whose number of cycles depends on the divergence.
+		float speed = 2.0f / (DT * (size - 2));
+		for (int j = 0; j < size; j++) {
+			for (int i = 0; i < size; i++) {
+				float x = static_cast<float>(i) / (size - 1);
+				float y = static_cast<float>(j) / (size - 1);
+				int index = vx.index(i, j);
+				vx[index] = previous_vx[index] = speed * std::sin(3.14159265f * x) * std::cos(3.14159265f * y + 0.3f);
+				vy[index] = previous_vy[index] = -speed * std::cos(3.14159265f * x + 0.2f) * std::sin(3.14159265f * y);
+				density[index] = previous_density[index] = 100.0f * (1 + std::sin(7 * x) * std::sin(5 * y));
+			}
+		}
+
+		if (selected("diffuse_velocity"))
+			measure("diffuse_velocity", size, diffuse_bytes, [&]() {
+				physics.diffuse(Boundary::VelocityX, previous_vx, vx, VISCOSITY, DT, _options.iterations);
+			});
+		if (selected("diffuse_density"))
+			measure("diffuse_density", size, diffuse_bytes, [&]() {
+				physics.diffuse(Boundary::Scalar, previous_density, density, DIFFUSION, DT, _options.iterations);
+			});
+		if (selected("project")) {
+			// The first call removes the divergence of the initial field, the byte count is taken from the
+			// following solves, which see the nearly divergence-free field the timed calls work on
+			for (int k = 0; k < 2; k++)
+				physics.project(vx, vy, pressure, divergence);
+			measure("project", size, projectionBytes(physics), [&]() {
+				physics.project(vx, vy, pressure, divergence);
+			});
+		}
+		if (selected("advect_velocity"))
+			measure("advect_velocity", size, advect_bytes, [&]() {
+				physics.advect({{Boundary::VelocityX, vx, previous_vx}}, previous_vx, previous_vy, DT);
+			});
+		if (selected("advect_density"))
+			measure("advect_density", size, advect_bytes, [&]() {
+				physics.advect({{Boundary::Scalar, density, previous_density}}, vx, vy, DT);
+			});
+		if (selected("advect_particles")) {
+			// One particle per cell, each step reads and writes its position and age. The walls keep all of them alive.
+			Particles particles;
+			particles.seed(0.5f, 0.5f, size - 1.5f, size - 1.5f, size * size);
+			measure("advect_particles", size, 6 * FLOAT_BYTES, [&]() {
+				particles.advect(vx, vy, DT, Domain::Walls, physics.pool());
+			});
+		}
+		if (selected("setBnd")) {
+			// Every boundary cell reads its interior neighbour and is written, spread over all cells of the grid
+			double boundary_bytes = 4.0 * (size - 2) * 2 * FLOAT_BYTES / (static_cast<double>(size) * size);
+			measure("setBnd", size, boundary_bytes, [&]() {
+				physics.setBnd(Boundary::Scalar, density);
+			});
+		}
+
+		if (selected("step")) {
+			// Sources in the centre keep the fluid moving, so the multigrid backend never starts from a converged state.
+			// Two diffusions and projections of the velocity, the fused advection of both components (which reads
+			// the previous velocity as field and as velocity), and the diffusion and advection of the density.
+			Logic logic(size, DT, DIFFUSION, VISCOSITY);
+			configure(logic.physics(), _options);
+			logic.setDiffusionIterations(_options.iterations);
+			auto step = [&]() {
+				logic.addDensity(size / 2.0f, size / 2.0f, 100.0f);
+				logic.addVelocity(size / 2.0f, size / 2.0f, speed, speed);
+				logic.step();
+			};
+			step();
+			double step_bytes = 3 * diffuse_bytes + 2 * projectionBytes(logic.physics()) + 4 * FLOAT_BYTES + advect_bytes;
+			measure("step", size, step_bytes, step);
+		}
+	}
+
+	if (!_options.json.empty()) {
+		std::ofstream out(_options.json);
+		if (!out)
+			throw std::runtime_error("cannot write results to '" + _options.json + "'");
+		writeJson(out);
+	}
+	if (!_options.csv.empty()) {
+		std::ofstream out(_options.csv);
+		if (!out)
+			throw std::runtime_error("cannot write results to '" + _options.csv + "'");
+		writeCsv(out);
+	}
+}
+
+// The settings of the run followed by one object per kernel and size
+void Bench::writeJson(std::ostream& out) const {
+	out << std::setprecision(9)
+		<< "{\n  \"settings\": {\"threads\": " << _options.threads
+		<< ", \"iterations\": " << _options.iterations
+		<< ", \"relaxation\": \"" << (_options.relaxation == Relaxation::RedBlack ? "red-black" : "gauss-seidel") << "\""
+		<< ", \"projection\": \"" << (_options.projection == ProjectionSolver::GaussSeidel ? "gauss-seidel"
+			: _options.projection == ProjectionSolver::RedBlack ? "red-black"
+			: (_options.cycle == Multigrid::FullMultigrid ? "fmg" : "multigrid")) << "\""
+		<< ", \"tolerance\": " << _options.tolerance
+		<< ", \"min_time\": " << _options.min_time << "},\n  \"results\": [\n";
+	for (std::size_t k = 0; k < _results.size(); k++) {
+		const BenchResult& r = _results[k];
+		out << "    {\"kernel\": \"" << r.kernel << "\", \"size\": " << r.size << ", \"calls\": " << r.calls
+			<< ", \"seconds\": " << r.seconds << ", \"cells_per_second\": " << r.cells_per_second
+			<< ", \"bytes_per_cell\": " << r.bytes_per_cell << ", \"bytes_per_second\": " << r.bytes_per_second << "}"
+			<< (k + 1 < _results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+void Bench::writeCsv(std::ostream& out) const {
+	out << std::setprecision(9) << "kernel,size,calls,seconds,cells_per_second,bytes_per_cell,bytes_per_second\n";
+	for (const BenchResult& r : _results)
+		out << r.kernel << "," << r.size << "," << r.calls << "," << r.seconds << "," << r.cells_per_second << ","
+			<< r.bytes_per_cell << "," << r.bytes_per_second << "\n";
+}
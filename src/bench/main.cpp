@@ -0,0 +1,23 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "../../header/bench.h"
+
+// Benchmark the physics kernels over a sweep of grid sizes
+int main(int argc, char** argv) {
+	for (int k = 1; k < argc; k++) {
+		if (std::strcmp(argv[k], "--help") == 0 || std::strcmp(argv[k], "-h") == 0) {
+			Bench::usage(argv[0]);
+			return 0;
+		}
+	}
+
+	try {
+		Bench bench(Bench::parse(argc, argv));
+		bench.run();
+	} catch (const std::exception& error) {
+		std::cerr << argv[0] << ": " << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
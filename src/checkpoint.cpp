@@ -0,0 +1,145 @@
+#include "../header/checkpoint.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(CheckpointHeader) <= CHECKPOINT_DATA_OFFSET, "the checkpoint header has to fit into one page");
+static_assert(Logic::FIELDS <= CHECKPOINT_MAX_FIELDS, "the checkpoint header has to describe every field of Logic");
+
+// Precisions of the fields stored in the header, throws std::runtime_error for unknown values
+static std::vector<Precision> storedPrecisions(const CheckpointHeader& header, const std::string& path) {
+	std::vector<Precision> precisions;
+	for (std::uint32_t field = 0; field < header.fields && field < CHECKPOINT_MAX_FIELDS; field++) {
+		if (header.precisions[field] > static_cast<std::uint8_t>(Precision::BFloat16))
+			throw std::runtime_error("'" + path + "' is a corrupt or truncated checkpoint");
+		precisions.push_back(static_cast<Precision>(header.precisions[field]));
+	}
+	return precisions;
+}
+
+// Write all bytes, write() may return after a part of them
+static void writeAll(int descriptor, const void* data, std::size_t bytes, const std::string& path) {
+	const char* next = static_cast<const char*>(data);
+	while (bytes > 0) {
+		ssize_t written = ::write(descriptor, next, bytes);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			throw std::runtime_error("cannot write checkpoint '" + path + "': " + std::strerror(errno));
+		next += written;
+		bytes -= static_cast<std::size_t>(written);
+	}
+}
+
+void Checkpoint::save(const std::string& path, Logic& logic, long step) {
+	const GridArena& arena = logic.arena();
+	Physics& physics = logic.physics();
+
+	std::vector<char> page(CHECKPOINT_DATA_OFFSET, 0);
+	CheckpointHeader header = {};
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.data_offset = static_cast<std::uint32_t>(CHECKPOINT_DATA_OFFSET);
+	header.size = static_cast<std::uint32_t>(arena.size());
+	header.stride = static_cast<std::uint32_t>(arena.stride());
+	header.fields = static_cast<std::uint32_t>(arena.fields());
+	header.data_bytes = arena.bytes();
+	header.step = step;
+	header.dt = logic.dt();
+	header.diffusion = logic.diffusion();
+	header.viscosity = logic.viscosity();
+	header.projection = static_cast<std::uint32_t>(physics.projectionSolver());
+	header.cycle = static_cast<std::uint32_t>(physics.multigrid().cycle());
+	header.relaxation = static_cast<std::uint32_t>(physics.relaxation());
+	header.domain = static_cast<std::uint32_t>(physics.domain());
+	header.advection = static_cast<std::uint32_t>(physics.advection());
+	header.tolerance = physics.multigrid().tolerance();
+	header.max_cycles = static_cast<std::uint32_t>(physics.multigrid().maxCycles());
+	header.diffusion_iterations = static_cast<std::uint32_t>(logic.diffusionIterations());
+	header.diffusion_tolerance = physics.diffusionTolerance();
+	header.projection_sweeps = static_cast<std::uint32_t>(physics.projectionSweeps());
+	header.projection_tolerance = physics.projectionTolerance();
+	header.residual_norm = static_cast<std::uint32_t>(physics.residualNorm());
+	header.warm_start = physics.warmStart() ? 1 : 0;
+	for (int field = 0; field < arena.fields(); field++)
+		header.precisions[field] = static_cast<std::uint8_t>(arena.precision(field));
+	std::memcpy(page.data(), &header, sizeof(header));
+
+	// Write and sync the temporary file completely before it replaces the previous checkpoint
+	std::string temporary = path + ".tmp";
+	int descriptor = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (descriptor < 0)
+		throw std::runtime_error("cannot create checkpoint '" + temporary + "': " + std::strerror(errno));
+	try {
+		writeAll(descriptor, page.data(), page.size(), temporary);
+		writeAll(descriptor, arena.data(), arena.bytes(), temporary);
+		if (::fsync(descriptor) != 0)
+			throw std::runtime_error("cannot sync checkpoint '" + temporary + "': " + std::strerror(errno));
+	} catch (...) {
+		::close(descriptor);
+		::unlink(temporary.c_str());
+		throw;
+	}
+	if (::close(descriptor) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0) {
+		std::string reason = std::strerror(errno);
+		::unlink(temporary.c_str());
+		throw std::runtime_error("cannot write checkpoint '" + path + "': " + reason);
+	}
+}
+
+CheckpointHeader Checkpoint::header(const std::string& path) {
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		throw std::runtime_error("cannot open checkpoint '" + path + "': " + std::strerror(errno));
+	CheckpointHeader header;
+	struct stat status;
+	bool valid = ::pread(descriptor, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))
+		&& ::fstat(descriptor, &status) == 0;
+	::close(descriptor);
+
+	if (!valid || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+		throw std::runtime_error("'" + path + "' is no checkpoint");
+	if (header.version != CHECKPOINT_VERSION)
+		throw std::runtime_error("'" + path + "' has the unsupported checkpoint version " + std::to_string(header.version));
+
+	// The layout has to be the one GridArena uses in this build, and the file must not be cut off
+	bool consistent = header.data_offset == CHECKPOINT_DATA_OFFSET && header.size >= 3
+		&& header.fields >= 1 && header.fields <= CHECKPOINT_MAX_FIELDS
+		&& header.stride == static_cast<std::uint32_t>(Grid::rowStride(header.size))
+		&& header.data_bytes == GridArena::layoutBytes(static_cast<int>(header.size), storedPrecisions(header, path))
+		&& static_cast<std::uint64_t>(status.st_size) == header.data_offset + header.data_bytes;
+	if (!consistent)
+		throw std::runtime_error("'" + path + "' is a corrupt or truncated checkpoint");
+	return header;
+}
+
+Logic Checkpoint::restore(const std::string& path, long& step) {
+	CheckpointHeader saved = header(path);
+	if (saved.fields != Logic::FIELDS)
+		throw std::runtime_error("'" + path + "' holds " + std::to_string(saved.fields) + " fields, expected "
+			+ std::to_string(Logic::FIELDS));
+
+	Logic logic(GridArena::map(path, saved.data_offset, static_cast<int>(saved.size), storedPrecisions(saved, path)),
+		saved.dt, saved.diffusion, saved.viscosity);
+	Physics& physics = logic.physics();
+	physics.setProjectionSolver(static_cast<ProjectionSolver>(saved.projection));
+	physics.setRelaxation(static_cast<Relaxation>(saved.relaxation));
+	physics.setDomain(static_cast<Domain>(saved.domain));
+	physics.setAdvection(static_cast<AdvectionScheme>(saved.advection));
+	physics.multigrid().setCycle(static_cast<Multigrid::Cycle>(saved.cycle));
+	physics.multigrid().setTolerance(saved.tolerance);
+	physics.multigrid().setMaxCycles(static_cast<int>(saved.max_cycles));
+	physics.setDiffusionTolerance(saved.diffusion_tolerance);
+	physics.setProjectionSweeps(static_cast<int>(saved.projection_sweeps));
+	physics.setProjectionTolerance(saved.projection_tolerance);
+	physics.setResidualNorm(static_cast<ResidualNorm>(saved.residual_norm));
+	physics.setWarmStart(saved.warm_start != 0);
+	logic.setDiffusionIterations(static_cast<int>(saved.diffusion_iterations));
+	step = static_cast<long>(saved.step);
+	return logic;
+}
@@ -0,0 +1,232 @@
+#include "../header/communicator.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/prctl.h>
+#endif
+
+const int Communicator::NO_RANK;
+
+// Every mailbox and the shared state start on their own cache line
+static const std::size_t LINE = 64;
+
+static std::size_t roundUp(std::size_t bytes) {
+	return (bytes + LINE - 1) / LINE * LINE;
+}
+
+struct Communicator::Shared {
+	// Sense reversing barrier: the last process to arrive resets the count and starts the next generation
+	std::atomic<int> arrived;
+	std::atomic<int> generation;
+
+	// Set by a process that failed, the others stop waiting for it
+	std::atomic<int> failed;
+};
+
+// Receiver and length of the message in a mailbox, stored in the cache line before the data
+struct MailboxHeader {
+	int dest;
+	std::uint64_t bytes;
+};
+
+static_assert(std::atomic<int>::is_always_lock_free, "the barrier needs lock-free atomics to work across processes");
+static_assert(sizeof(MailboxHeader) <= LINE, "the mailbox header has to fit into one cache line");
+
+Communicator::Communicator(Shared* shared, std::size_t mapping_bytes, int rank, int size, std::size_t capacity)
+	: _shared(shared), _mapping_bytes(mapping_bytes), _rank(rank), _size(size), _capacity(capacity), _child_failed(false) {}
+
+Communicator::~Communicator() {
+	::munmap(_shared, _mapping_bytes);
+}
+
+unsigned char* Communicator::mailbox(int rank) const {
+	std::size_t slot = LINE + roundUp(_capacity);
+	return reinterpret_cast<unsigned char*>(_shared) + roundUp(sizeof(Shared)) + rank * slot + LINE;
+}
+
+static MailboxHeader* header(unsigned char* mailbox) {
+	return reinterpret_cast<MailboxHeader*>(mailbox - LINE);
+}
+
+void Communicator::fail() {
+	_shared->failed.store(1, std::memory_order_release);
+}
+
+// A process that exits with an error or a signal while the others wait can never reach the barrier
+void Communicator::checkChildren() {
+	for (pid_t& child : _children) {
+		int status = 0;
+		if (child > 0 && ::waitpid(child, &status, WNOHANG) == child) {
+			child = 0;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				_child_failed = true;
+				fail();
+			}
+		}
+	}
+}
+
+void Communicator::barrier() {
+	int generation = _shared->generation.load(std::memory_order_acquire);
+	if (_shared->arrived.fetch_add(1, std::memory_order_acq_rel) == _size - 1) {
+		_shared->arrived.store(0, std::memory_order_relaxed);
+		_shared->generation.store(generation + 1, std::memory_order_release);
+		return;
+	}
+
+	// Spin briefly for the common case of balanced processes, then give the core to the processes still working
+	long spins = 0;
+	while (_shared->generation.load(std::memory_order_acquire) == generation) {
+		if (_shared->failed.load(std::memory_order_acquire))
+			throw std::runtime_error("another process of the communicator failed");
+		if (++spins > 256) {
+			sched_yield();
+			if (_rank == 0 && spins % 1024 == 0)
+				checkChildren();
+		}
+	}
+}
+
+void Communicator::sendrecv(const void* send, std::size_t send_bytes, int dest, void* receive, std::size_t receive_bytes,
+		int source) {
+	if (send_bytes > _capacity)
+		throw std::invalid_argument("message of " + std::to_string(send_bytes) + " bytes exceeds the mailbox capacity");
+	unsigned char* own = mailbox(_rank);
+	header(own)->dest = dest;
+	header(own)->bytes = dest == NO_RANK ? 0 : send_bytes;
+	if (dest != NO_RANK)
+		std::memcpy(own, send, send_bytes);
+	barrier();
+
+	if (source != NO_RANK) {
+		unsigned char* other = mailbox(source);
+		if (header(other)->dest != _rank || header(other)->bytes != receive_bytes) {
+			fail();
+			throw std::logic_error("sendrecv from rank " + std::to_string(source) + " does not match the receive of rank "
+				+ std::to_string(_rank));
+		}
+		std::memcpy(receive, other, receive_bytes);
+	}
+	barrier();
+}
+
+void Communicator::allgatherv(const void* send, void* receive, const std::vector<std::size_t>& bytes,
+		const std::vector<std::size_t>& offsets) {
+	if (bytes[_rank] > _capacity)
+		throw std::invalid_argument("message of " + std::to_string(bytes[_rank]) + " bytes exceeds the mailbox capacity");
+	std::memcpy(mailbox(_rank), send, bytes[_rank]);
+	barrier();
+
+	unsigned char* target = static_cast<unsigned char*>(receive);
+	for (int k = 0; k < _size; k++) {
+		if (k != _rank)
+			std::memcpy(target + offsets[k], mailbox(k), bytes[k]);
+		else if (target + offsets[k] != send)
+			std::memmove(target + offsets[k], send, bytes[k]);
+	}
+	barrier();
+}
+
+void Communicator::allreduce(double* values, int count, Reduce operation) {
+	std::size_t bytes = count * sizeof(double);
+	if (bytes > _capacity)
+		throw std::invalid_argument("message of " + std::to_string(bytes) + " bytes exceeds the mailbox capacity");
+	std::memcpy(mailbox(_rank), values, bytes);
+	barrier();
+
+	const double* first = reinterpret_cast<const double*>(mailbox(0));
+	std::copy(first, first + count, values);
+	for (int k = 1; k < _size; k++) {
+		const double* other = reinterpret_cast<const double*>(mailbox(k));
+		for (int l = 0; l < count; l++)
+			values[l] = operation == Sum ? values[l] + other[l] : std::max(values[l], other[l]);
+	}
+	barrier();
+}
+
+void Communicator::run(int processes, std::size_t capacity, const std::function<void(Communicator&)>& body) {
+	if (processes < 1)
+		throw std::invalid_argument("a communicator needs at least one process");
+	std::size_t bytes = roundUp(sizeof(Shared)) + processes * (LINE + roundUp(capacity));
+	void* mapping = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error(std::string("cannot map the shared memory of the communicator: ") + std::strerror(errno));
+	Shared* shared = new (mapping) Shared();
+	shared->arrived = 0;
+	shared->generation = 0;
+	shared->failed = 0;
+
+	// Buffered output would otherwise be written once by every process
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(nullptr);
+
+	std::vector<pid_t> children;
+	for (int rank = 1; rank < processes; rank++) {
+		pid_t pid = ::fork();
+		if (pid < 0) {
+			shared->failed = 1;
+			for (pid_t child : children)
+				::waitpid(child, nullptr, 0);
+			::munmap(mapping, bytes);
+			throw std::runtime_error(std::string("cannot start the processes of the communicator: ") + std::strerror(errno));
+		}
+		if (pid == 0) {
+#ifdef __linux__
+			// Do not outlive rank 0
+			::prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+			int status = 0;
+			{
+				Communicator communicator(shared, bytes, rank, processes, capacity);
+				try {
+					body(communicator);
+				} catch (const std::exception& error) {
+					// Only the process that failed first reports, the others just stop
+					if (!shared->failed.load())
+						std::cerr << "process " << rank << ": " << error.what() << std::endl;
+					communicator.fail();
+					status = 1;
+				}
+			}
+			std::cout.flush();
+			std::cerr.flush();
+			::_exit(status);
+		}
+		children.push_back(pid);
+	}
+
+	Communicator communicator(shared, bytes, 0, processes, capacity);
+	communicator._children = children;
+	std::exception_ptr error;
+	try {
+		body(communicator);
+	} catch (...) {
+		communicator.fail();
+		error = std::current_exception();
+	}
+
+	for (pid_t child : communicator._children) {
+		int status = 0;
+		if (child > 0 && ::waitpid(child, &status, 0) == child && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+			communicator._child_failed = true;
+	}
+	if (error)
+		std::rethrow_exception(error);
+	if (communicator._child_failed)
+		throw std::runtime_error("a process of the communicator failed");
+}
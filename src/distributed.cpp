@@ -0,0 +1,501 @@
+#include "../header/distributed.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+std::vector<int> DistributedLogic::split(int size, int processes) {
+	int interior = size - 2;
+	if (processes < 1 || processes > interior)
+		throw std::invalid_argument("a grid of size " + std::to_string(size) + " can be split across 1 to "
+			+ std::to_string(interior) + " processes");
+
+	// The interior rows are split evenly, the boundary rows belong to the first and the last rank
+	std::vector<int> rows(processes + 1);
+	rows[0] = 0;
+	for (int r = 1; r < processes; r++)
+		rows[r] = 1 + static_cast<int>(static_cast<long>(r) * interior / processes);
+	rows[processes] = size;
+	return rows;
+}
+
+// The largest message is the slab of a rank, the ghost rows and the row norms are smaller
+std::size_t DistributedLogic::capacity(int size, int processes) {
+	std::vector<int> rows = split(size, processes);
+	int largest = 0;
+	for (int r = 0; r < processes; r++)
+		largest = std::max(largest, rows[r + 1] - rows[r]);
+	return static_cast<std::size_t>(largest) * Grid::rowStride(size) * sizeof(float);
+}
+
+DistributedLogic::DistributedLogic(Communicator& communicator, int size, float dt, float diff, float visc)
+	: _communicator(communicator), _size(size), _dt(dt), _diffusion_coefficient(diff), _viscosity(visc),
+	_rows(split(size, communicator.size())), _arena(size, Logic::FIELDS) {
+	_first = _rows[communicator.rank()];
+	_last = _rows[communicator.rank() + 1];
+
+	// Same order of the fields as in Logic
+	_velocity_x = _arena.field(0);
+	_velocity_y = _arena.field(1);
+	_previous_velocity_x = _arena.field(2);
+	_previous_velocity_y = _arena.field(3);
+	_previous_density = _arena.field(4);
+	_density = _arena.field(5);
+	_pressure_diffused = _arena.field(6);
+	_pressure_advected = _arena.field(7);
+	_divergence = _arena.field(8);
+
+	_diffusion_iterations = 16;
+	_statistics = {0, 0, 0, 0};
+
+	_physics.setRelaxation(Relaxation::RedBlack);
+	_physics.setProjectionSolver(ProjectionSolver::RedBlack);
+
+	_row_squares.assign(size, 0.0);
+	_row_max.assign(size, 0.0f);
+	_row_pairs.assign(2 * size, 0.0);
+
+	std::size_t row_bytes = static_cast<std::size_t>(Grid::rowStride(size)) * sizeof(float);
+	for (int r = 0; r < communicator.size(); r++) {
+		_field_bytes.push_back((_rows[r + 1] - _rows[r]) * row_bytes);
+		_field_offsets.push_back(_rows[r] * row_bytes);
+		_pair_bytes.push_back((_rows[r + 1] - _rows[r]) * 2 * sizeof(double));
+		_pair_offsets.push_back(_rows[r] * 2 * sizeof(double));
+	}
+}
+
+// Shift the first own row up and the last own row down, the first and the last rank have no neighbour on one side
+void DistributedLogic::exchange(Grid& x) {
+	int rank = _communicator.rank();
+	int up = rank > 0 ? rank - 1 : Communicator::NO_RANK;
+	int down = rank < _communicator.size() - 1 ? rank + 1 : Communicator::NO_RANK;
+	float* above = up != Communicator::NO_RANK ? &x[x.index(0, _first - 1)] : nullptr;
+	float* below = down != Communicator::NO_RANK ? &x[x.index(0, _last)] : nullptr;
+	std::size_t bytes = _size * sizeof(float);
+	_communicator.sendrecv(&x[x.index(0, _first)], bytes, up, below, bytes, down);
+	_communicator.sendrecv(&x[x.index(0, _last - 1)], bytes, down, above, bytes, up);
+}
+
+// Every rank sends the norms of its rows, the maxima are stored as doubles which holds every float exactly
+void DistributedLogic::sumRows(double& squares, float& largest) {
+	for (int j = _first; j < _last; j++) {
+		_row_pairs[2 * j] = _row_squares[j];
+		_row_pairs[2 * j + 1] = _row_max[j];
+	}
+	_communicator.allgatherv(&_row_pairs[2 * _first], _row_pairs.data(), _pair_bytes, _pair_offsets);
+
+	squares = 0;
+	largest = 0;
+	for (int j = 0; j < _size; j++) {
+		squares += _row_pairs[2 * j];
+		largest = std::max(largest, static_cast<float>(_row_pairs[2 * j + 1]));
+	}
+}
+
+void DistributedLogic::gather(Grid& x) {
+	_communicator.allgatherv(&x[x.index(0, _first)], x.data(), _field_bytes, _field_offsets);
+}
+
+void DistributedLogic::relax(Boundary b, Grid& x, Grid& x0, float a, int& iterations, float& residual) {
+	float c = 1 + 4 * a;
+	double rhs_squares;
+	float rhs_max;
+	_physics.normRows(x0, interiorFirst(), interiorLast(), _row_squares.data(), _row_max.data());
+	sumRows(rhs_squares, rhs_max);
+
+	// The sweeps start from the values of the previous step, the rows of the neighbours included
+	exchange(x);
+
+	float tolerance = _physics.diffusionTolerance();
+	iterations = 0;
+	residual = 0;
+	for (int k = 0; k < _diffusion_iterations; k++) {
+		std::fill(_row_squares.begin(), _row_squares.end(), 0.0);
+		std::fill(_row_max.begin(), _row_max.end(), 0.0f);
+		for (int colour = 0; colour < 2; colour++) {
+			_physics.relaxRows(x, x0, a, colour, interiorFirst(), interiorLast(), _row_squares.data(), _row_max.data());
+			exchange(x);
+		}
+		_physics.setBnd(b, x, _first, _last);
+
+		double squares;
+		float largest;
+		sumRows(squares, largest);
+		iterations = k + 1;
+		residual = _physics.relativeResidual(squares * c * c, largest * c, rhs_squares, rhs_max);
+		if (tolerance > 0 && residual <= tolerance)
+			break;
+	}
+}
+
+void DistributedLogic::project(Grid& vx, Grid& vy, Grid& p, Grid& div, int& iterations, float& residual) {
+	// The divergence reads the velocity in y of the rows next to the own ones
+	exchange(vy);
+
+	double div_squares;
+	float div_max;
+	_physics.divergenceRows(vx, vy, p, div, interiorFirst(), interiorLast(), _row_squares.data(), _row_max.data());
+	sumRows(div_squares, div_max);
+	_physics.setBnd(Boundary::Scalar, div, _first, _last);
+	_physics.setBnd(Boundary::Scalar, p, _first, _last);
+	exchange(p);
+
+	float tolerance = _physics.projectionTolerance();
+	iterations = 0;
+	residual = 0;
+	for (int k = 0; k < _physics.projectionSweeps(); k++) {
+		std::fill(_row_squares.begin(), _row_squares.end(), 0.0);
+		std::fill(_row_max.begin(), _row_max.end(), 0.0f);
+		for (int colour = 0; colour < 2; colour++) {
+			_physics.pressureRows(p, div, colour, interiorFirst(), interiorLast(), _row_squares.data(), _row_max.data());
+			exchange(p);
+		}
+		_physics.setBnd(Boundary::Scalar, p, _first, _last);
+
+		double squares;
+		float largest;
+		sumRows(squares, largest);
+		iterations = k + 1;
+		residual = _physics.relativeResidual(squares * 16, largest * 4, div_squares, div_max);
+		if (tolerance > 0 && residual <= tolerance)
+			break;
+	}
+
+	_physics.gradientRows(vx, vy, p, interiorFirst(), interiorLast());
+	_physics.setBnd(Boundary::VelocityX, vx, _first, _last);
+	_physics.setBnd(Boundary::VelocityY, vy, _first, _last);
+}
+
+// Add the iterations and keep the largest residual of a solve to the statistics of the current step
+static void countSolve(int& iterations, float& residual, int solve_iterations, float solve_residual) {
+	iterations += solve_iterations;
+	residual = std::max(residual, solve_residual);
+}
+
+// Only the rank owning the cell adds the source, the clamping is the same as in Logic
+void DistributedLogic::addDensity(float x, float y, float amount) {
+	int index = _density.clampedIndex(x, y);
+	int row = index / _density.stride();
+	if (row >= _first && row < _last)
+		_density[index] += amount;
+}
+
+void DistributedLogic::addVelocity(float x, float y, float px, float py) {
+	int index = _velocity_x.clampedIndex(x, y);
+	int row = index / _velocity_x.stride();
+	if (row >= _first && row < _last) {
+		_velocity_x[index] += px;
+		_velocity_y[index] += py;
+	}
+}
+
+// The stages of Logic::step on the own rows
+void DistributedLogic::step() {
+	_statistics = {0, 0, 0, 0};
+	int iterations;
+	float residual;
+
+	// Viscous diffusion of the velocity field in x and y direction
+	float a = _dt * _viscosity * (_size - 2) * (_size - 2);
+	relax(Boundary::VelocityX, _previous_velocity_x, _velocity_x, a, iterations, residual);
+	countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual, iterations, residual);
+	relax(Boundary::VelocityY, _previous_velocity_y, _velocity_y, a, iterations, residual);
+	countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual, iterations, residual);
+
+	project(_previous_velocity_x, _previous_velocity_y, _pressure_diffused, _divergence, iterations, residual);
+	countSolve(_statistics.projection_iterations, _statistics.projection_residual, iterations, residual);
+
+	// Self-advection, the backtrace may end in any row of the previous velocity
+	gather(_previous_velocity_x);
+	gather(_previous_velocity_y);
+	AdvectedField velocity[2] = {{Boundary::VelocityX, _velocity_x, _previous_velocity_x},
+		{Boundary::VelocityY, _velocity_y, _previous_velocity_y}};
+	_physics.advectRows(velocity, 2, _previous_velocity_x, _previous_velocity_y, _dt, interiorFirst(), interiorLast());
+	_physics.setBnd(Boundary::VelocityX, _velocity_x, _first, _last);
+	_physics.setBnd(Boundary::VelocityY, _velocity_y, _first, _last);
+
+	project(_velocity_x, _velocity_y, _pressure_advected, _divergence, iterations, residual);
+	countSolve(_statistics.projection_iterations, _statistics.projection_residual, iterations, residual);
+
+	// Diffusion and advection of the smoke density
+	a = _dt * _diffusion_coefficient * (_size - 2) * (_size - 2);
+	relax(Boundary::Scalar, _previous_density, _density, a, iterations, residual);
+	countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual, iterations, residual);
+
+	gather(_previous_density);
+	AdvectedField density[1] = {{Boundary::Scalar, _density, _previous_density}};
+	_physics.advectRows(density, 1, _velocity_x, _velocity_y, _dt, interiorFirst(), interiorLast());
+	_physics.setBnd(Boundary::Scalar, _density, _first, _last);
+}
+
+void DistributedLogic::fadeDensity() {
+	float* values = &_density[_density.index(0, _first)];
+	int elements = (_last - _first) * _density.stride();
+	for (int i = 0; i < elements; i++) {
+		float d = values[i];
+		values[i] = (d - 0.05f < 0) ? 0 : d - 0.05f;
+	}
+}
+
+void DistributedLogic::totals(double& mass, double& max_density, double& kinetic_energy) {
+	double sums[2] = {0, 0};
+	double largest = 0;
+	int end = _last * _density.stride();
+	for (int k = _first * _density.stride(); k < end; k++) {
+		sums[0] += _density[k];
+		largest = std::max<double>(largest, _density[k]);
+		sums[1] += 0.5 * (static_cast<double>(_velocity_x[k]) * _velocity_x[k]
+			+ static_cast<double>(_velocity_y[k]) * _velocity_y[k]);
+	}
+	_communicator.allreduce(sums, 2, Communicator::Sum);
+	_communicator.allreduce(&largest, 1, Communicator::Max);
+	mass = sums[0];
+	kinetic_energy = sums[1];
+	max_density = largest;
+}
+
+// Print the available command line options
+void Distributed::usage(const char* program) {
+	std::cout << "Usage: " << program << " [options] [fluid_headless options]\n"
+		<< "  --processes N    number of processes the rows of the grid are split across (default 2)\n"
+		<< "  --verify         compare the result with a single process run\n"
+		<< "  --verify-tolerance T  largest accepted difference relative to the largest value of a field (default 1e-5)\n"
+		<< "  --scaling        run with 1, 2, 4, ... processes and report speedup and efficiency\n"
+		<< "All other options are fluid_headless options (see fluid_headless --help). The diffusion and the pressure\n"
+		<< "always use red-black sweeps, --threads, --active-tiles, the multigrid solvers, frames, checkpoints,\n"
+		<< "--profile and --trace are not available.\n";
+}
+
+// Parse fluid_headless options, argv[0] is not an option
+static HeadlessOptions parseHeadless(const std::vector<std::string>& arguments) {
+	std::vector<char*> argv;
+	static char program[] = "fluid_distributed";
+	argv.push_back(program);
+	for (const std::string& argument : arguments)
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	return Headless::parse(static_cast<int>(argv.size()), argv.data());
+}
+
+// Parse the command line, the options of the distributed run are taken out and the rest is left to Headless::parse
+DistributedOptions Distributed::parse(int argc, char** argv) {
+	DistributedOptions options;
+	std::vector<std::string> headless;
+	for (int k = 1; k < argc; k++) {
+		std::string option = argv[k];
+
+		auto value = [&]() -> std::string {
+			if (k + 1 >= argc)
+				throw std::invalid_argument("missing value for " + option);
+			return argv[++k];
+		};
+
+		if (option == "--processes")
+			options.processes = Headless::toInt(option, value());
+		else if (option == "--verify")
+			options.verify = true;
+		else if (option == "--verify-tolerance")
+			options.verify_tolerance = Headless::toFloat(option, value());
+		else if (option == "--scaling")
+			options.scaling = true;
+		else
+			headless.push_back(option);
+	}
+
+	HeadlessOptions& simulation = options.simulation;
+	simulation = parseHeadless(headless);
+	if (simulation.projection == ProjectionSolver::Multigrid)
+		throw std::invalid_argument("the distributed solver projects with red-black sweeps, multigrid is not available");
+	if (simulation.threads != 1)
+		throw std::invalid_argument("--threads is not available, --processes sets the parallelism");
+	if (simulation.active_tiles)
+		throw std::invalid_argument("--active-tiles is not available for distributed runs");
+	if (!simulation.frames.path.empty() || !simulation.checkpoint.empty() || !simulation.restore.empty())
+		throw std::invalid_argument("frames and checkpoints are not available for distributed runs");
+	if (simulation.profile || !simulation.trace.empty())
+		throw std::invalid_argument("--profile and --trace are not available for distributed runs");
+	if (simulation.accuracy || simulation.precisions.fields() != FieldPrecisions().fields())
+		throw std::invalid_argument("--precision and --accuracy are not available for distributed runs");
+	if (simulation.domain != Domain::Walls)
+		throw std::invalid_argument("--boundary is not available for distributed runs, the slabs only exchange the rows of their neighbours");
+	if (simulation.advection != AdvectionScheme::SemiLagrangian)
+		throw std::invalid_argument("--advection is not available for distributed runs");
+	if (simulation.particles > 0)
+		throw std::invalid_argument("--particles is not available for distributed runs");
+	if (options.verify_tolerance < 0)
+		throw std::invalid_argument("--verify-tolerance must not be negative");
+	simulation.relaxation = Relaxation::RedBlack;
+	simulation.projection = ProjectionSolver::RedBlack;
+
+	// Fails for more processes than interior rows
+	DistributedLogic::split(simulation.size, options.processes);
+	return options;
+}
+
+Distributed::Distributed(const DistributedOptions& options) : _options(options) {
+	if (!_options.simulation.script.empty())
+		_script = SourceScript::load(_options.simulation.script);
+	for (const SourceEvent& event : _script.events()) {
+		if (event.type == SourceEvent::Particles)
+			throw std::invalid_argument("particle sources are not available for distributed runs");
+	}
+}
+
+// Solver settings of the distributed run and of the single process reference
+static void configure(Physics& physics, const HeadlessOptions& options) {
+	physics.setRelaxation(Relaxation::RedBlack);
+	physics.setProjectionSolver(ProjectionSolver::RedBlack);
+	physics.setProjectionTolerance(options.tolerance);
+	physics.setProjectionSweeps(options.projection_iterations);
+	physics.setDiffusionTolerance(options.diffusion_tolerance);
+	physics.setResidualNorm(options.residual_norm);
+	physics.setWarmStart(options.warm_start);
+}
+
+HeadlessResult Distributed::simulate(int processes, GridArena* fields) {
+	const HeadlessOptions& options = _options.simulation;
+	HeadlessResult result = {};
+	result.steps = std::max(options.steps, 0);
+
+	// Rank 0 is this process, so the result it writes is seen here
+	Communicator::run(processes, DistributedLogic::capacity(options.size, processes), [&](Communicator& communicator) {
+		DistributedLogic logic(communicator, options.size, options.dt, options.diffusion, options.viscosity);
+		configure(logic.physics(), options);
+		logic.setDiffusionIterations(options.diffusion_iterations);
+
+		long diffusion_iterations = 0;
+		long projection_iterations = 0;
+		communicator.barrier();
+		auto start = std::chrono::steady_clock::now();
+		for (long step = 0; step < options.steps; step++) {
+			_script.apply(logic, step);
+			logic.step();
+			diffusion_iterations += logic.statistics().diffusion_iterations;
+			projection_iterations += logic.statistics().projection_iterations;
+			if (options.fade)
+				logic.fadeDensity();
+		}
+		communicator.barrier();
+		auto end = std::chrono::steady_clock::now();
+
+		double mass, max_density, kinetic_energy;
+		logic.totals(mass, max_density, kinetic_energy);
+		if (fields) {
+			logic.gather(logic.density());
+			logic.gather(logic.velocity_x());
+			logic.gather(logic.velocity_y());
+		}
+		if (communicator.rank() != 0)
+			return;
+
+		result.seconds = std::chrono::duration<double>(end - start).count();
+		result.mass = mass;
+		result.max_density = max_density;
+		result.kinetic_energy = kinetic_energy;
+		if (result.steps > 0) {
+			result.diffusion_iterations = static_cast<double>(diffusion_iterations) / result.steps;
+			result.projection_iterations = static_cast<double>(projection_iterations) / result.steps;
+		}
+		result.diffusion_residual = logic.statistics().diffusion_residual;
+		result.projection_residual = logic.statistics().projection_residual;
+		if (fields) {
+			std::copy(logic.density().begin(), logic.density().end(), fields->field(0).begin());
+			std::copy(logic.velocity_x().begin(), logic.velocity_x().end(), fields->field(1).begin());
+			std::copy(logic.velocity_y().begin(), logic.velocity_y().end(), fields->field(2).begin());
+		}
+	});
+	return result;
+}
+
+// Largest absolute difference of two fields relative to the largest absolute value of the reference
+static float relativeDifference(const Grid& reference, const Grid& field, float& difference) {
+	difference = 0;
+	float magnitude = 0;
+	for (int k = 0; k < reference.elements(); k++) {
+		difference = std::max(difference, std::fabs(reference[k] - field[k]));
+		magnitude = std::max(magnitude, std::fabs(reference[k]));
+	}
+	return magnitude > 0 ? difference / magnitude : difference;
+}
+
+void Distributed::run() {
+	const HeadlessOptions& options = _options.simulation;
+	GridArena fields(options.size, 3);
+	HeadlessResult result = simulate(_options.processes, _options.verify ? &fields : nullptr);
+	double steps_per_second = result.seconds > 0 ? result.steps / result.seconds : 0;
+
+	std::vector<int> rows = DistributedLogic::split(options.size, _options.processes);
+	int fewest = options.size;
+	int most = 0;
+	for (int r = 0; r < _options.processes; r++) {
+		fewest = std::min(fewest, rows[r + 1] - rows[r]);
+		most = std::max(most, rows[r + 1] - rows[r]);
+	}
+
+	std::cout << "grid:           " << options.size << " x " << options.size << "\n"
+		<< "processes:      " << _options.processes << " (" << fewest << " to " << most << " rows each)\n"
+		<< "steps:          " << result.steps << "\n"
+		<< "time:           " << result.seconds << " s\n"
+		<< "steps/second:   " << steps_per_second << "\n"
+		<< "cells/second:   " << steps_per_second * options.size * options.size << "\n"
+		<< "total density:  " << result.mass << "\n"
+		<< "diffusion:      " << result.diffusion_iterations
+		<< " iterations/step, last residual " << result.diffusion_residual << "\n"
+		<< "projection:     " << result.projection_iterations
+		<< " iterations/step, last residual " << result.projection_residual << std::endl;
+
+	bool verified = true;
+	if (_options.verify) {
+		// The same steps in this process with the same kernels and solver settings
+		Logic reference(options.size, options.dt, options.diffusion, options.viscosity);
+		configure(reference.physics(), options);
+		reference.setDiffusionIterations(options.diffusion_iterations);
+		for (long step = 0; step < options.steps; step++) {
+			_script.apply(reference, step);
+			reference.step();
+			if (options.fade)
+				reference.fadeDensity();
+		}
+
+		const char* names[3] = {"density", "velocity x", "velocity y"};
+		const Grid* expected[3] = {&reference.density(), &reference.velocity_x(), &reference.velocity_y()};
+		for (int f = 0; f < 3; f++) {
+			float difference;
+			float relative = relativeDifference(*expected[f], fields.field(f), difference);
+			verified = verified && relative <= _options.verify_tolerance;
+			std::cout << "verify:         " << names[f] << " max difference " << difference << " (relative " << relative
+				<< ")" << std::endl;
+		}
+	}
+
+	if (_options.scaling) {
+		// Efficiency is the speedup divided by the number of processes, processes beyond the cores of the machine
+		// share them and cannot speed up the run
+		std::cout << "scaling:        " << std::thread::hardware_concurrency() << " hardware threads\n"
+			<< "  processes      seconds  steps/second  speedup  efficiency\n";
+		std::vector<int> counts;
+		for (int processes = 1; processes < _options.processes; processes *= 2)
+			counts.push_back(processes);
+		counts.push_back(_options.processes);
+
+		double serial = 0;
+		for (int processes : counts) {
+			double seconds = simulate(processes, nullptr).seconds;
+			if (processes == 1)
+				serial = seconds;
+			double speedup = seconds > 0 ? serial / seconds : 0;
+			std::cout << "  " << std::setw(9) << processes << "  " << std::setw(11) << std::fixed << std::setprecision(3)
+				<< seconds << "  " << std::setw(12) << std::setprecision(1) << (seconds > 0 ? result.steps / seconds : 0)
+				<< "  " << std::setw(7) << std::setprecision(2) << speedup << "  " << std::setw(9)
+				<< std::setprecision(0) << 100 * speedup / processes << "%" << std::endl;
+		}
+		std::cout << std::defaultfloat << std::setprecision(6);
+	}
+
+	if (!verified)
+		throw std::runtime_error("the distributed result differs from the single process result by more than "
+			+ std::to_string(_options.verify_tolerance));
+}
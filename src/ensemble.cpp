@@ -0,0 +1,394 @@
+#include "../header/ensemble.h"
+#include "../header/work_stealing.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// Print the available command line options
+void Ensemble::usage(const char* program) {
+	std::cout << "Usage: " << program << " [options] [fluid_headless options]\n"
+		<< "  --members FILE   one member per line: a name followed by fluid_headless options\n"
+		<< "  --dt-values L    comma separated time steps, every member runs with each of them\n"
+		<< "  --diffusion-values L  comma separated diffusion coefficients\n"
+		<< "  --viscosity-values L  comma separated viscosities\n"
+		<< "  --scripts L      comma separated source scripts\n"
+		<< "  --jobs N         members simulated at the same time (default: one per hardware thread)\n"
+		<< "  --frames-dir DIR write the frames of every member to DIR/<member>.frames\n"
+		<< "  --json FILE      write the member statistics as JSON to FILE\n"
+		<< "  --csv FILE       write the member statistics as CSV to FILE\n"
+		<< "All other options are fluid_headless options shared by every member (see fluid_headless --help).\n"
+		<< "Members run single threaded, --threads, --profile and --trace are not available.\n"
+		<< "--frames and --checkpoint can only be given per member in the member file, --restore is not available.\n";
+}
+
+// Split a comma separated list, empty entries are dropped
+static std::vector<std::string> split(const std::string& text) {
+	std::vector<std::string> items;
+	std::istringstream in(text);
+	std::string item;
+	while (std::getline(in, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+static std::vector<float> toFloats(const std::string& option, const std::string& text) {
+	std::vector<float> values;
+	for (const std::string& item : split(text))
+		values.push_back(Headless::toFloat(option, item));
+	if (values.empty())
+		throw std::invalid_argument(option + " needs at least one value");
+	return values;
+}
+
+// Parse fluid_headless options on top of the given ones, argv[0] is not an option
+static HeadlessOptions parseHeadless(const std::vector<std::string>& arguments, const HeadlessOptions& options) {
+	std::vector<char*> argv;
+	static char program[] = "fluid_ensemble";
+	argv.push_back(program);
+	for (const std::string& argument : arguments)
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	return Headless::parse(static_cast<int>(argv.size()), argv.data(), options);
+}
+
+// Options that would interfere between members running side by side
+static void checkMember(const std::string& name, const HeadlessOptions& options) {
+	if (options.threads != 1)
+		throw std::invalid_argument(name + ": members run single threaded, --jobs sets the number of members run at once");
+	if (options.profile || !options.trace.empty())
+		throw std::invalid_argument(name + ": --profile and --trace are not available for ensemble members");
+	if (options.accuracy)
+		throw std::invalid_argument(name + ": --accuracy is only available for fluid_headless");
+	// A restored run takes dt, diffusion and viscosity from the checkpoint, which would silently replace the sweeps
+	if (!options.restore.empty())
+		throw std::invalid_argument(name + ": --restore is only available for fluid_headless");
+}
+
+// Options of files every member would write to, they can only be given per member
+static void checkBase(const HeadlessOptions& options) {
+	if (!options.frames.path.empty())
+		throw std::invalid_argument("base options: --frames would be shared by every member, use --frames-dir");
+	if (!options.checkpoint.empty())
+		throw std::invalid_argument("base options: --checkpoint would be shared by every member, give it per member");
+}
+
+// Parse the command line, the options of the ensemble are taken out and the rest is left to Headless::parse
+EnsembleOptions Ensemble::parse(int argc, char** argv) {
+	EnsembleOptions options;
+	std::vector<std::string> headless;
+	for (int k = 1; k < argc; k++) {
+		std::string option = argv[k];
+
+		auto value = [&]() -> std::string {
+			if (k + 1 >= argc)
+				throw std::invalid_argument("missing value for " + option);
+			return argv[++k];
+		};
+
+		if (option == "--members")
+			options.members = value();
+		else if (option == "--dt-values")
+			options.dt_values = toFloats(option, value());
+		else if (option == "--diffusion-values")
+			options.diffusion_values = toFloats(option, value());
+		else if (option == "--viscosity-values")
+			options.viscosity_values = toFloats(option, value());
+		else if (option == "--scripts") {
+			options.scripts = split(value());
+			if (options.scripts.empty())
+				throw std::invalid_argument("--scripts needs at least one script");
+		}
+		else if (option == "--jobs")
+			options.jobs = Headless::toInt(option, value());
+		else if (option == "--frames-dir")
+			options.frames_dir = value();
+		else if (option == "--json")
+			options.json = value();
+		else if (option == "--csv")
+			options.csv = value();
+		else
+			headless.push_back(option);
+	}
+
+	options.base = parseHeadless(headless, HeadlessOptions());
+	checkMember("base options", options.base);
+	checkBase(options.base);
+	if (options.jobs < 0)
+		throw std::invalid_argument("--jobs must not be negative");
+	return options;
+}
+
+Ensemble::Ensemble(const EnsembleOptions& options) : _options(options), _threads(0), _steals(0), _seconds(0) {
+	buildMembers();
+}
+
+// Short form of a number for member names, e.g. 0.0005 instead of 0.000500
+static std::string shortNumber(float value) {
+	std::ostringstream out;
+	out << value;
+	return out.str();
+}
+
+// File name of a script without directory and extension
+static std::string scriptName(const std::string& path) {
+	std::string name = path.substr(path.find_last_of('/') + 1);
+	std::size_t dot = name.find_last_of('.');
+	return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+void Ensemble::buildMembers() {
+	std::vector<EnsembleMember> listed;
+	if (_options.members.empty()) {
+		listed.push_back({"run", _options.base});
+	} else {
+		std::ifstream file(_options.members);
+		if (!file)
+			throw std::runtime_error("cannot open member file '" + _options.members + "'");
+		std::string line;
+		int line_number = 0;
+		while (std::getline(file, line)) {
+			line_number++;
+			std::istringstream in(line);
+			std::string name;
+			if (!(in >> name) || name[0] == '#')
+				continue;
+			std::vector<std::string> arguments;
+			std::string argument;
+			while (in >> argument && argument[0] != '#')
+				arguments.push_back(argument);
+			try {
+				listed.push_back({name, parseHeadless(arguments, _options.base)});
+			} catch (const std::invalid_argument& error) {
+				throw std::invalid_argument(_options.members + ":" + std::to_string(line_number) + ": " + error.what());
+			}
+		}
+		if (listed.empty())
+			throw std::invalid_argument("'" + _options.members + "' lists no members");
+	}
+
+	// An empty list keeps the value of the member, a list of values adds them to the name
+	for (const EnsembleMember& member : listed) {
+		std::vector<float> dts = _options.dt_values.empty() ? std::vector<float>{member.options.dt} : _options.dt_values;
+		std::vector<float> diffusions = _options.diffusion_values.empty()
+			? std::vector<float>{member.options.diffusion} : _options.diffusion_values;
+		std::vector<float> viscosities = _options.viscosity_values.empty()
+			? std::vector<float>{member.options.viscosity} : _options.viscosity_values;
+		std::vector<std::string> scripts = _options.scripts.empty()
+			? std::vector<std::string>{member.options.script} : _options.scripts;
+
+		for (float dt : dts) {
+			for (float diffusion : diffusions) {
+				for (float viscosity : viscosities) {
+					for (const std::string& script : scripts) {
+						EnsembleMember expanded = member;
+						expanded.options.dt = dt;
+						expanded.options.diffusion = diffusion;
+						expanded.options.viscosity = viscosity;
+						expanded.options.script = script;
+						if (!_options.dt_values.empty())
+							expanded.name += "-dt" + shortNumber(dt);
+						if (!_options.diffusion_values.empty())
+							expanded.name += "-diff" + shortNumber(diffusion);
+						if (!_options.viscosity_values.empty())
+							expanded.name += "-visc" + shortNumber(viscosity);
+						if (!_options.scripts.empty())
+							expanded.name += "-" + scriptName(script);
+						_members.push_back(expanded);
+					}
+				}
+			}
+		}
+	}
+
+	for (std::size_t k = 0; k < _members.size(); k++) {
+		EnsembleMember& member = _members[k];
+		checkMember(member.name, member.options);
+		for (std::size_t l = 0; l < k; l++)
+			if (_members[l].name == member.name)
+				throw std::invalid_argument("the member name '" + member.name + "' is used twice");
+		if (!_options.frames_dir.empty() && member.options.frames.path.empty())
+			member.options.frames.path = _options.frames_dir + "/" + member.name + ".frames";
+	}
+
+	// A member line expanded by the value lists keeps its file options, the expanded members would share the files
+	for (std::size_t k = 0; k < _members.size(); k++) {
+		const HeadlessOptions& options = _members[k].options;
+		for (std::size_t l = 0; l < k; l++) {
+			const HeadlessOptions& other = _members[l].options;
+			if (!options.frames.path.empty() && options.frames.path == other.frames.path)
+				throw std::invalid_argument("the members '" + _members[l].name + "' and '" + _members[k].name
+					+ "' write to the same frame file '" + options.frames.path + "'");
+			if (!options.checkpoint.empty() && options.checkpoint == other.checkpoint)
+				throw std::invalid_argument("the members '" + _members[l].name + "' and '" + _members[k].name
+					+ "' write to the same checkpoint '" + options.checkpoint + "'");
+		}
+	}
+}
+
+// Grid cells times steps, the order in which the members are started
+static double cost(const HeadlessOptions& options) {
+	return static_cast<double>(options.size) * options.size * options.steps;
+}
+
+void Ensemble::run() {
+	int hardware = static_cast<int>(std::thread::hardware_concurrency());
+	_threads = _options.jobs > 0 ? _options.jobs : std::max(hardware, 1);
+	_threads = std::min<int>(_threads, static_cast<int>(_members.size()));
+
+	// Longest members first, each thread works through its share from the front
+	std::vector<std::size_t> order(_members.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+		return cost(_members[a].options) > cost(_members[b].options);
+	});
+
+	// Every task writes only its own result, the simulation and its arena are created on the thread that runs it
+	_results.assign(_members.size(), EnsembleResult());
+	std::vector<std::function<void(int)>> tasks;
+	for (std::size_t index : order) {
+		tasks.push_back([this, index](int thread) {
+			EnsembleResult& result = _results[index];
+			result.member = _members[index];
+			result.thread = thread;
+			try {
+				Headless headless(result.member.options);
+				result.result = headless.simulate();
+			} catch (const std::exception& error) {
+				result.error = error.what();
+			}
+		});
+	}
+
+	WorkStealingPool pool(_threads);
+	auto start = std::chrono::steady_clock::now();
+	pool.run(std::move(tasks));
+	_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	_steals = pool.steals();
+
+	// Work of all members, the busy time of the threads compared to the wall clock time shows how well they were used
+	double member_seconds = 0;
+	double cell_steps = 0;
+	int failed = 0;
+	std::size_t width = 6;
+	for (const EnsembleResult& r : _results)
+		width = std::max(width, r.member.name.size());
+
+	std::cout << std::left << std::setw(static_cast<int>(width)) << "member" << std::right
+		<< std::setw(6) << "size" << std::setw(8) << "steps" << std::setw(11) << "seconds" << std::setw(11) << "steps/s"
+		<< std::setw(13) << "density" << std::setw(11) << "max" << std::setw(13) << "energy"
+		<< std::setw(8) << "diff" << std::setw(8) << "proj" << std::setw(8) << "thread" << "\n";
+	for (const EnsembleResult& r : _results) {
+		std::cout << std::left << std::setw(static_cast<int>(width)) << r.member.name << std::right;
+		if (!r.error.empty()) {
+			std::cout << "  failed: " << r.error << "\n";
+			failed++;
+			continue;
+		}
+		const HeadlessResult& h = r.result;
+		member_seconds += h.seconds;
+		cell_steps += static_cast<double>(r.member.options.size) * r.member.options.size * h.steps;
+		std::cout << std::setw(6) << r.member.options.size << std::setw(8) << h.steps
+			<< std::fixed << std::setprecision(3) << std::setw(11) << h.seconds
+			<< std::setprecision(1) << std::setw(11) << (h.seconds > 0 ? h.steps / h.seconds : 0)
+			<< std::setw(13) << h.mass << std::setw(11) << h.max_density
+			<< std::setprecision(4) << std::setw(13) << h.kinetic_energy
+			<< std::setprecision(1) << std::setw(8) << h.diffusion_iterations << std::setw(8) << h.projection_iterations
+			<< std::defaultfloat << std::setw(8) << r.thread << "\n";
+	}
+
+	std::cout << std::setprecision(6) << "members:        " << _members.size() << (failed > 0 ? " (" + std::to_string(failed) + " failed)" : "") << "\n"
+		<< "threads:        " << _threads << ", " << _steals << " members stolen\n"
+		<< "time:           " << _seconds << " s\n"
+		<< "member time:    " << member_seconds << " s, " << (_seconds > 0 ? member_seconds / _seconds : 0)
+		<< " members running on average\n"
+		<< "cells/second:   " << (_seconds > 0 ? cell_steps / _seconds : 0) << std::endl;
+
+	if (!_options.json.empty()) {
+		std::ofstream out(_options.json);
+		if (!out)
+			throw std::runtime_error("cannot write results to '" + _options.json + "'");
+		writeJson(out);
+	}
+	if (!_options.csv.empty()) {
+		std::ofstream out(_options.csv);
+		if (!out)
+			throw std::runtime_error("cannot write results to '" + _options.csv + "'");
+		writeCsv(out);
+	}
+	if (failed > 0)
+		throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(_members.size()) + " members failed");
+}
+
+// Escape a string for a JSON string literal, member names and error messages are plain text
+static std::string jsonString(const std::string& text) {
+	std::string escaped = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+	}
+	return escaped + "\"";
+}
+
+// The totals of the run followed by one object per member
+void Ensemble::writeJson(std::ostream& out) const {
+	out << std::setprecision(9)
+		<< "{\n  \"threads\": " << _threads << ", \"steals\": " << _steals << ", \"seconds\": " << _seconds
+		<< ",\n  \"members\": [\n";
+	for (std::size_t k = 0; k < _results.size(); k++) {
+		const EnsembleResult& r = _results[k];
+		const HeadlessOptions& o = r.member.options;
+		const HeadlessResult& h = r.result;
+		out << "    {\"name\": " << jsonString(r.member.name) << ", \"size\": " << o.size << ", \"dt\": " << o.dt
+			<< ", \"diffusion\": " << o.diffusion << ", \"viscosity\": " << o.viscosity
+			<< ", \"script\": " << jsonString(o.script) << ", \"thread\": " << r.thread;
+		if (!r.error.empty()) {
+			out << ", \"error\": " << jsonString(r.error);
+		} else {
+			out << ", \"steps\": " << h.steps << ", \"seconds\": " << h.seconds << ", \"mass\": " << h.mass
+				<< ", \"max_density\": " << h.max_density << ", \"kinetic_energy\": " << h.kinetic_energy
+				<< ", \"diffusion_iterations\": " << h.diffusion_iterations
+				<< ", \"projection_iterations\": " << h.projection_iterations
+				<< ", \"active_tiles\": " << h.active_tiles << ", \"frames\": " << h.frames_written;
+		}
+		out << "}" << (k + 1 < _results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+// Failed members have an empty statistics part and the error in the last column
+// Quoted CSV field, embedded quotes are doubled (RFC 4180), so commas and quotes in names, paths and errors keep the
+// columns in place
+static std::string csvString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+void Ensemble::writeCsv(std::ostream& out) const {
+	out << std::setprecision(9) << "name,size,dt,diffusion,viscosity,script,thread,steps,seconds,mass,max_density,"
+		"kinetic_energy,diffusion_iterations,projection_iterations,active_tiles,frames,error\n";
+	for (const EnsembleResult& r : _results) {
+		const HeadlessOptions& o = r.member.options;
+		const HeadlessResult& h = r.result;
+		out << csvString(r.member.name) << "," << o.size << "," << o.dt << "," << o.diffusion << "," << o.viscosity
+			<< "," << csvString(o.script) << "," << r.thread << ",";
+		if (r.error.empty()) {
+			out << h.steps << "," << h.seconds << "," << h.mass << "," << h.max_density << "," << h.kinetic_energy << ","
+				<< h.diffusion_iterations << "," << h.projection_iterations << "," << h.active_tiles << ","
+				<< h.frames_written << "," << csvString("") << "\n";
+		} else {
+			out << ",,,,,,,,," << csvString(r.error) << "\n";
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "../../header/ensemble.h"
+
+// Run a set of independent simulations side by side and summarize them
+int main(int argc, char** argv) {
+	for (int k = 1; k < argc; k++) {
+		if (std::strcmp(argv[k], "--help") == 0 || std::strcmp(argv[k], "-h") == 0) {
+			Ensemble::usage(argv[0]);
+			return 0;
+		}
+	}
+
+	try {
+		Ensemble ensemble(Ensemble::parse(argc, argv));
+		ensemble.run();
+	} catch (const std::exception& error) {
+		std::cerr << argv[0] << ": " << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "../header/fft.h"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+bool FFT::supports(int n) {
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+// The twiddles are computed in double, so their error does not grow with the length
+FFT::FFT(int n) : _n(n) {
+	if (!supports(n))
+		throw std::invalid_argument("the FFT length " + std::to_string(n) + " is not a power of two");
+	_reversed.resize(n);
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int j = 0; j < n; j++) {
+		int reversed = 0;
+		for (int b = 0; b < bits; b++)
+			reversed |= ((j >> b) & 1) << (bits - 1 - b);
+		_reversed[j] = reversed;
+	}
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < n / 2; k++) {
+		double angle = -2 * pi * k / n;
+		_twiddles.emplace_back(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+	}
+}
+
+// Iterative decimation in time: bit reversal, then log2(n) passes of butterflies with growing span. The inverse uses the
+// conjugated twiddles.
+void FFT::transform(std::complex<float>* data, bool inverse) const {
+	for (int j = 0; j < _n; j++) {
+		if (j < _reversed[j])
+			std::swap(data[j], data[_reversed[j]]);
+	}
+
+	float* values = reinterpret_cast<float*>(data);
+	float sign = inverse ? -1.0f : 1.0f;
+	for (int span = 1; span < _n; span *= 2) {
+		int step = _n / (2 * span);
+		for (int start = 0; start < _n; start += 2 * span) {
+			for (int k = 0; k < span; k++) {
+				float wr = _twiddles[k * step].real();
+				float wi = sign * _twiddles[k * step].imag();
+				float* a = values + 2 * (start + k);
+				float* b = values + 2 * (start + k + span);
+				float tr = wr * b[0] - wi * b[1];
+				float ti = wr * b[1] + wi * b[0];
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
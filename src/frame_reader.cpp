@@ -0,0 +1,178 @@
+#include "../header/frames.h"
+#include "../header/half.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FrameReader::FrameReader(const std::string& path) : _data(nullptr), _length(0) {
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		throw std::runtime_error("cannot open frame file '" + path + "': " + std::strerror(errno));
+	struct stat status;
+	if (::fstat(descriptor, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(FrameFileHeader)) {
+		::close(descriptor);
+		throw std::runtime_error("'" + path + "' is no frame file");
+	}
+	_length = static_cast<std::size_t>(status.st_size);
+	void* mapping = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, descriptor, 0);
+	::close(descriptor);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("cannot map frame file '" + path + "': " + std::strerror(errno));
+	_data = static_cast<const unsigned char*>(mapping);
+
+	try {
+		std::memcpy(&_header, _data, sizeof(_header));
+		if (std::memcmp(_header.magic, FRAME_FILE_MAGIC, sizeof(_header.magic)) != 0)
+			throw std::runtime_error("'" + path + "' is no frame file");
+		if (_header.version != FRAME_FILE_VERSION)
+			throw std::runtime_error("'" + path + "' has the unsupported version " + std::to_string(_header.version));
+		if (_header.size < 3 || _header.fields == 0 || _header.encoding > static_cast<std::uint32_t>(FrameEncoding::Delta16))
+			throw std::runtime_error("'" + path + "' has a corrupt header");
+
+		std::size_t offset = sizeof(_header);
+		if (offset + _header.fields * FRAME_NAME_LENGTH > _length)
+			throw std::runtime_error("'" + path + "' has a corrupt header");
+		for (std::uint32_t k = 0; k < _header.fields; k++) {
+			const char* name = reinterpret_cast<const char*>(_data + offset);
+			_fields.emplace_back(name, strnlen(name, FRAME_NAME_LENGTH));
+			offset += FRAME_NAME_LENGTH;
+		}
+
+		// Index the chunks, a chunk that does not fit into the file was cut off while writing and is ignored
+		while (offset + sizeof(FrameChunkHeader) <= _length) {
+			FrameChunkHeader chunk;
+			std::memcpy(&chunk, _data + offset, sizeof(chunk));
+			if (chunk.magic != FRAME_CHUNK_MAGIC)
+				throw std::runtime_error("'" + path + "' is corrupt at offset " + std::to_string(offset));
+			std::size_t begin = offset + sizeof(chunk);
+			if (chunk.bytes > _length - begin)
+				break;
+			std::size_t end = begin + chunk.bytes;
+
+			Entry entry;
+			entry.step = static_cast<long>(chunk.step);
+			entry.keyframe = (chunk.flags & FRAME_KEYFRAME) != 0;
+			std::size_t position = begin;
+			for (std::uint32_t k = 0; k < _header.fields; k++) {
+				std::uint64_t bytes;
+				if (position + sizeof(bytes) > end)
+					throw std::runtime_error("'" + path + "' is corrupt at offset " + std::to_string(position));
+				std::memcpy(&bytes, _data + position, sizeof(bytes));
+				position += sizeof(bytes);
+				if (bytes > end - position)
+					throw std::runtime_error("'" + path + "' is corrupt at offset " + std::to_string(position));
+				entry.offsets.push_back(position);
+				entry.bytes.push_back(bytes);
+				position += (bytes + 7) / 8 * 8;
+			}
+			_entries.push_back(entry);
+			offset = end;
+		}
+	} catch (...) {
+		::munmap(const_cast<unsigned char*>(_data), _length);
+		throw;
+	}
+
+	_decoded.resize(_header.fields);
+	_decoded_frame.assign(_header.fields, -1);
+}
+
+FrameReader::~FrameReader() {
+	::munmap(const_cast<unsigned char*>(_data), _length);
+}
+
+int FrameReader::field(const std::string& name) const {
+	for (std::size_t k = 0; k < _fields.size(); k++)
+		if (_fields[k] == name)
+			return static_cast<int>(k);
+	throw std::invalid_argument("the frame file has no field '" + name + "'");
+}
+
+// Apply the run-length encoded XOR of one frame (see FrameWriter) to the halves of the frame before it
+static void applyRuns(const std::uint16_t* runs, std::size_t tokens, std::uint16_t* halves, std::size_t cells) {
+	std::size_t k = 0;
+	std::size_t position = 0;
+	while (k < cells) {
+		if (position + 2 > tokens)
+			throw std::runtime_error("corrupt delta frame");
+		std::size_t zeros = runs[position];
+		std::size_t literals = runs[position + 1];
+		position += 2;
+		if (k + zeros + literals > cells || position + literals > tokens)
+			throw std::runtime_error("corrupt delta frame");
+		k += zeros;
+		for (std::size_t l = 0; l < literals; l++)
+			halves[k++] ^= runs[position++];
+	}
+}
+
+// Continue from the last decoded frame if it lies between the keyframe and the requested frame
+const std::uint16_t* FrameReader::decodeDelta(std::size_t frame, int field) {
+	std::size_t cells = static_cast<std::size_t>(_header.size) * _header.size;
+	std::size_t key = frame;
+	while (!_entries[key].keyframe) {
+		if (key == 0)
+			throw std::runtime_error("delta frame without keyframe");
+		key--;
+	}
+
+	std::vector<std::uint16_t>& halves = _decoded[field];
+	long& decoded = _decoded_frame[field];
+	std::size_t next;
+	if (decoded >= static_cast<long>(key) && decoded <= static_cast<long>(frame)) {
+		next = decoded + 1;
+	} else {
+		if (_entries[key].bytes[field] != cells * sizeof(std::uint16_t))
+			throw std::runtime_error("corrupt keyframe");
+		const std::uint16_t* keyframe = reinterpret_cast<const std::uint16_t*>(_data + _entries[key].offsets[field]);
+		halves.assign(keyframe, keyframe + cells);
+		next = key + 1;
+	}
+	for (std::size_t k = next; k <= frame; k++) {
+		const std::uint16_t* runs = reinterpret_cast<const std::uint16_t*>(_data + _entries[k].offsets[field]);
+		applyRuns(runs, _entries[k].bytes[field] / sizeof(std::uint16_t), halves.data(), cells);
+	}
+	decoded = static_cast<long>(frame);
+	return halves.data();
+}
+
+void FrameReader::read(std::size_t frame, int field, float* values) {
+	const Entry& entry = _entries.at(frame);
+	if (field < 0 || field >= static_cast<int>(_fields.size()))
+		throw std::invalid_argument("field index out of range");
+	std::size_t cells = static_cast<std::size_t>(_header.size) * _header.size;
+	const unsigned char* data = _data + entry.offsets[field];
+
+	switch (encoding()) {
+		case FrameEncoding::Float32:
+			if (entry.bytes[field] != cells * sizeof(float))
+				throw std::runtime_error("corrupt frame");
+			std::memcpy(values, data, cells * sizeof(float));
+			break;
+		case FrameEncoding::Half16:
+			if (entry.bytes[field] != cells * sizeof(std::uint16_t))
+				throw std::runtime_error("corrupt frame");
+			halvesToFloats(reinterpret_cast<const std::uint16_t*>(data), values, cells);
+			break;
+		case FrameEncoding::Delta16:
+			halvesToFloats(decodeDelta(frame, field), values, cells);
+			break;
+	}
+}
+
+// Decode into a contiguous buffer and copy it row by row into the padded grid
+void FrameReader::read(std::size_t frame, int field, Grid& grid) {
+	int size = this->size();
+	if (grid.size() != size)
+		throw std::invalid_argument("the grid does not have the size of the frames");
+	std::vector<float> values(static_cast<std::size_t>(size) * size);
+	read(frame, field, values.data());
+	for (int y = 0; y < size; y++)
+		std::copy(values.begin() + static_cast<std::size_t>(y) * size, values.begin() + static_cast<std::size_t>(y + 1) * size,
+			&grid[grid.index(0, y)]);
+}
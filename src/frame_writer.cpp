@@ -0,0 +1,246 @@
+#include "../header/frames.h"
+#include "../header/half.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+const std::vector<std::string>& FrameWriter::fieldNames() {
+	static const std::vector<std::string> names = {"density", "velocity_x", "velocity_y"};
+	return names;
+}
+
+FrameWriter::FrameWriter(const FrameOptions& options, int size, float dt)
+	: _options(options), _size(size), _cells(static_cast<std::size_t>(size) * size), _file(nullptr),
+	  _stop(false), _written(0), _dropped(0) {
+	if (_options.every < 1)
+		throw std::invalid_argument("frames have to be written at least every step");
+	if (_options.keyframe_interval < 1)
+		throw std::invalid_argument("the keyframe interval has to be at least 1");
+	if (_options.queue < 1)
+		throw std::invalid_argument("the frame queue needs at least one buffer");
+	if (_options.fields.empty())
+		throw std::invalid_argument("no fields selected for the frame export");
+	for (const std::string& name : _options.fields) {
+		auto id = std::find(fieldNames().begin(), fieldNames().end(), name);
+		if (id == fieldNames().end())
+			throw std::invalid_argument("unknown field '" + name + "'");
+		_field_ids.push_back(static_cast<int>(id - fieldNames().begin()));
+	}
+
+	_file = std::fopen(_options.path.c_str(), "wb");
+	if (!_file)
+		throw std::runtime_error("cannot create frame file '" + _options.path + "': " + std::strerror(errno));
+
+	FrameFileHeader header = {};
+	std::memcpy(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic));
+	header.version = FRAME_FILE_VERSION;
+	header.size = static_cast<std::uint32_t>(size);
+	header.fields = static_cast<std::uint32_t>(_field_ids.size());
+	header.encoding = static_cast<std::uint32_t>(_options.encoding);
+	header.every = static_cast<std::uint32_t>(_options.every);
+	header.keyframe_interval = static_cast<std::uint32_t>(_options.keyframe_interval);
+	header.dt = dt;
+	try {
+		writeBytes(&header, sizeof(header));
+		for (const std::string& name : _options.fields) {
+			char padded[FRAME_NAME_LENGTH] = {};
+			std::strncpy(padded, name.c_str(), FRAME_NAME_LENGTH - 1);
+			writeBytes(padded, sizeof(padded));
+		}
+	} catch (...) {
+		std::fclose(_file);
+		throw;
+	}
+
+	// All buffers are allocated up front, the simulation never allocates while it runs
+	_frames.resize(_options.queue);
+	for (int k = 0; k < _options.queue; k++) {
+		_frames[k].values.resize(_cells * _field_ids.size());
+		_free.push_back(k);
+	}
+	if (_options.encoding == FrameEncoding::Delta16)
+		_previous.resize(_cells * _field_ids.size());
+
+	_thread = std::thread(&FrameWriter::work, this);
+}
+
+FrameWriter::~FrameWriter() {
+	try {
+		close();
+	} catch (const std::exception&) {
+		// The error was already reported by capture() or is lost together with the writer
+	}
+}
+
+void FrameWriter::writeBytes(const void* data, std::size_t bytes) {
+	if (std::fwrite(data, 1, bytes, _file) != bytes)
+		throw std::runtime_error("cannot write frame file '" + _options.path + "': " + std::strerror(errno));
+}
+
+// Take a free buffer, copy the rows of every selected field into it and hand it to the writer thread
+bool FrameWriter::capture(const Logic& logic, long step) {
+	int index;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (!_error.empty())
+			throw std::runtime_error(_error);
+		if (_free.empty() && _options.drop) {
+			_dropped++;
+			return false;
+		}
+		_released.wait(lock, [&] { return !_free.empty() || !_error.empty(); });
+		if (!_error.empty())
+			throw std::runtime_error(_error);
+		index = _free.front();
+		_free.pop_front();
+	}
+
+	Frame& frame = _frames[index];
+	frame.step = step;
+	float* values = frame.values.data();
+	for (int id : _field_ids) {
+		const Grid& field = id == 0 ? logic.density() : (id == 1 ? logic.velocity_x() : logic.velocity_y());
+		for (int y = 0; y < _size; y++) {
+			field.load(field.index(0, y), _size, values);
+			values += _size;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending.push_back(index);
+	}
+	_queued.notify_one();
+	return true;
+}
+
+// Writer thread: write the queued frames in order until close() was called and the queue is empty.
+// After the first error the frames are only returned to the pool, capture() reports the error.
+void FrameWriter::work() {
+	while (true) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_queued.wait(lock, [&] { return _stop || !_pending.empty(); });
+			if (_pending.empty())
+				return;
+			index = _pending.front();
+			_pending.pop_front();
+		}
+
+		bool written = false;
+		if (_error.empty()) {
+			try {
+				writeFrame(_frames[index]);
+				written = true;
+			} catch (const std::exception& error) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				_error = error.what();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_free.push_back(index);
+			if (written)
+				_written++;
+		}
+		_released.notify_one();
+	}
+}
+
+// Run-length encoding of the XOR of two frames as pairs (number of zeros, number of literals) followed by the
+// literals. Literals only end at two zeros in a row, so the encoding is never much larger than the halves themselves.
+static void encodeRuns(const std::uint16_t* delta, std::size_t count, std::vector<std::uint16_t>& runs) {
+	runs.clear();
+	std::size_t k = 0;
+	while (k < count) {
+		std::size_t zeros = 0;
+		while (k < count && delta[k] == 0 && zeros < 0xffff) {
+			zeros++;
+			k++;
+		}
+		std::size_t start = k;
+		while (k < count && k - start < 0xffff && !(delta[k] == 0 && (k + 1 == count || delta[k + 1] == 0)))
+			k++;
+		runs.push_back(static_cast<std::uint16_t>(zeros));
+		runs.push_back(static_cast<std::uint16_t>(k - start));
+		runs.insert(runs.end(), delta + start, delta + k);
+	}
+}
+
+// Encode all fields into one chunk so that the chunk header can hold the total size, then write it at once.
+// Every frame is flushed, a run that is killed keeps all frames written so far.
+void FrameWriter::writeFrame(const Frame& frame) {
+	bool keyframe = _options.encoding != FrameEncoding::Delta16 || _written % _options.keyframe_interval == 0;
+
+	_chunk.clear();
+	auto append = [&](const void* data, std::size_t bytes) {
+		const unsigned char* begin = static_cast<const unsigned char*>(data);
+		std::uint64_t length = bytes;
+		const unsigned char* length_bytes = reinterpret_cast<const unsigned char*>(&length);
+		_chunk.insert(_chunk.end(), length_bytes, length_bytes + sizeof(length));
+		_chunk.insert(_chunk.end(), begin, begin + bytes);
+		_chunk.resize((_chunk.size() + 7) / 8 * 8, 0);
+	};
+
+	for (std::size_t field = 0; field < _field_ids.size(); field++) {
+		const float* values = frame.values.data() + field * _cells;
+		if (_options.encoding == FrameEncoding::Float32) {
+			append(values, _cells * sizeof(float));
+			continue;
+		}
+
+		_halves.resize(_cells);
+		floatsToHalves(values, _halves.data(), _cells);
+		if (_options.encoding == FrameEncoding::Delta16) {
+			std::uint16_t* previous = _previous.data() + field * _cells;
+			if (!keyframe) {
+				for (std::size_t k = 0; k < _cells; k++)
+					previous[k] ^= _halves[k];
+				encodeRuns(previous, _cells, _encoded);
+				append(_encoded.data(), _encoded.size() * sizeof(std::uint16_t));
+			}
+			std::copy(_halves.begin(), _halves.end(), previous);
+			if (!keyframe)
+				continue;
+		}
+		append(_halves.data(), _cells * sizeof(std::uint16_t));
+	}
+
+	FrameChunkHeader header = {FRAME_CHUNK_MAGIC, keyframe ? FRAME_KEYFRAME : 0u,
+		static_cast<std::int64_t>(frame.step), static_cast<std::uint64_t>(_chunk.size())};
+	writeBytes(&header, sizeof(header));
+	writeBytes(_chunk.data(), _chunk.size());
+	if (std::fflush(_file) != 0)
+		throw std::runtime_error("cannot write frame file '" + _options.path + "': " + std::strerror(errno));
+}
+
+void FrameWriter::close() {
+	if (_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_queued.notify_one();
+		_thread.join();
+	}
+	if (_file) {
+		if (std::fclose(_file) != 0 && _error.empty())
+			_error = "cannot close frame file '" + _options.path + "'";
+		_file = nullptr;
+	}
+	if (!_error.empty())
+		throw std::runtime_error(_error);
+}
+
+long FrameWriter::written() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _written;
+}
+
+long FrameWriter::dropped() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _dropped;
+}
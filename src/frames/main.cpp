@@ -0,0 +1,99 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../../header/frames.h"
+
+// Print the available command line options
+static void usage(const char* program) {
+	std::cout << "Usage: " << program << " FILE [--frame N --field NAME]\n"
+		<< "  Without options, print the header and the frames of a frame file written by fluid_headless --frames.\n"
+		<< "  --frame N      print field NAME of frame N as comma separated rows\n"
+		<< "  --field NAME   field to print (default: the first field of the file)\n";
+}
+
+// Convert the value of --frame, the complete text has to be a number that is not negative
+static long toFrame(const std::string& option, const std::string& text) {
+	std::size_t used = 0;
+	long value = 0;
+	try {
+		value = std::stol(text, &used);
+	} catch (const std::exception&) {
+		used = 0;
+	}
+	if (used == 0 || used != text.size())
+		throw std::invalid_argument("malformed value '" + text + "' for " + option);
+	if (value < 0)
+		throw std::invalid_argument(option + " must not be negative");
+	return value;
+}
+
+// Inspect a frame file or dump one field of one frame
+int main(int argc, char** argv) {
+	std::string path, field;
+	long frame = -1;
+	for (int k = 1; k < argc; k++) {
+		std::string option = argv[k];
+		if (option == "--help" || option == "-h") {
+			usage(argv[0]);
+			return 0;
+		} else if (option == "--frame" && k + 1 < argc) {
+			try {
+				frame = toFrame(option, argv[++k]);
+			} catch (const std::invalid_argument& error) {
+				std::cerr << argv[0] << ": " << error.what() << std::endl;
+				return 1;
+			}
+		} else if (option == "--field" && k + 1 < argc) {
+			field = argv[++k];
+		} else if (path.empty() && option[0] != '-') {
+			path = option;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (path.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	try {
+		FrameReader reader(path);
+		if (frame < 0) {
+			static const char* encodings[] = {"f32", "half", "delta"};
+			std::cout << "grid:      " << reader.size() << " x " << reader.size() << "\n"
+				<< "dt:        " << reader.dt() << "\n"
+				<< "every:     " << reader.every() << " steps\n"
+				<< "encoding:  " << encodings[static_cast<int>(reader.encoding())] << "\n"
+				<< "fields:   ";
+			for (const std::string& name : reader.fields())
+				std::cout << " " << name;
+			std::cout << "\nframes:    " << reader.frames() << "\n";
+			for (std::size_t k = 0; k < reader.frames(); k++) {
+				std::size_t bytes = 0;
+				for (std::size_t f = 0; f < reader.fields().size(); f++)
+					bytes += reader.bytes(k, static_cast<int>(f));
+				std::cout << "  " << k << ": step " << reader.step(k) << ", " << bytes << " bytes"
+					<< (reader.keyframe(k) ? ", keyframe" : "") << "\n";
+			}
+			return 0;
+		}
+
+		int index = field.empty() ? 0 : reader.field(field);
+		if (static_cast<std::size_t>(frame) >= reader.frames())
+			throw std::invalid_argument("the file has only " + std::to_string(reader.frames()) + " frames");
+		int size = reader.size();
+		std::vector<float> values(static_cast<std::size_t>(size) * size);
+		reader.read(static_cast<std::size_t>(frame), index, values.data());
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++)
+				std::cout << (x > 0 ? "," : "") << values[static_cast<std::size_t>(y) * size + x];
+			std::cout << "\n";
+		}
+	} catch (const std::exception& error) {
+		std::cerr << argv[0] << ": " << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,197 @@
+#include "../header/grid.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::size_t elementBytes(Precision precision) {
+	return precision == Precision::Float ? sizeof(float) : sizeof(std::uint16_t);
+}
+
+const char* precisionName(Precision precision) {
+	switch (precision) {
+		case Precision::Half:
+			return "half";
+		case Precision::BFloat16:
+			return "bf16";
+		default:
+			return "float";
+	}
+}
+
+Precision parsePrecision(const std::string& name) {
+	if (name == "float" || name == "fp32")
+		return Precision::Float;
+	if (name == "half" || name == "fp16")
+		return Precision::Half;
+	if (name == "bf16" || name == "bfloat16")
+		return Precision::BFloat16;
+	throw std::invalid_argument("unknown precision '" + name + "' (float, half or bf16)");
+}
+
+Grid::Grid() : _data(nullptr), _size(0), _stride(0), _precision(Precision::Float) {}
+
+Grid::Grid(float* data, int size, int stride) : _data(data), _size(size), _stride(stride), _precision(Precision::Float) {}
+
+Grid::Grid(void* data, int size, int stride, Precision precision)
+	: _data(data), _size(size), _stride(stride), _precision(precision) {}
+
+float Grid::load(int index) const {
+	float value = 0;
+	withStorage(_precision, [&](auto storage) {
+		typedef decltype(storage) Storage;
+		value = Storage::load(values<Storage>()[index]);
+	});
+	return value;
+}
+
+void Grid::store(int index, float value) {
+	withStorage(_precision, [&](auto storage) {
+		typedef decltype(storage) Storage;
+		values<Storage>()[index] = Storage::store(value);
+	});
+}
+
+// The bulk conversions of half.h use F16C for eight values at a time
+void Grid::load(int index, int count, float* target) const {
+	const std::uint16_t* halves = static_cast<const std::uint16_t*>(_data) + index;
+	switch (_precision) {
+		case Precision::Half:
+			halvesToFloats(halves, target, count);
+			break;
+		case Precision::BFloat16:
+			bfloat16sToFloats(halves, target, count);
+			break;
+		default:
+			std::copy(data() + index, data() + index + count, target);
+	}
+}
+
+void Grid::store(int index, int count, const float* source) {
+	std::uint16_t* halves = static_cast<std::uint16_t*>(_data) + index;
+	switch (_precision) {
+		case Precision::Half:
+			floatsToHalves(source, halves, count);
+			break;
+		case Precision::BFloat16:
+			floatsToBFloat16s(source, halves, count);
+			break;
+		default:
+			std::copy(source, source + count, data() + index);
+	}
+}
+
+// Zero has all bits cleared in every precision
+void Grid::zero(int index, int count) {
+	std::size_t bytes = elementBytes(_precision);
+	std::memset(static_cast<unsigned char*>(_data) + index * bytes, 0, count * bytes);
+}
+
+// Set every element of the field to the given value, the row padding is left untouched
+void Grid::fill(float value) {
+	withStorage(_precision, [&](auto storage) {
+		typedef decltype(storage) Storage;
+		typename Storage::Element element = Storage::store(value);
+		for (int y = 0; y < _size; y++)
+			std::fill(values<Storage>() + index(0, y), values<Storage>() + index(0, y) + _size, element);
+	});
+}
+
+// Fields follow each other, each one rounded up to the alignment. The vector gathers of 16 bit fields read 32 bits at
+// the address of an element, so these fields get room for one more element after the last one.
+std::size_t GridArena::layoutBytes(int size, const std::vector<Precision>& precisions) {
+	std::size_t elements = static_cast<std::size_t>(size) * Grid::rowStride(size);
+	std::size_t bytes = 0;
+	for (Precision precision : precisions) {
+		std::size_t field = (elements + (precision == Precision::Float ? 0 : 1)) * elementBytes(precision);
+		bytes += (field + GRID_ALIGNMENT - 1) / GRID_ALIGNMENT * GRID_ALIGNMENT;
+	}
+	return bytes;
+}
+
+GridArena::GridArena(int size, int fields)
+	: GridArena(size, std::vector<Precision>(fields > 0 ? fields : 0, Precision::Float)) {}
+
+GridArena::GridArena(int size, const std::vector<Precision>& precisions) : GridArena(nullptr, size, precisions, false) {
+	if (size < 3 || precisions.empty())
+		throw std::invalid_argument("GridArena needs a size of at least 3 and at least one field");
+	_memory = static_cast<unsigned char*>(::operator new(_bytes, std::align_val_t(GRID_ALIGNMENT)));
+	std::memset(_memory, 0, _bytes);
+}
+
+// Every row is padded to a multiple of the alignment, so every row of a float field and every field starts aligned
+GridArena::GridArena(unsigned char* memory, int size, const std::vector<Precision>& precisions, bool mapped)
+	: _memory(memory), _size(size), _row_stride(Grid::rowStride(size)), _precisions(precisions),
+	  _bytes(layoutBytes(size, precisions)), _mapped(mapped) {
+	std::size_t offset = 0;
+	for (std::size_t k = 0; k < precisions.size(); k++) {
+		_offsets.push_back(offset);
+		offset += layoutBytes(size, {precisions[k]});
+	}
+}
+
+// The fields are stored exactly like in an allocated arena, so the file offset is the only difference
+GridArena GridArena::map(const std::string& path, std::size_t offset, int size, const std::vector<Precision>& precisions) {
+	if (size < 3 || precisions.empty())
+		throw std::invalid_argument("GridArena needs a size of at least 3 and at least one field");
+	std::size_t bytes = layoutBytes(size, precisions);
+
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		throw std::runtime_error("cannot open '" + path + "': " + std::strerror(errno));
+	struct stat status;
+	if (::fstat(descriptor, &status) != 0 || static_cast<std::size_t>(status.st_size) < offset + bytes) {
+		::close(descriptor);
+		throw std::runtime_error("'" + path + "' is too short for " + std::to_string(precisions.size()) + " fields of size " + std::to_string(size));
+	}
+	void* mapping = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, static_cast<off_t>(offset));
+	::close(descriptor);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("cannot map '" + path + "': " + std::strerror(errno));
+	return GridArena(static_cast<unsigned char*>(mapping), size, precisions, true);
+}
+
+GridArena::~GridArena() {
+	release();
+}
+
+GridArena::GridArena(GridArena&& other) noexcept
+	: _memory(other._memory), _size(other._size), _row_stride(other._row_stride), _precisions(std::move(other._precisions)),
+	  _offsets(std::move(other._offsets)), _bytes(other._bytes), _mapped(other._mapped) {
+	other._memory = nullptr;
+}
+
+GridArena& GridArena::operator=(GridArena&& other) noexcept {
+	if (this != &other) {
+		release();
+		_memory = other._memory;
+		_size = other._size;
+		_row_stride = other._row_stride;
+		_precisions = std::move(other._precisions);
+		_offsets = std::move(other._offsets);
+		_bytes = other._bytes;
+		_mapped = other._mapped;
+		other._memory = nullptr;
+	}
+	return *this;
+}
+
+// View onto the field with the given index
+Grid GridArena::field(int index) {
+	if (index < 0 || index >= fields())
+		throw std::out_of_range("GridArena field index out of range");
+	return Grid(_memory + _offsets[index], _size, _row_stride, _precisions[index]);
+}
+
+void GridArena::release() {
+	if (_memory != nullptr && _mapped)
+		::munmap(_memory, _bytes);
+	else if (_memory != nullptr)
+		::operator delete(_memory, std::align_val_t(GRID_ALIGNMENT));
+	_memory = nullptr;
+}
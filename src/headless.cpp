@@ -0,0 +1,609 @@
+#include "../header/headless.h"
+#include "../header/checkpoint.h"
+#include "../header/profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Parse the step column of a script line, either '*', a single step or a range 'first-last'
+static bool parseSteps(const std::string& text, int& first, int& last) {
+	if (text == "*") {
+		first = 0;
+		last = -1;
+		return true;
+	}
+	char dash = 0;
+	std::istringstream in(text);
+	if (!(in >> first))
+		return false;
+	last = first;
+	if (in >> dash) {
+		if (dash != '-' || !(in >> last))
+			return false;
+	}
+	return in.eof() && first >= 0 && (last >= first);
+}
+
+// Parse the script file line by line
+SourceScript SourceScript::load(const std::string& path) {
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("cannot open source script '" + path + "'");
+
+	SourceScript script;
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line)) {
+		line_number++;
+		std::istringstream in(line);
+		std::string steps, type;
+		if (!(in >> steps) || steps[0] == '#')
+			continue;
+
+		SourceEvent event;
+		event.amount_y = 0;
+		bool valid = parseSteps(steps, event.first_step, event.last_step) && (in >> type);
+		if (valid && type == "density") {
+			event.type = SourceEvent::Density;
+			valid = static_cast<bool>(in >> event.x >> event.y >> event.amount_x);
+		} else if (valid && type == "velocity") {
+			event.type = SourceEvent::Velocity;
+			valid = static_cast<bool>(in >> event.x >> event.y >> event.amount_x >> event.amount_y);
+		} else if (valid && type == "particles") {
+			int count = 0;
+			event.type = SourceEvent::Particles;
+			valid = static_cast<bool>(in >> event.x >> event.y >> count) && count >= 0;
+			event.amount_x = static_cast<float>(count);
+		} else {
+			valid = false;
+		}
+
+		std::string rest;
+		if (!valid || (in >> rest && rest[0] != '#'))
+			throw std::runtime_error(path + ":" + std::to_string(line_number) + ": malformed source '" + line + "'");
+		script._events.push_back(event);
+	}
+	return script;
+}
+
+// Combinations of the domain with the solvers and the active tiles that are not supported
+static void checkDomain(Domain domain, ProjectionSolver projection, Relaxation relaxation, bool active_tiles) {
+	// The multigrid levels only know walls, and the active tiles do not follow the fluid across the periodic seam
+	if (domain == Domain::Periodic && projection == ProjectionSolver::Multigrid)
+		throw std::invalid_argument("--boundary periodic cannot be combined with the multigrid or fmg projection");
+	if (domain == Domain::Periodic && active_tiles)
+		throw std::invalid_argument("--boundary periodic cannot be combined with --active-tiles");
+	bool spectral = projection == ProjectionSolver::Spectral || relaxation == Relaxation::Spectral;
+	if (spectral && domain != Domain::Periodic)
+		throw std::invalid_argument("the spectral solvers need --boundary periodic");
+}
+
+// The corrections of MacCormack and BFECC assume a divergence free velocity. A single Gauss Seidel sweep leaves most of
+// the divergence, and the corrections then add up to 80 % of the injected mass within 200 steps.
+static void checkAdvection(AdvectionScheme advection, ProjectionSolver projection, int projection_sweeps) {
+	bool sweep = projection == ProjectionSolver::GaussSeidel || projection == ProjectionSolver::RedBlack;
+	if (advection != AdvectionScheme::SemiLagrangian && sweep && projection_sweeps < 2)
+		throw std::invalid_argument("--advection maccormack and bfecc need a converged projection: multigrid, fmg, "
+			"spectral or more than one --projection-iterations");
+}
+
+// Print the available command line options
+void Headless::usage(const char* program) {
+	std::cout << "Usage: " << program << " [options]\n"
+		<< "  --size N         number of grid elements in each direction (default " << SIZE << ")\n"
+		<< "  --steps N        number of simulation steps (default 1000)\n"
+		<< "  --dt T           time step (default 0.1)\n"
+		<< "  --diffusion D    diffusion coefficient of the density (default 0)\n"
+		<< "  --viscosity V    viscosity of the fluid (default 0.0005)\n"
+		<< "  --script FILE    inject sources from FILE instead of the mouse\n"
+		<< "  --projection P   pressure solver: gauss-seidel (default), red-black, multigrid, fmg or spectral\n"
+		<< "  --tolerance T    relative residual at which the pressure solve stops (default 1e-4)\n"
+		<< "  --projection-iterations N  maximum Gauss Seidel sweeps of the pressure solve (default 1)\n"
+		<< "  --diffusion-iterations N   maximum iterations of every diffusion solve (default 16)\n"
+		<< "  --diffusion-tolerance T    relative residual at which the diffusion stops (default 1e-4, 0: never)\n"
+		<< "  --residual-norm N  norm of the Gauss Seidel residuals: l2 (default) or max\n"
+		<< "  --no-warm-start  start every pressure solve from zero instead of the previous pressure\n"
+		<< "  --relaxation R   diffusion solver: gauss-seidel (default), red-black or spectral\n"
+		<< "  --boundary B     boundaries of the box: walls (default), periodic or open\n"
+		<< "  --advection A    advection scheme: semi-lagrangian (default), maccormack or bfecc (the corrected\n"
+		<< "                   schemes need multigrid, fmg, spectral or more than one --projection-iterations)\n"
+		<< "  --threads N      threads used by the red-black relaxation and the spectral solvers (default 1)\n"
+		<< "  --active-tiles   only simulate the 16x16 tiles with smoke or motion and their surroundings\n"
+		<< "  --tile-threshold T  density and speed above which a tile is active (default 1e-3)\n"
+		<< "  --profile        print min / mean / p99 of every solver stage (needs -DFLUIDSIM_PROFILE)\n"
+		<< "  --trace FILE     write a Chrome trace of every stage to FILE (needs -DFLUIDSIM_PROFILE)\n"
+		<< "  --precision P    storage of the transported fields: float (default), half or bf16 for all of them, or a\n"
+		<< "                   list like velocity=half,density=bf16 (velocity, previous-velocity, density,\n"
+		<< "                   previous-density), the pressure always stays float\n"
+		<< "  --accuracy       repeat the run in float and report the deviation of the reduced precision fields\n"
+		<< "  --no-fade        do not let the density fade after every step\n"
+		<< "  --particles N    seed N tracer particles uniformly over the box before the first step\n"
+		<< "  --particle-lifetime T  retire every tracer particle after the time T (default 0: never)\n"
+		<< "  --frames FILE    write the fields to the frame file FILE, see header/frames.h\n"
+		<< "  --frame-every K  write a frame after every K steps (default 1)\n"
+		<< "  --frame-fields F comma separated fields: density (default), velocity_x, velocity_y\n"
+		<< "  --frame-encoding E  f32, half (default) or delta\n"
+		<< "  --frame-keyframes N frames between two keyframes of the delta encoding (default 32)\n"
+		<< "  --frame-queue N  frames waiting for the writer thread before the simulation waits (default 8)\n"
+		<< "  --frame-drop     drop frames instead of waiting when the queue is full\n"
+		<< "  --checkpoint FILE  save the solver state to FILE at the end, on SIGUSR1 and every --checkpoint-every steps\n"
+		<< "  --checkpoint-every N  save a checkpoint after every N steps (default 0: never)\n"
+		<< "  --restore FILE   continue the run saved in FILE up to a total of --steps steps\n"
+		<< "                   (grid, parameters and solver settings are taken from the checkpoint)\n";
+}
+
+// Convert the value of a command line option, the complete text has to be a number
+int Headless::toInt(const std::string& option, const std::string& text) {
+	std::size_t used = 0;
+	int value = 0;
+	try {
+		value = std::stoi(text, &used);
+	} catch (const std::exception&) {
+		used = 0;
+	}
+	if (used == 0 || used != text.size())
+		throw std::invalid_argument("malformed value '" + text + "' for " + option);
+	return value;
+}
+
+float Headless::toFloat(const std::string& option, const std::string& text) {
+	std::size_t used = 0;
+	float value = 0;
+	try {
+		value = std::stof(text, &used);
+	} catch (const std::exception&) {
+		used = 0;
+	}
+	if (used == 0 || used != text.size())
+		throw std::invalid_argument("malformed value '" + text + "' for " + option);
+	return value;
+}
+
+// Either a single precision or field=precision pairs, the fields not mentioned stay float
+FieldPrecisions parseFieldPrecisions(const std::string& text) {
+	FieldPrecisions precisions;
+	if (text.find('=') == std::string::npos) {
+		Precision precision = parsePrecision(text);
+		precisions.velocity = precision;
+		precisions.previous_velocity = precision;
+		precisions.density = precision;
+		precisions.previous_density = precision;
+		return precisions;
+	}
+
+	std::istringstream entries(text);
+	std::string entry;
+	while (std::getline(entries, entry, ',')) {
+		std::size_t equals = entry.find('=');
+		if (equals == std::string::npos)
+			throw std::invalid_argument("malformed precision '" + entry + "', expected field=precision");
+		std::string field = entry.substr(0, equals);
+		Precision precision = parsePrecision(entry.substr(equals + 1));
+		if (field == "velocity")
+			precisions.velocity = precision;
+		else if (field == "previous-velocity")
+			precisions.previous_velocity = precision;
+		else if (field == "density")
+			precisions.density = precision;
+		else if (field == "previous-density")
+			precisions.previous_density = precision;
+		else
+			throw std::invalid_argument("unknown field '" + field + "' in --precision");
+	}
+	return precisions;
+}
+
+// Parse the command line into the options of the run
+HeadlessOptions Headless::parse(int argc, char** argv, HeadlessOptions options) {
+	for (int k = 1; k < argc; k++) {
+		std::string option = argv[k];
+
+		// All options except the flags take exactly one value
+		auto value = [&]() -> std::string {
+			if (k + 1 >= argc)
+				throw std::invalid_argument("missing value for " + option);
+			return argv[++k];
+		};
+
+		if (option == "--size")
+			options.size = toInt(option, value());
+		else if (option == "--steps")
+			options.steps = toInt(option, value());
+		else if (option == "--dt")
+			options.dt = toFloat(option, value());
+		else if (option == "--diffusion")
+			options.diffusion = toFloat(option, value());
+		else if (option == "--viscosity")
+			options.viscosity = toFloat(option, value());
+		else if (option == "--script")
+			options.script = value();
+		else if (option == "--projection") {
+			std::string solver = value();
+			if (solver == "gauss-seidel") {
+				options.projection = ProjectionSolver::GaussSeidel;
+			} else if (solver == "multigrid") {
+				options.projection = ProjectionSolver::Multigrid;
+				options.cycle = Multigrid::VCycle;
+			} else if (solver == "fmg") {
+				options.projection = ProjectionSolver::Multigrid;
+				options.cycle = Multigrid::FullMultigrid;
+			} else if (solver == "red-black") {
+				options.projection = ProjectionSolver::RedBlack;
+			} else if (solver == "spectral") {
+				options.projection = ProjectionSolver::Spectral;
+			} else {
+				throw std::invalid_argument("unknown projection solver '" + solver + "'");
+			}
+		}
+		else if (option == "--tolerance")
+			options.tolerance = toFloat(option, value());
+		else if (option == "--projection-iterations")
+			options.projection_iterations = toInt(option, value());
+		else if (option == "--diffusion-iterations")
+			options.diffusion_iterations = toInt(option, value());
+		else if (option == "--diffusion-tolerance")
+			options.diffusion_tolerance = toFloat(option, value());
+		else if (option == "--residual-norm") {
+			std::string norm = value();
+			if (norm == "l2")
+				options.residual_norm = ResidualNorm::L2;
+			else if (norm == "max")
+				options.residual_norm = ResidualNorm::Max;
+			else
+				throw std::invalid_argument("unknown residual norm '" + norm + "'");
+		}
+		else if (option == "--no-warm-start")
+			options.warm_start = false;
+		else if (option == "--relaxation") {
+			std::string relaxation = value();
+			if (relaxation == "gauss-seidel")
+				options.relaxation = Relaxation::GaussSeidel;
+			else if (relaxation == "red-black")
+				options.relaxation = Relaxation::RedBlack;
+			else if (relaxation == "spectral")
+				options.relaxation = Relaxation::Spectral;
+			else
+				throw std::invalid_argument("unknown relaxation '" + relaxation + "'");
+		}
+		else if (option == "--advection") {
+			std::string scheme = value();
+			if (scheme == "semi-lagrangian")
+				options.advection = AdvectionScheme::SemiLagrangian;
+			else if (scheme == "maccormack")
+				options.advection = AdvectionScheme::MacCormack;
+			else if (scheme == "bfecc")
+				options.advection = AdvectionScheme::BFECC;
+			else
+				throw std::invalid_argument("unknown advection scheme '" + scheme + "'");
+		}
+		else if (option == "--boundary") {
+			std::string boundary = value();
+			if (boundary == "walls")
+				options.domain = Domain::Walls;
+			else if (boundary == "periodic")
+				options.domain = Domain::Periodic;
+			else if (boundary == "open")
+				options.domain = Domain::Open;
+			else
+				throw std::invalid_argument("unknown boundary '" + boundary + "'");
+		}
+		else if (option == "--threads")
+			options.threads = toInt(option, value());
+		else if (option == "--active-tiles")
+			options.active_tiles = true;
+		else if (option == "--tile-threshold")
+			options.tile_threshold = toFloat(option, value());
+		else if (option == "--profile")
+			options.profile = true;
+		else if (option == "--trace")
+			options.trace = value();
+		else if (option == "--precision")
+			options.precisions = parseFieldPrecisions(value());
+		else if (option == "--accuracy")
+			options.accuracy = true;
+		else if (option == "--no-fade")
+			options.fade = false;
+		else if (option == "--particles")
+			options.particles = toInt(option, value());
+		else if (option == "--particle-lifetime")
+			options.particle_lifetime = toFloat(option, value());
+		else if (option == "--frames")
+			options.frames.path = value();
+		else if (option == "--frame-every")
+			options.frames.every = toInt(option, value());
+		else if (option == "--frame-fields") {
+			options.frames.fields.clear();
+			std::istringstream fields(value());
+			std::string field;
+			while (std::getline(fields, field, ','))
+				options.frames.fields.push_back(field);
+		}
+		else if (option == "--frame-encoding") {
+			std::string encoding = value();
+			if (encoding == "f32")
+				options.frames.encoding = FrameEncoding::Float32;
+			else if (encoding == "half")
+				options.frames.encoding = FrameEncoding::Half16;
+			else if (encoding == "delta")
+				options.frames.encoding = FrameEncoding::Delta16;
+			else
+				throw std::invalid_argument("unknown frame encoding '" + encoding + "'");
+		}
+		else if (option == "--frame-keyframes")
+			options.frames.keyframe_interval = toInt(option, value());
+		else if (option == "--frame-queue")
+			options.frames.queue = toInt(option, value());
+		else if (option == "--frame-drop")
+			options.frames.drop = true;
+		else if (option == "--checkpoint")
+			options.checkpoint = value();
+		else if (option == "--checkpoint-every")
+			options.checkpoint_every = toInt(option, value());
+		else if (option == "--restore")
+			options.restore = value();
+		else
+			throw std::invalid_argument("unknown option " + option);
+	}
+
+	if (options.size < 3)
+		throw std::invalid_argument("--size must be at least 3");
+	if ((options.profile || !options.trace.empty()) && !Profiler::enabled())
+		throw std::invalid_argument("--profile and --trace need a build with -DFLUIDSIM_PROFILE");
+	if (options.threads < 1)
+		throw std::invalid_argument("--threads must be at least 1");
+	if (options.steps < 0)
+		throw std::invalid_argument("--steps must not be negative");
+	if (options.projection_iterations < 1 || options.diffusion_iterations < 1)
+		throw std::invalid_argument("--projection-iterations and --diffusion-iterations must be at least 1");
+	if (options.tile_threshold < 0)
+		throw std::invalid_argument("--tile-threshold must not be negative");
+	if (options.checkpoint_every < 0)
+		throw std::invalid_argument("--checkpoint-every must not be negative");
+	if (options.particles < 0 || options.particle_lifetime < 0)
+		throw std::invalid_argument("--particles and --particle-lifetime must not be negative");
+	if (options.checkpoint_every > 0 && options.checkpoint.empty())
+		throw std::invalid_argument("--checkpoint-every needs --checkpoint");
+	if (options.accuracy && !options.restore.empty())
+		throw std::invalid_argument("--accuracy cannot be combined with --restore");
+	// A restored simulation keeps the domain and solvers of the checkpoint, createLogic checks them after the restore
+	if (options.restore.empty()) {
+		checkDomain(options.domain, options.projection, options.relaxation, options.active_tiles);
+		checkAdvection(options.advection, options.projection, options.projection_iterations);
+		// The spectral solvers transform one period of 2^k interior cells
+		bool spectral = options.projection == ProjectionSolver::Spectral || options.relaxation == Relaxation::Spectral;
+		if (spectral && !Spectral::supports(options.size))
+			throw std::invalid_argument("the spectral solvers need a --size of 2^k + 2, e.g. 130 or 1026");
+	}
+	return options;
+}
+
+// A new simulation with the parameters of the options, or the one saved in the checkpoint to restore
+static Logic createLogic(HeadlessOptions& options, long& first_step) {
+	first_step = 0;
+	if (options.restore.empty())
+		return Logic(options.size, options.dt, options.diffusion, options.viscosity, options.precisions);
+
+	// The checkpoint decides the precision of the fields
+	Logic logic = Checkpoint::restore(options.restore, first_step);
+	options.precisions = logic.precisions();
+	options.size = logic.size();
+	options.dt = logic.dt();
+	options.diffusion = logic.diffusion();
+	options.viscosity = logic.viscosity();
+	Physics& physics = logic.physics();
+	checkDomain(physics.domain(), physics.projectionSolver(), physics.relaxation(), options.active_tiles);
+	checkAdvection(physics.advection(), physics.projectionSolver(), physics.projectionSweeps());
+	return logic;
+}
+
+Headless::Headless(const HeadlessOptions& options)
+	: _options(options), _first_step(0), _logic(createLogic(_options, _first_step)) {
+	if (!_options.script.empty())
+		_script = SourceScript::load(_options.script);
+
+	// A restored simulation keeps the solver settings of the checkpoint
+	Physics& physics = _logic.physics();
+	if (_options.restore.empty()) {
+		physics.setProjectionSolver(_options.projection);
+		physics.multigrid().setCycle(_options.cycle);
+		physics.multigrid().setTolerance(_options.tolerance);
+		physics.setRelaxation(_options.relaxation);
+		physics.setDomain(_options.domain);
+		physics.setAdvection(_options.advection);
+		physics.setProjectionTolerance(_options.tolerance);
+		physics.setProjectionSweeps(_options.projection_iterations);
+		physics.setDiffusionTolerance(_options.diffusion_tolerance);
+		physics.setResidualNorm(_options.residual_norm);
+		physics.setWarmStart(_options.warm_start);
+		_logic.setDiffusionIterations(_options.diffusion_iterations);
+	}
+	physics.setThreads(_options.threads);
+
+	// The tiles are not part of a checkpoint, the first step finds them in the restored fields
+	if (_options.active_tiles)
+		_logic.setActiveTiles(true, _options.tile_threshold);
+
+	if (!_options.frames.path.empty())
+		_frames.reset(new FrameWriter(_options.frames, _options.size, _options.dt));
+
+	// The particles are not checkpointed, a restored run seeds them again
+	Particles& particles = _logic.particles();
+	if (_options.particle_lifetime > 0)
+		particles.setLifetime(_options.particle_lifetime);
+	float high = _options.size - 1.5f;
+	particles.seed(0.5f, 0.5f, high, high, _options.particles);
+}
+
+// Set by SIGUSR1, the simulation loop writes a checkpoint after the current step
+static volatile std::sig_atomic_t checkpoint_requested = 0;
+
+static void requestCheckpoint(int) {
+	checkpoint_requested = 1;
+}
+
+// Run the simulation loop of Simulation::run without input polling, rendering and vsync
+HeadlessResult Headless::simulate() {
+	HeadlessResult result = {};
+
+	// Iterations of all diffusion and pressure solves
+	long diffusion_iterations = 0;
+	long projection_iterations = 0;
+
+	// Active tiles summed over all steps
+	long active_tiles = 0;
+
+	// A restored run continues with the step after the checkpoint, so the sources of the script stay in place
+	result.steps = std::max<long>(_options.steps - _first_step, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	for (long step = _first_step; step < _options.steps; step++) {
+		_script.apply(_logic, step);
+		_logic.step();
+		diffusion_iterations += _logic.statistics().diffusion_iterations;
+		projection_iterations += _logic.statistics().projection_iterations;
+		if (_logic.activeTiles())
+			active_tiles += _logic.activeTiles()->activeCount();
+		if (_options.fade)
+			_logic.fadeDensity();
+		if (_frames && _frames->due(step + 1))
+			_frames->capture(_logic, step + 1);
+
+		bool periodic = _options.checkpoint_every > 0 && (step + 1) % _options.checkpoint_every == 0;
+		if (periodic || checkpoint_requested) {
+			checkpoint_requested = 0;
+			Checkpoint::save(_options.checkpoint, _logic, step + 1);
+			std::cerr << "checkpoint after step " << step + 1 << " written to " << _options.checkpoint << std::endl;
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+
+	const Grid& density = _logic.density();
+	const Grid& velocity_x = _logic.velocity_x();
+	const Grid& velocity_y = _logic.velocity_y();
+	for (int k = 0; k < density.elements(); k++) {
+		double u = velocity_x.load(k);
+		double v = velocity_y.load(k);
+		result.mass += density.load(k);
+		result.max_density = std::max<double>(result.max_density, density.load(k));
+		result.kinetic_energy += 0.5 * (u * u + v * v);
+	}
+
+	if (result.steps > 0) {
+		result.diffusion_iterations = static_cast<double>(diffusion_iterations) / result.steps;
+		result.projection_iterations = static_cast<double>(projection_iterations) / result.steps;
+		result.active_tiles = static_cast<double>(active_tiles) / result.steps;
+	}
+	result.diffusion_residual = _logic.statistics().diffusion_residual;
+	result.projection_residual = _logic.statistics().projection_residual;
+	result.particles = _logic.particles().count();
+
+	// The frames still in the queue are written after the time measurement
+	if (_frames) {
+		_frames->close();
+		result.frames_written = _frames->written();
+		result.frames_dropped = _frames->dropped();
+	}
+
+	// The final state can be continued with a larger number of steps
+	if (!_options.checkpoint.empty())
+		Checkpoint::save(_options.checkpoint, _logic, std::max<long>(_options.steps, _first_step));
+	return result;
+}
+
+// Largest and root mean square difference of a field to the float reference, relative to the largest and the root
+// mean square value of the reference
+static void printDeviation(const char* name, const Grid& field, const Grid& reference) {
+	double largest_difference = 0;
+	double largest_value = 0;
+	double squared_difference = 0;
+	double squared_value = 0;
+	double sum = 0;
+	double reference_sum = 0;
+	for (int k = 0; k < field.elements(); k++) {
+		double value = field.load(k);
+		double expected = reference.load(k);
+		double difference = value - expected;
+		largest_difference = std::max(largest_difference, std::fabs(difference));
+		largest_value = std::max(largest_value, std::fabs(expected));
+		squared_difference += difference * difference;
+		squared_value += expected * expected;
+		sum += value;
+		reference_sum += expected;
+	}
+	std::cout << "  " << name << ": max difference " << largest_difference
+		<< " (" << (largest_value > 0 ? 100.0 * largest_difference / largest_value : 0.0) << "% of the max), relative L2 "
+		<< (squared_value > 0 ? std::sqrt(squared_difference / squared_value) : 0.0)
+		<< ", sum " << sum << " vs " << reference_sum << std::endl;
+}
+
+// Simulate and print the throughput and the state after the last step
+void Headless::run() {
+	if (!_options.trace.empty())
+		Profiler::instance().setTracing(true);
+	if (!_options.checkpoint.empty())
+		std::signal(SIGUSR1, requestCheckpoint);
+
+	HeadlessResult result = simulate();
+	double steps_per_second = result.seconds > 0 ? result.steps / result.seconds : 0;
+
+	std::cout << "grid:           " << _options.size << " x " << _options.size << "\n"
+		<< "threads:        " << _logic.physics().threads() << "\n"
+		<< "steps:          " << result.steps << (_first_step > 0 ? " (restored after step " + std::to_string(_first_step) + ")" : "") << "\n"
+		<< "time:           " << result.seconds << " s\n"
+		<< "steps/second:   " << steps_per_second << "\n"
+		<< "cells/second:   " << steps_per_second * _logic.density().cells() << "\n"
+		<< "total density:  " << result.mass << "\n"
+		<< "diffusion:      " << result.diffusion_iterations
+		<< " iterations/step, last residual " << result.diffusion_residual << "\n"
+		<< "projection:     " << result.projection_iterations
+		<< " iterations/step, last residual " << result.projection_residual << std::endl;
+	if (const ActiveTiles* tiles = _logic.activeTiles()) {
+		int tiles_total = tiles->tiles() * tiles->tiles();
+		std::cout << "active tiles:   " << result.active_tiles << " of " << tiles_total << " per step ("
+			<< 100.0 * result.active_tiles / tiles_total << "%), " << tiles->activeCount() << " in the last step" << std::endl;
+	}
+	if (_logic.particles().capacity() > 0)
+		std::cout << "particles:      " << result.particles << " alive after the last step" << std::endl;
+	if (_frames) {
+		std::cout << "frames:         " << result.frames_written << " written to " << _options.frames.path
+			<< ", " << result.frames_dropped << " dropped" << std::endl;
+	}
+	if (!_options.checkpoint.empty())
+		std::cout << "checkpoint:     " << _options.checkpoint << std::endl;
+
+	// Memory of all fields compared to storing every one of them in float
+	FieldPrecisions precisions = _logic.precisions();
+	const double mebibyte = 1024.0 * 1024.0;
+	std::cout << "precision:      velocity " << precisionName(precisions.velocity)
+		<< ", previous velocity " << precisionName(precisions.previous_velocity)
+		<< ", density " << precisionName(precisions.density)
+		<< ", previous density " << precisionName(precisions.previous_density) << "\n"
+		<< "field memory:   " << _logic.arena().bytes() / mebibyte << " MiB ("
+		<< GridArena::layoutBytes(_options.size, FieldPrecisions().fields()) / mebibyte << " MiB in float)" << std::endl;
+
+	// The reference runs the same steps without frames and checkpoints after the time measurement
+	if (_options.accuracy) {
+		HeadlessOptions reference_options = _options;
+		reference_options.precisions = FieldPrecisions();
+		reference_options.frames = FrameOptions();
+		reference_options.checkpoint.clear();
+		reference_options.checkpoint_every = 0;
+		Headless reference(reference_options);
+		reference.simulate();
+		std::cout << "accuracy against float:" << std::endl;
+		printDeviation("density", _logic.density(), reference.logic().density());
+		printDeviation("velocity x", _logic.velocity_x(), reference.logic().velocity_x());
+		printDeviation("velocity y", _logic.velocity_y(), reference.logic().velocity_y());
+	}
+
+	if (_options.profile)
+		Profiler::instance().report(std::cout);
+	if (!_options.trace.empty())
+		Profiler::instance().writeTrace(_options.trace);
+}
@@ -1,14 +1,32 @@
 #include "../header/logic.h"
+#include "../header/profiler.h"
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
-// Helper-Function:
-// Get as input x and y coordinates and checks if the coordinates are outside of the window
-// N is the max size, i.e. here SIZE*SIZE
-int transform_coordinates(int x, int y, int N);
+const int Logic::FIELDS;
 
-Logic::Logic(float dt, float diff, float visc) {
-	// Get size from global variable SIZE to set correct array sizes
-	_size = SIZE;
+// Velocity, previous velocity, previous density, density, the two pressures and the divergence
+std::vector<Precision> FieldPrecisions::fields() const {
+	return {velocity, velocity, previous_velocity, previous_velocity, previous_density, density,
+		Precision::Float, Precision::Float, Precision::Float};
+}
+
+Logic::Logic(int size, float dt, float diff, float visc, const FieldPrecisions& precisions)
+	: Logic(GridArena(size, precisions.fields()), dt, diff, visc) {}
+
+Logic::Logic(GridArena arena, float dt, float diff, float visc) : _arena(std::move(arena)) {
+	if (_arena.fields() != FIELDS)
+		throw std::invalid_argument("Logic needs an arena with " + std::to_string(FIELDS) + " fields");
+	for (int field = 6; field < FIELDS; field++) {
+		if (_arena.precision(field) != Precision::Float)
+			throw std::invalid_argument("Logic needs the pressure and the divergence in float precision");
+	}
+
+	// Number of grid elements in each direction, the arena is allocated with this size
+	_size = _arena.size();
 	
 	// Time step of recalulcation of the fluid movement
 	// The smaller _dt, the "slower" the rendering
@@ -20,72 +38,179 @@ Logic::Logic(float dt, float diff, float visc) {
 	// Set viscosity of fluid
 	_viscosity = visc;
 
-	// Setting the initial values of the arrays to zero
-	std::fill(_velocity_x.begin(), _velocity_x.end(), 0);
-	std::fill(_velocity_y.begin(), _velocity_y.end(), 0);
-	std::fill(_previous_velocity_x.begin(), _previous_velocity_x.end(), 0);
-	std::fill(_previous_velocity_y.begin(), _previous_velocity_y.end(), 0);
-	std::fill(_previous_density.begin(), _previous_density.end(), 0);
-	std::fill(_density.begin(), _density.end(), 0);
+	// Hand out the fields of the arena, a new arena already initialized all values to zero
+	_velocity_x = _arena.field(0);
+	_velocity_y = _arena.field(1);
+	_previous_velocity_x = _arena.field(2);
+	_previous_velocity_y = _arena.field(3);
+	_previous_density = _arena.field(4);
+	_density = _arena.field(5);
+	_pressure_diffused = _arena.field(6);
+	_pressure_advected = _arena.field(7);
+	_divergence = _arena.field(8);
+
+	_diffusion_iterations = 16;
+	_statistics = {0, 0, 0, 0};
+}
+
+FieldPrecisions Logic::precisions() const {
+	FieldPrecisions precisions;
+	precisions.velocity = _velocity_x.precision();
+	precisions.previous_velocity = _previous_velocity_x.precision();
+	precisions.density = _density.precision();
+	precisions.previous_density = _previous_density.precision();
+	return precisions;
+}
+
+// Sparse simulation, the first update of the new tiles scans the complete grid
+void Logic::setActiveTiles(bool enabled, float threshold) {
+	if (enabled)
+		_tiles.reset(new ActiveTiles(_size, threshold));
+	else
+		_tiles.reset();
+	_physics.setActiveTiles(_tiles.get());
+}
+
+// Add the iterations and keep the largest residual of a solve to the statistics of the current step
+static void countSolve(int& iterations, float& residual, int solve_iterations, float solve_residual) {
+	iterations += solve_iterations;
+	residual = std::max(residual, solve_residual);
 }
 	
 // Addition of density in the density field at the spot where the mouse is clicked
 // This represents the third term in the smoke density PDE (see Jos Stam, Figure 1, equation 2)
 void Logic::addDensity(float x, float y, float amount) {
-	_density[transform_coordinates(x,y,_size)] += amount;
+	int index = _density.clampedIndex(x, y);
+	_density.store(index, _density.load(index) + amount);
+	if (_tiles)
+		_tiles->touch(x, y);
 }
 
 // Increase of velocity in the velocity field in x and y direction due to external force (mouse movement)
 void Logic::addVelocity(float x, float y, float px, float py) {
-	int index = transform_coordinates(x,y,_size);
-	_velocity_x[index] += px;
-	_velocity_y[index] += py;
+	int index = _velocity_x.clampedIndex(x, y);
+	_velocity_x.store(index, _velocity_x.load(index) + px);
+	_velocity_y.store(index, _velocity_y.load(index) + py);
+	if (_tiles)
+		_tiles->touch(x, y);
+}
+
+// The cell is moved into the interior, its particles start anywhere inside of it
+void Logic::addParticles(float x, float y, int count) {
+	x = std::min(std::max(x, 1.0f), _size - 2.0f);
+	y = std::min(std::max(y, 1.0f), _size - 2.0f);
+	_particles.seed(x - 0.5f, y - 0.5f, x + 0.5f, y + 0.5f, count);
 }
 
 // Make one simulation step by solving the differential equation
 // Diffuse and advect always in both directions
+// Every stage is timed when the code is compiled with FLUIDSIM_PROFILE (see profiler.h)
 void Logic::step() {
+	PROFILE_SCOPE("step");
+	_statistics = {0, 0, 0, 0};
+
+	// Find the tiles this step has to simulate, the tiles that turn quiet are cleared in every transported field
+	if (_tiles) {
+		PROFILE_SCOPE("active tiles");
+		_tiles->update(_density, _velocity_x, _velocity_y, _dt,
+			{_velocity_x, _velocity_y, _previous_velocity_x, _previous_velocity_y, _previous_density, _density});
+		PROFILE_VALUE("active tile count", _tiles->activeCount());
+	}
+
 	// Viscous diffusion of the velocity field in x and y direction according to the Navier Stokes PDE
-	_physics.diffuse_velocity(1, _previous_velocity_x, _velocity_x, _viscosity, _dt, 16, _size);	
-	_physics.diffuse_velocity(2, _previous_velocity_y, _velocity_y, _viscosity, _dt, 16, _size);	
+	{
+		PROFILE_SCOPE("diffuse velocity");
+		_physics.diffuse(Boundary::VelocityX, _previous_velocity_x, _velocity_x, _viscosity, _dt, _diffusion_iterations);	
+		countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual,
+			_physics.diffusionIterations(), _physics.diffusionResidual());
+		_physics.diffuse(Boundary::VelocityY, _previous_velocity_y, _velocity_y, _viscosity, _dt, _diffusion_iterations);	
+		countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual,
+			_physics.diffusionIterations(), _physics.diffusionResidual());
+	}
 
 	// Force mass conservation and ensure that the velocity field remains divergence-free.
-	_physics.project(_previous_velocity_x, _previous_velocity_y, _velocity_x, _velocity_y, _size);
+	// Starts from the pressure this projection found in the previous step
+	{
+		PROFILE_SCOPE("project diffused");
+		_physics.project(_previous_velocity_x, _previous_velocity_y, _pressure_diffused, _divergence);
+		countSolve(_statistics.projection_iterations, _statistics.projection_residual,
+			_physics.projectionIterations(), _physics.projectionResidual());
+		PROFILE_VALUE("project diffused iterations", _physics.projectionIterations());
+		PROFILE_VALUE("project diffused residual", _physics.projectionResidual());
+	}
 	
 	// Self-Advection of the velocity in x and y direction according to the Navier Stokes PDE
 	// Self-Advection is the movement of the velocity field along itself
-	_physics.advect_velocity(1, _velocity_x, _previous_velocity_x, _previous_velocity_x, _previous_velocity_y, _dt, _size);
-	_physics.advect_velocity(2, _velocity_y, _previous_velocity_y, _previous_velocity_x, _previous_velocity_y, _dt, _size);
+	// Both components share the backtrace along the previous velocity field, so they are advected in one pass
+	{
+		PROFILE_SCOPE("advect velocity");
+		_physics.advect({{Boundary::VelocityX, _velocity_x, _previous_velocity_x},
+				{Boundary::VelocityY, _velocity_y, _previous_velocity_y}},
+			_previous_velocity_x, _previous_velocity_y, _dt);
+	}
 
 	// Force mass conservation and ensure that the velocity field remains divergence-free.
-	_physics.project(_velocity_x, _velocity_y, _previous_velocity_x, _previous_velocity_y, _size);
+	{
+		PROFILE_SCOPE("project advected");
+		_physics.project(_velocity_x, _velocity_y, _pressure_advected, _divergence);
+		countSolve(_statistics.projection_iterations, _statistics.projection_residual,
+			_physics.projectionIterations(), _physics.projectionResidual());
+		PROFILE_VALUE("project advected iterations", _physics.projectionIterations());
+		PROFILE_VALUE("project advected residual", _physics.projectionResidual());
+	}
 
 	// Diffuse the smoke density according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-	_physics.diffuse_density(0, _previous_density, _density, _diffusion_coefficient, _dt, 16, _size);	
+	{
+		PROFILE_SCOPE("diffuse density");
+		_physics.diffuse(Boundary::Scalar, _previous_density, _density, _diffusion_coefficient, _dt, _diffusion_iterations);	
+		countSolve(_statistics.diffusion_iterations, _statistics.diffusion_residual,
+			_physics.diffusionIterations(), _physics.diffusionResidual());
+	}
 	
 	// Advection of the smoke in the velocity field according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-	_physics.advect_density(0, _density, _previous_density, _velocity_x, _velocity_y, _dt, _size);
+	{
+		PROFILE_SCOPE("advect density");
+		_physics.advect({{Boundary::Scalar, _density, _previous_density}}, _velocity_x, _velocity_y, _dt);
+	}
+
+	// The tracers follow the same velocity field as the smoke
+	if (_particles.count() > 0) {
+		PROFILE_SCOPE("advect particles");
+		_particles.advect(_velocity_x, _velocity_y, _dt, _physics.domain(), _physics.pool());
+		PROFILE_VALUE("particles", _particles.count());
+	}
+	PROFILE_VALUE("diffusion iterations", _statistics.diffusion_iterations);
 }
 
-// Refresh the image displayed during simulation
-void Logic::render(sf::RenderWindow& win) {
-	win.clear();
-	for (int i = 0; i < _size; i++) {
-		for(int j = 0; j < _size; j++) {
-			sf::RectangleShape rect;
-			rect.setSize(sf::Vector2f(SCALE, SCALE));
-			rect.setPosition(j * SCALE, i * SCALE);
-			rect.setFillColor(sf::Color(0, 255, 0, (_density[transform_coordinates(i,j,_size)] > 255) ? 255 : _density[transform_coordinates(i,j,_size)]));
-			win.draw(rect);
-		}
+// Subtract the fade from every element of [begin, end), stored with the element type of the storage
+template <typename Storage>
+static void fadeElements(typename Storage::Element* values, int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		float d = Storage::load(values[i]);
+		values[i] = Storage::store((d - 0.05f < 0) ? 0 : d - 0.05f);
 	}
 }
 
 // Let's the density fade over time so to not fill the complete image
 // UNPHYSICAL BEHAVIOR!!
-void Logic::fadeDensity(int size) {
-	for (int i = 0; i < size; i++) {
-		float d = _density[i];
-		_density[i] = (d - 0.05f < 0) ? 0 : d - 0.05f; 
-	}	
+void Logic::fadeDensity() {
+	PROFILE_SCOPE("fade density");
+
+	withStorage(_density.precision(), [&](auto storage) {
+		typedef decltype(storage) Storage;
+		typename Storage::Element* values = _density.values<Storage>();
+
+		// The row padding is zero and stays zero, so the loop can run over all stored values
+		if (!_tiles) {
+			fadeElements<Storage>(values, 0, _density.elements());
+			return;
+		}
+
+		// The density outside of the active tiles is zero already
+		for (int j = 0; j < _size; j++) {
+			typename Storage::Element* row = values + _density.index(0, j);
+			for (const TileSpan& span : _tiles->spans(j))
+				fadeElements<Storage>(row, span.begin, span.end);
+		}
+	});
 }
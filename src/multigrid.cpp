@@ -0,0 +1,259 @@
+#include "../header/multigrid.h"
+#include <algorithm>
+#include <cmath>
+
+// Coarsening stops once a level has at most this many interior cells in each direction
+static const int COARSEST_SIZE = 4;
+
+// Red-black sweeps on the coarsest level, which is small enough to be solved almost exactly
+static const int COARSEST_SWEEPS = 32;
+
+// Copy the interior neighbours into the boundary cells (zero gradient across the walls)
+static void setNeumann(Grid& x, int n) {
+	int m = x.stride();
+	for (int i = 1; i <= n; i++) {
+		x[i] = x[m + i];
+		x[(n + 1) * m + i] = x[n * m + i];
+	}
+	for (int j = 0; j < n + 2; j++) {
+		x[j * m] = x[j * m + 1];
+		x[j * m + n + 1] = x[j * m + n];
+	}
+}
+
+// Subtract the mean of the interior cells, the pressure equation is only solvable for a right hand side without mean
+static void removeMean(Grid& x, int n) {
+	int m = x.stride();
+	double sum = 0;
+	for (int j = 1; j <= n; j++)
+		for (int i = 1; i <= n; i++)
+			sum += x[j * m + i];
+	float mean = static_cast<float>(sum / (static_cast<double>(n) * n));
+	for (int j = 1; j <= n; j++)
+		for (int i = 1; i <= n; i++)
+			x[j * m + i] -= mean;
+}
+
+// L2 norm over the interior cells
+static float norm(const Grid& x, int n) {
+	int m = x.stride();
+	double sum = 0;
+	for (int j = 1; j <= n; j++)
+		for (int i = 1; i <= n; i++)
+			sum += static_cast<double>(x[j * m + i]) * x[j * m + i];
+	return static_cast<float>(std::sqrt(sum));
+}
+
+Multigrid::Level::Level(int interior, int fields) : n(interior), arena(interior + 2, fields) {
+	residual = arena.field(0);
+	correction = arena.field(1);
+	if (fields > 2) {
+		p = arena.field(2);
+		rhs = arena.field(3);
+	}
+}
+
+Multigrid::Multigrid()
+	: _cycle(VCycle), _tolerance(1e-4f), _max_cycles(50), _pre_smoothing(2), _post_smoothing(2) {}
+
+// Create the hierarchy, level 0 borrows p and div from the caller so it only needs a residual and a correction field
+void Multigrid::build(int size) {
+	if (!_levels.empty() && _levels[0].n == size - 2)
+		return;
+
+	_levels.clear();
+	int n = size - 2;
+	_levels.emplace_back(n, 2);
+	while (n > COARSEST_SIZE) {
+		// Odd sizes round up, the last coarse cell then covers a single row or column of fine cells
+		n = (n + 1) / 2;
+		_levels.emplace_back(n, 4);
+	}
+}
+
+// Red-black Gauss Seidel: all cells of one colour only depend on cells of the other colour
+void Multigrid::smooth(Level& level, int sweeps) {
+	int n = level.n;
+	int m = level.p.stride();
+	float* p = level.p.data();
+	const float* rhs = level.rhs.data();
+	for (int k = 0; k < sweeps; k++) {
+		for (int colour = 0; colour < 2; colour++) {
+			for (int j = 1; j <= n; j++) {
+				for (int i = 1 + (j + colour) % 2; i <= n; i += 2) {
+					int index = j * m + i;
+					p[index] = 0.25f * (rhs[index] + p[index - 1] + p[index + 1] + p[index - m] + p[index + m]);
+				}
+			}
+			setNeumann(level.p, n);
+		}
+	}
+}
+
+// The coarsest level is tiny, many sweeps are cheaper than any further coarsening
+void Multigrid::solveCoarsest(Level& level) {
+	removeMean(level.rhs, level.n);
+	smooth(level, COARSEST_SWEEPS);
+}
+
+// Residual r = rhs - A p of the pressure equation on the interior cells
+float Multigrid::computeResidual(Level& level) {
+	int n = level.n;
+	int m = level.p.stride();
+	const float* p = level.p.data();
+	const float* rhs = level.rhs.data();
+	float* r = level.residual.data();
+	for (int j = 1; j <= n; j++) {
+		for (int i = 1; i <= n; i++) {
+			int index = j * m + i;
+			r[index] = rhs[index] - (4 * p[index] - p[index - 1] - p[index + 1] - p[index - m] - p[index + m]);
+		}
+	}
+	return norm(level.residual, n);
+}
+
+// Average the fine cells covered by each coarse cell. The operator is not scaled by the cell width,
+// so the coarse right hand side is four times the average to account for the doubled cell width.
+static void restrictField(const Grid& fine, int fine_n, Grid& coarse, int coarse_n) {
+	int fm = fine.stride();
+	int cm = coarse.stride();
+	for (int J = 1; J <= coarse_n; J++) {
+		for (int I = 1; I <= coarse_n; I++) {
+			float sum = 0;
+			int count = 0;
+			for (int j = 2 * J - 1; j <= std::min(2 * J, fine_n); j++) {
+				for (int i = 2 * I - 1; i <= std::min(2 * I, fine_n); i++) {
+					sum += fine[j * fm + i];
+					count++;
+				}
+			}
+			coarse[J * cm + I] = 4.0f * sum / count;
+		}
+	}
+}
+
+void Multigrid::restrictResidual(const Level& fine, Level& coarse) {
+	restrictField(fine.residual, fine.n, coarse.rhs, coarse.n);
+}
+
+void Multigrid::restrictRhs(const Level& fine, Level& coarse) {
+	restrictField(fine.rhs, fine.n, coarse.rhs, coarse.n);
+}
+
+// Bilinear interpolation between cell centres: each fine cell takes 9/16 of its own coarse cell,
+// 3/16 of the two nearest coarse neighbours and 1/16 of the diagonal one. The boundary cells of the
+// coarse level supply the neighbours at the walls.
+void Multigrid::prolongate(Level& coarse, Level& fine, Grid& target) {
+	setNeumann(coarse.p, coarse.n);
+	int fm = target.stride();
+	int cm = coarse.p.stride();
+	const float* c = coarse.p.data();
+	float* p = target.data();
+	for (int j = 1; j <= fine.n; j++) {
+		int J = (j + 1) / 2;
+		int Jn = (j % 2 == 1) ? J - 1 : J + 1;
+		for (int i = 1; i <= fine.n; i++) {
+			int I = (i + 1) / 2;
+			int In = (i % 2 == 1) ? I - 1 : I + 1;
+			p[j * fm + i] = 0.5625f * c[J * cm + I] + 0.1875f * (c[J * cm + In] + c[Jn * cm + I]) + 0.0625f * c[Jn * cm + In];
+		}
+	}
+	setNeumann(target, fine.n);
+}
+
+// Add the interpolated coarse grid correction e to p, scaled by (r . e) / (e . A e). This is the step
+// length that minimizes the error in the energy norm along e. For even sizes it stays close to one,
+// for odd sizes, where the last coarse cell only covers one fine row, it keeps the cycle convergent.
+void Multigrid::correct(Level& level) {
+	int n = level.n;
+	int m = level.p.stride();
+	const float* e = level.correction.data();
+	const float* r = level.residual.data();
+	double re = 0;
+	double eAe = 0;
+	for (int j = 1; j <= n; j++) {
+		for (int i = 1; i <= n; i++) {
+			int index = j * m + i;
+			float Ae = 4 * e[index] - e[index - 1] - e[index + 1] - e[index - m] - e[index + m];
+			re += static_cast<double>(r[index]) * e[index];
+			eAe += static_cast<double>(e[index]) * Ae;
+		}
+	}
+	if (eAe <= 0)
+		return;
+
+	float alpha = static_cast<float>(re / eAe);
+	float* p = level.p.data();
+	for (int j = 1; j <= n; j++)
+		for (int i = 1; i <= n; i++)
+			p[j * m + i] += alpha * e[j * m + i];
+	setNeumann(level.p, n);
+}
+
+// One V-cycle starting at the given level
+void Multigrid::vcycle(int index) {
+	Level& level = _levels[index];
+	if (index + 1 == static_cast<int>(_levels.size())) {
+		solveCoarsest(level);
+		return;
+	}
+
+	smooth(level, _pre_smoothing);
+	computeResidual(level);
+
+	Level& coarse = _levels[index + 1];
+	restrictResidual(level, coarse);
+	coarse.p.fill(0);
+	vcycle(index + 1);
+
+	prolongate(coarse, level, level.correction);
+	correct(level);
+	smooth(level, _post_smoothing);
+}
+
+// Solve the pressure equation for p with div as right hand side
+Multigrid::Result Multigrid::solve(Grid& p, Grid& div) {
+	build(p.size());
+	Level& finest = _levels[0];
+	finest.p = p;
+	finest.rhs = div;
+	int n = finest.n;
+
+	removeMean(div, n);
+	setNeumann(p, n);
+
+	Result result = {0, 0};
+	float rhs_norm = norm(div, n);
+	if (rhs_norm == 0) {
+		// Without divergence the pressure is constant, which does not change the velocities
+		p.fill(0);
+		return result;
+	}
+
+	result.residual = computeResidual(finest) / rhs_norm;
+	if (result.residual <= _tolerance)
+		return result;
+
+	if (_cycle == FullMultigrid) {
+		// Restrict the right hand side to every level, solve on the coarsest one and interpolate
+		// the solution upwards with one V-cycle per level as initial guess for the next finer one
+		int coarsest = static_cast<int>(_levels.size()) - 1;
+		for (int l = 1; l <= coarsest; l++)
+			restrictRhs(_levels[l - 1], _levels[l]);
+		_levels[coarsest].p.fill(0);
+		solveCoarsest(_levels[coarsest]);
+		for (int l = coarsest - 1; l >= 0; l--) {
+			prolongate(_levels[l + 1], _levels[l], _levels[l].p);
+			vcycle(l);
+		}
+		result.iterations++;
+		result.residual = computeResidual(finest) / rhs_norm;
+	}
+
+	while (result.residual > _tolerance && result.iterations < _max_cycles) {
+		vcycle(0);
+		result.iterations++;
+		result.residual = computeResidual(finest) / rhs_norm;
+	}
+	return result;
+}
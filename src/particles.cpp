@@ -0,0 +1,422 @@
+#include "../header/particles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+const int Particles::CHUNK;
+const int Particles::SORT_INTERVAL;
+
+Particles::Particles() : _count(0), _capacity(0), _lifetime(std::numeric_limits<float>::infinity()), _random(0x9e3779b9u),
+	  _unsorted(SORT_INTERVAL) {}
+
+// xorshift32, the upper 24 bits give a float in [0, 1) with all of its significant bits random
+float Particles::random() {
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+	return static_cast<float>(_random >> 8) * (1.0f / 16777216.0f);
+}
+
+// The capacity at least doubles, so seeding in small batches copies every particle only a few times in total
+void Particles::reserve(int count) {
+	if (count <= _capacity)
+		return;
+	if (count > std::numeric_limits<int>::max() / 2 - CHUNK)
+		throw std::length_error("Particles cannot hold " + std::to_string(count) + " particles");
+	int capacity = std::max(2 * _capacity, count);
+	capacity = (capacity + CHUNK - 1) / CHUNK * CHUNK;
+
+	std::size_t floats = 3 * static_cast<std::size_t>(capacity);
+	std::unique_ptr<float, AlignedDelete> memory(
+		static_cast<float*>(::operator new(floats * sizeof(float), std::align_val_t(GRID_ALIGNMENT))));
+	for (int array = 0; array < 3 && _count > 0; array++) {
+		std::memcpy(memory.get() + static_cast<std::size_t>(array) * capacity,
+			_memory.get() + static_cast<std::size_t>(array) * _capacity, _count * sizeof(float));
+	}
+	_memory = std::move(memory);
+	_scratch.reset();
+	_capacity = capacity;
+}
+
+void Particles::seed(float x0, float y0, float x1, float y1, int count) {
+	if (count < 0)
+		throw std::invalid_argument("cannot seed a negative number of particles");
+	reserve(_count + count);
+	float* x = _memory.get();
+	float* y = x + _capacity;
+	float* age = y + _capacity;
+	for (int k = _count; k < _count + count; k++) {
+		x[k] = x0 + (x1 - x0) * random();
+		y[k] = y0 + (y1 - y0) * random();
+		age[k] = 0;
+	}
+	_count += count;
+	if (count > 0)
+		_unsorted = SORT_INTERVAL;
+}
+
+// Copy every live particle over the retired ones before it, the particles before the first retired one stay in place
+void Particles::retire() {
+	float* x = _memory.get();
+	float* y = x + _capacity;
+	float* age = y + _capacity;
+	int live = 0;
+	while (live < _count && age[live] < _lifetime)
+		live++;
+	for (int k = live; k < _count; k++) {
+		if (age[k] < _lifetime) {
+			x[live] = x[k];
+			y[live] = y[k];
+			age[live] = age[k];
+			live++;
+		}
+	}
+	_count = live;
+}
+
+// Count the particles of every row, then scatter them into the scratch pool at the start of their row
+void Particles::sort(int size) {
+	if (!_scratch) {
+		std::size_t floats = 3 * static_cast<std::size_t>(_capacity);
+		_scratch.reset(static_cast<float*>(::operator new(floats * sizeof(float), std::align_val_t(GRID_ALIGNMENT))));
+	}
+	const float* x = _memory.get();
+	const float* y = x + _capacity;
+	const float* age = y + _capacity;
+	float* sorted_x = _scratch.get();
+	float* sorted_y = sorted_x + _capacity;
+	float* sorted_age = sorted_y + _capacity;
+
+	// Seeded particles may still lie outside of the grid, they count to the nearest row
+	auto row = [size](float y) {
+		return std::min(std::max(static_cast<int>(y), 0), size - 1);
+	};
+	_rows.assign(size + 1, 0);
+	for (int k = 0; k < _count; k++)
+		_rows[row(y[k]) + 1]++;
+	for (int j = 0; j < size; j++)
+		_rows[j + 1] += _rows[j];
+	for (int k = 0; k < _count; k++) {
+		int target = _rows[row(y[k])]++;
+		sorted_x[target] = x[k];
+		sorted_y[target] = y[k];
+		sorted_age[target] = age[k];
+	}
+	std::swap(_memory, _scratch);
+	_unsorted = 0;
+}
+
+// Parameters of one advection step shared by the kernels
+struct ParticleStep {
+	// Time step in cells per unit of velocity, and in time units for the age
+	float h;
+	float dt;
+
+	// Positions are kept in [0.5, high], see highestBacktrace in physics.cpp, n = N - 2 is the period
+	float high;
+	float n;
+
+	// An open domain retires the particles beyond edge = N - 1.5
+	bool open;
+	float edge;
+
+	float lifetime;
+};
+
+// Wrap a position around the periodic domain, then clamp it to the cells the bilinear stencil may read
+template <bool Wrap>
+static inline float confine(float x, const ParticleStep& step) {
+	if constexpr (Wrap)
+		x = x - step.n * std::floor((x - 1) / step.n);
+	return std::min(std::max(x, 0.5f), step.high);
+}
+
+// Bilinear interpolation of both velocity components at a confined position
+template <typename Storage>
+static inline void sample(const Grid& vx, const Grid& vy, float x, float y, float& u, float& v) {
+	const typename Storage::Element* a = vx.values<Storage>();
+	const typename Storage::Element* b = vy.values<Storage>();
+	int S = vx.stride();
+
+	// The positions are positive, so truncation is the same as floorf
+	int i0 = static_cast<int>(x);
+	int j0 = static_cast<int>(y);
+	float s1 = x - i0;
+	float s0 = 1.0f - s1;
+	float t1 = y - j0;
+	float t0 = 1.0f - t1;
+
+	int k = j0 * S + i0;
+	u = s0 * (t0 * Storage::load(a[k]) + t1 * Storage::load(a[k + S])) +
+		s1 * (t0 * Storage::load(a[k + 1]) + t1 * Storage::load(a[k + S + 1]));
+	v = s0 * (t0 * Storage::load(b[k]) + t1 * Storage::load(b[k + S])) +
+		s1 * (t0 * Storage::load(b[k + 1]) + t1 * Storage::load(b[k + S + 1]));
+}
+
+// Midpoint rule for the particles [i, end): the velocity at the position moves the particle half a step, the velocity
+// there moves it a full step. Returns the number of particles whose age reached the lifetime.
+template <typename Storage, bool Wrap>
+static int advectScalar(float* px, float* py, float* age, int i, int end, const Grid& vx, const Grid& vy,
+		const ParticleStep& step) {
+	int expired = 0;
+	for (; i < end; i++) {
+		float x = confine<Wrap>(px[i], step);
+		float y = confine<Wrap>(py[i], step);
+		float u, v;
+		sample<Storage>(vx, vy, x, y, u, v);
+		sample<Storage>(vx, vy, confine<Wrap>(x + 0.5f * step.h * u, step), confine<Wrap>(y + 0.5f * step.h * v, step), u, v);
+		x += step.h * u;
+		y += step.h * v;
+
+		float a = age[i] + step.dt;
+		if (step.open && (x < 0.5f || x > step.edge || y < 0.5f || y > step.edge))
+			a = std::numeric_limits<float>::infinity();
+		px[i] = confine<Wrap>(x, step);
+		py[i] = confine<Wrap>(y, step);
+		age[i] = a;
+		expired += a >= step.lifetime;
+	}
+	return expired;
+}
+
+#if defined(__AVX512F__)
+template <bool Wrap>
+static inline __m512 confine16(__m512 x, __m512 period, __m512 high) {
+	if constexpr (Wrap) {
+		const int floor = _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC;
+		x = _mm512_sub_ps(x, _mm512_mul_ps(period,
+			_mm512_roundscale_ps(_mm512_div_ps(_mm512_sub_ps(x, _mm512_set1_ps(1.0f)), period), floor)));
+	}
+	return _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(0.5f)), high);
+}
+
+// The horizontal neighbours of a stencil are adjacent, so every gather of 64 bit elements reads both of them for
+// 8 particles. The pairs of 16 particles are split into the left and the right values with two permutations.
+static inline void gatherPairs16(const float* field, __m512i indices, __m512& left, __m512& right) {
+	const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+	__m512 low = _mm512_castsi512_ps(_mm512_i32gather_epi64(_mm512_castsi512_si256(indices), field, 4));
+	__m512 high = _mm512_castsi512_ps(_mm512_i32gather_epi64(_mm512_extracti64x4_epi64(indices, 1), field, 4));
+	left = _mm512_permutex2var_ps(low, even, high);
+	right = _mm512_permutex2var_ps(low, odd, high);
+}
+
+static inline __m512 bilinear16(const float* field, __m512i source, __m512i below, __m512 s0, __m512 s1, __m512 t0,
+		__m512 t1) {
+	__m512 a, b, c, d;
+	gatherPairs16(field, source, a, b);
+	gatherPairs16(field, below, c, d);
+	__m512 left = _mm512_add_ps(_mm512_mul_ps(t0, a), _mm512_mul_ps(t1, c));
+	__m512 right = _mm512_add_ps(_mm512_mul_ps(t0, b), _mm512_mul_ps(t1, d));
+	return _mm512_add_ps(_mm512_mul_ps(s0, left), _mm512_mul_ps(s1, right));
+}
+
+// Same as sample for 16 confined positions of float fields
+static inline void sample16(const float* vx, const float* vy, int S, __m512 x, __m512 y, __m512& u, __m512& v) {
+	const __m512 one = _mm512_set1_ps(1.0f);
+	__m512i i0 = _mm512_cvttps_epi32(x);
+	__m512i j0 = _mm512_cvttps_epi32(y);
+	__m512 s1 = _mm512_sub_ps(x, _mm512_cvtepi32_ps(i0));
+	__m512 s0 = _mm512_sub_ps(one, s1);
+	__m512 t1 = _mm512_sub_ps(y, _mm512_cvtepi32_ps(j0));
+	__m512 t0 = _mm512_sub_ps(one, t1);
+	__m512i source = _mm512_add_epi32(_mm512_mullo_epi32(j0, _mm512_set1_epi32(S)), i0);
+	__m512i below = _mm512_add_epi32(source, _mm512_set1_epi32(S));
+	u = bilinear16(vx, source, below, s0, s1, t0, t1);
+	v = bilinear16(vy, source, below, s0, s1, t0, t1);
+}
+
+// Same as advectScalar for 16 particles at once, returns the first particle that is left for the scalar loop. The
+// chunks start on a multiple of CHUNK, so all loads and stores are aligned.
+template <bool Wrap>
+static int advectVector(float* px, float* py, float* age, int i, int end, const float* vx, const float* vy, int S,
+		const ParticleStep& step, int& expired) {
+	const __m512 period = _mm512_set1_ps(step.n);
+	const __m512 high = _mm512_set1_ps(step.high);
+	const __m512 h = _mm512_set1_ps(step.h);
+	const __m512 half_h = _mm512_set1_ps(0.5f * step.h);
+	const __m512 dt = _mm512_set1_ps(step.dt);
+	const __m512 low = _mm512_set1_ps(0.5f);
+	const __m512 edge = _mm512_set1_ps(step.edge);
+	const __m512 lifetime = _mm512_set1_ps(step.lifetime);
+	const __m512 infinity = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+	for (; i + 16 <= end; i += 16) {
+		__m512 x = confine16<Wrap>(_mm512_load_ps(px + i), period, high);
+		__m512 y = confine16<Wrap>(_mm512_load_ps(py + i), period, high);
+		__m512 u, v;
+		sample16(vx, vy, S, x, y, u, v);
+		sample16(vx, vy, S, confine16<Wrap>(_mm512_add_ps(x, _mm512_mul_ps(half_h, u)), period, high),
+			confine16<Wrap>(_mm512_add_ps(y, _mm512_mul_ps(half_h, v)), period, high), u, v);
+		x = _mm512_add_ps(x, _mm512_mul_ps(h, u));
+		y = _mm512_add_ps(y, _mm512_mul_ps(h, v));
+
+		__m512 a = _mm512_add_ps(_mm512_load_ps(age + i), dt);
+		if (step.open) {
+			__mmask16 outside = _mm512_cmp_ps_mask(x, low, _CMP_LT_OQ) | _mm512_cmp_ps_mask(x, edge, _CMP_GT_OQ)
+				| _mm512_cmp_ps_mask(y, low, _CMP_LT_OQ) | _mm512_cmp_ps_mask(y, edge, _CMP_GT_OQ);
+			a = _mm512_mask_mov_ps(a, outside, infinity);
+		}
+		_mm512_store_ps(px + i, confine16<Wrap>(x, period, high));
+		_mm512_store_ps(py + i, confine16<Wrap>(y, period, high));
+		_mm512_store_ps(age + i, a);
+		expired += __builtin_popcount(_mm512_cmp_ps_mask(a, lifetime, _CMP_GE_OQ));
+	}
+	return i;
+}
+#elif defined(__AVX2__)
+template <bool Wrap>
+static inline __m256 confine8(__m256 x, __m256 period, __m256 high) {
+	if constexpr (Wrap)
+		x = _mm256_sub_ps(x, _mm256_mul_ps(period, _mm256_floor_ps(_mm256_div_ps(_mm256_sub_ps(x, _mm256_set1_ps(1.0f)), period))));
+	return _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(0.5f)), high);
+}
+
+// Same as gatherPairs16 for 8 particles. The shuffle collects the left and the right values of both 128 bit lanes, the
+// permutation puts the lanes in order.
+static inline void gatherPairs8(const float* field, __m256i indices, __m256& left, __m256& right) {
+	const long long* pairs = reinterpret_cast<const long long*>(field);
+	__m256 low = _mm256_castsi256_ps(_mm256_i32gather_epi64(pairs, _mm256_castsi256_si128(indices), 4));
+	__m256 high = _mm256_castsi256_ps(_mm256_i32gather_epi64(pairs, _mm256_extracti128_si256(indices, 1), 4));
+	left = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0))),
+		_MM_SHUFFLE(3, 1, 2, 0)));
+	right = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1))),
+		_MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+static inline __m256 bilinear8(const float* field, __m256i source, __m256i below, __m256 s0, __m256 s1, __m256 t0,
+		__m256 t1) {
+	__m256 a, b, c, d;
+	gatherPairs8(field, source, a, b);
+	gatherPairs8(field, below, c, d);
+	__m256 left = _mm256_add_ps(_mm256_mul_ps(t0, a), _mm256_mul_ps(t1, c));
+	__m256 right = _mm256_add_ps(_mm256_mul_ps(t0, b), _mm256_mul_ps(t1, d));
+	return _mm256_add_ps(_mm256_mul_ps(s0, left), _mm256_mul_ps(s1, right));
+}
+
+// Same as sample for 8 confined positions of float fields
+static inline void sample8(const float* vx, const float* vy, int S, __m256 x, __m256 y, __m256& u, __m256& v) {
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256i i0 = _mm256_cvttps_epi32(x);
+	__m256i j0 = _mm256_cvttps_epi32(y);
+	__m256 s1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i0));
+	__m256 s0 = _mm256_sub_ps(one, s1);
+	__m256 t1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(j0));
+	__m256 t0 = _mm256_sub_ps(one, t1);
+	__m256i source = _mm256_add_epi32(_mm256_mullo_epi32(j0, _mm256_set1_epi32(S)), i0);
+	__m256i below = _mm256_add_epi32(source, _mm256_set1_epi32(S));
+	u = bilinear8(vx, source, below, s0, s1, t0, t1);
+	v = bilinear8(vy, source, below, s0, s1, t0, t1);
+}
+
+// Same as advectScalar for 8 particles at once, returns the first particle that is left for the scalar loop
+template <bool Wrap>
+static int advectVector(float* px, float* py, float* age, int i, int end, const float* vx, const float* vy, int S,
+		const ParticleStep& step, int& expired) {
+	const __m256 period = _mm256_set1_ps(step.n);
+	const __m256 high = _mm256_set1_ps(step.high);
+	const __m256 h = _mm256_set1_ps(step.h);
+	const __m256 half_h = _mm256_set1_ps(0.5f * step.h);
+	const __m256 dt = _mm256_set1_ps(step.dt);
+	const __m256 low = _mm256_set1_ps(0.5f);
+	const __m256 edge = _mm256_set1_ps(step.edge);
+	const __m256 lifetime = _mm256_set1_ps(step.lifetime);
+	const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+	for (; i + 8 <= end; i += 8) {
+		__m256 x = confine8<Wrap>(_mm256_load_ps(px + i), period, high);
+		__m256 y = confine8<Wrap>(_mm256_load_ps(py + i), period, high);
+		__m256 u, v;
+		sample8(vx, vy, S, x, y, u, v);
+		sample8(vx, vy, S, confine8<Wrap>(_mm256_add_ps(x, _mm256_mul_ps(half_h, u)), period, high),
+			confine8<Wrap>(_mm256_add_ps(y, _mm256_mul_ps(half_h, v)), period, high), u, v);
+		x = _mm256_add_ps(x, _mm256_mul_ps(h, u));
+		y = _mm256_add_ps(y, _mm256_mul_ps(h, v));
+
+		__m256 a = _mm256_add_ps(_mm256_load_ps(age + i), dt);
+		if (step.open) {
+			__m256 outside = _mm256_or_ps(
+				_mm256_or_ps(_mm256_cmp_ps(x, low, _CMP_LT_OQ), _mm256_cmp_ps(x, edge, _CMP_GT_OQ)),
+				_mm256_or_ps(_mm256_cmp_ps(y, low, _CMP_LT_OQ), _mm256_cmp_ps(y, edge, _CMP_GT_OQ)));
+			a = _mm256_blendv_ps(a, infinity, outside);
+		}
+		_mm256_store_ps(px + i, confine8<Wrap>(x, period, high));
+		_mm256_store_ps(py + i, confine8<Wrap>(y, period, high));
+		_mm256_store_ps(age + i, a);
+		expired += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(a, lifetime, _CMP_GE_OQ)));
+	}
+	return i;
+}
+#endif
+
+// Every chunk is advected independently and counts its expired particles, they are retired together afterwards
+void Particles::advect(const Grid& vx, const Grid& vy, float dt, Domain domain, ThreadPool* pool) {
+	if (_count == 0)
+		return;
+	if (vx.precision() != vy.precision())
+		throw std::invalid_argument("Particles::advect needs both velocity components in the same precision");
+
+	int N = vx.size();
+	if (_unsorted >= SORT_INTERVAL)
+		sort(N);
+	_unsorted++;
+
+	bool periodic = domain == Domain::Periodic;
+	ParticleStep step;
+	step.h = dt * (N - 2);
+	step.dt = dt;
+	step.high = periodic ? std::nextafter(N - 1.0f, 0.0f) : N - 1.5f;
+	step.n = N - 2.0f;
+	step.open = domain == Domain::Open;
+	step.edge = N - 1.5f;
+	step.lifetime = _lifetime;
+
+	float* x = _memory.get();
+	float* y = x + _capacity;
+	float* age = y + _capacity;
+	int chunks = (_count + CHUNK - 1) / CHUNK;
+	_expired.assign(chunks, 0);
+
+	// The kernels are instantiated with and without the periodic wrap of the positions
+	auto advectChunks = [&](auto wrap) {
+		constexpr bool Wrap = decltype(wrap)::value;
+		std::function<void(int, int)> body = [&](int first, int last) {
+			for (int chunk = first; chunk < last; chunk++) {
+				int i = chunk * CHUNK;
+				int end = std::min(i + CHUNK, _count);
+				int expired = 0;
+				withStorage(vx.precision(), [&](auto storage) {
+					typedef decltype(storage) Storage;
+#if defined(__AVX512F__) || defined(__AVX2__)
+					if constexpr (std::is_same<Storage, FloatStorage>::value)
+						i = advectVector<Wrap>(x, y, age, i, end, vx.data(), vy.data(), vx.stride(), step, expired);
+#endif
+					expired += advectScalar<Storage, Wrap>(x, y, age, i, end, vx, vy, step);
+				});
+				_expired[chunk] = expired;
+			}
+		};
+		if (pool)
+			pool->parallel_for(0, chunks, body);
+		else
+			body(0, chunks);
+	};
+	if (periodic)
+		advectChunks(std::true_type());
+	else
+		advectChunks(std::false_type());
+
+	for (int expired : _expired) {
+		if (expired > 0) {
+			retire();
+			break;
+		}
+	}
+}
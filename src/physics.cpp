@@ -1,243 +1,1200 @@
 #include "../header/physics.h"
+#include "../header/const.h"
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-// Helper-Function:
-// Get as input x and y coordinates and translates it into the coordinates for the 1D array
-// N is the size of the whole array, i.e. here SIZE*SIZE
-int transform_coordinates(int x, int y, int N);
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Grid sizes the kernels are specialized for, see SizeList. Shape<0> is the run time shape, so
+// -DFLUIDSIM_FIXED_SIZES=0 builds no specialized kernels at all.
+#ifndef FLUIDSIM_FIXED_SIZES
+#define FLUIDSIM_FIXED_SIZES SIZE
+#endif
+typedef SizeList<FLUIDSIM_FIXED_SIZES> FixedSizes;
 
 // Ensure that no smoke can exist the simulation box. 
 // Set horizontal density to zero on vertical walls, analog on horizontal walls
-void Physics::setBnd(int b, std::array<float, SIZE*SIZE>& x, int N) {
-        // If b == 2, assign the negative value of the second but last element to the element closest to the boundary 
-		// on top and bottom of the simulation box. This is called in the diffusion / advection for the y-axis.
-		for(int i = 1; i < N - 1; i++) {
-            	x[transform_coordinates(i, 0, N)] = (b == 2 ? -x[transform_coordinates(i, 1, N)] : x[transform_coordinates(i, 1, N)]);
-            	x[transform_coordinates(i, N-1, N)] = (b == 2 ? -x[transform_coordinates(i, N-2, N)] : x[transform_coordinates(i, N-2, N)]);
-        }
-
-		// If b == 1, assign the negative value of the second but last element to the element closest to the boundary 
-		// on left and right of the simulation box. This is called in the diffusion / advection for the x-axis.
-        for(int j = 1; j < N - 1; j++) {
-            	x[transform_coordinates(0, j, N)] = (b == 1 ? -x[transform_coordinates(1, j, N)] : x[transform_coordinates(1, j, N)]);
-            	x[transform_coordinates(N-1, j, N)] = (b == 1 ? -x[transform_coordinates(N-2, j, N)] : x[transform_coordinates(N-2, j, N)]);
-        }
-    
+void Physics::setBnd(Boundary b, Grid& x) {
+	setBnd(b, x, 0, x.size());
+}
+
+// The boundary values of the rows [first, last). Row 0 and row N - 1 only read the row next to them, the side columns
+// only read their own row, so the rows can be handled by different threads or processes.
+// A periodic boundary reads the rows on the other side of the grid and always handles the complete grid.
+template <typename Storage, typename Policy, typename GridShape>
+static void setBndWith(Grid& grid, int first, int last) {
+	int N = GridShape::size(grid);
+	int S = GridShape::stride(grid);
+	typename Storage::Element* x = grid.values<Storage>();
+	auto value = [&](int i, int j) { return Storage::load(x[j * S + i]); };
+
+	if constexpr (Policy::periodic) {
+		// The side columns hold the interior column of the other side, then the top and bottom rows (including the
+		// corners) the interior row of the other side
+		for (int j = 1; j < N - 1; j++) {
+			x[j * S] = x[j * S + N - 2];
+			x[j * S + N - 1] = x[j * S + 1];
+		}
+		std::copy(x + (N - 2) * S, x + (N - 2) * S + N, x);
+		std::copy(x + S, x + S + N, x + (N - 1) * S);
+	} else {
+		// The y-velocity is negated on top and bottom of the simulation box, so no fluid passes these walls.
+		// This is called in the diffusion / advection for the y-axis.
+		if (first == 0) {
+			for(int i = 1; i < N - 1; i++)
+				x[i] = Storage::store(Policy::horizontal * value(i, 1));
+		}
+		if (last == N) {
+			for(int i = 1; i < N - 1; i++)
+				x[(N-1) * S + i] = Storage::store(Policy::horizontal * value(i, N-2));
+		}
+
+		// The x-velocity is negated on the left and right of the simulation box. This is called in the diffusion /
+		// advection for the x-axis.
+		for(int j = std::max(first, 1); j < std::min(last, N - 1); j++) {
+			x[j * S] = Storage::store(Policy::vertical * value(1, j));
+			x[j * S + N-1] = Storage::store(Policy::vertical * value(N-2, j));
+		}
+
 		// Assign to the edges the average over itself and its both neighbors
-    	x[transform_coordinates(0, 0, N)] = 0.33f * (x[transform_coordinates(1, 0, N)]
-                                  + x[transform_coordinates(0, 1, N)]
-                                  + x[transform_coordinates(0, 0, N)]);
-    	x[transform_coordinates(0, N-1, N)] = 0.33f * (x[transform_coordinates(1, N-1, N)]
-                                  + x[transform_coordinates(0, N-2, N)]
-                                  + x[transform_coordinates(0, N-1, N)]);
-    	x[transform_coordinates(N-1, 0, N)] = 0.33f * (x[transform_coordinates(N-2, 0, N)]
-                                  + x[transform_coordinates(N-1, 1, N)]
-                                  + x[transform_coordinates(N-1, 0, N)]);
-    	x[transform_coordinates(N-1, N-1, N)] = 0.33f * (x[transform_coordinates(N-2, N-1, N)]
-                                  + x[transform_coordinates(N-1, N-2, N)]
-                                  + x[transform_coordinates(N-1, N-1, N)]);
-}
-
-// Viscous diffusion of the velocity field in x and y direction according to the Navier Stokes PDE
-void Physics::diffuse_velocity(int b, std::array<float, SIZE*SIZE>& velocity, std::array<float, SIZE*SIZE>& previous_velocity, float diffusion_coefficient, float dt, int number_of_iterations, int N) {
-	float a = dt * diffusion_coefficient * (N - 2) * (N - 2);
+		if (first == 0) {
+			x[0] = Storage::store(0.33f * (value(1, 0) + value(0, 1) + value(0, 0)));
+			x[N-1] = Storage::store(0.33f * (value(N-2, 0) + value(N-1, 1) + value(N-1, 0)));
+		}
+		if (last == N) {
+			x[(N-1) * S] = Storage::store(0.33f * (value(1, N-1) + value(0, N-2) + value(0, N-1)));
+			x[(N-1) * S + N-1] = Storage::store(0.33f * (value(N-2, N-1) + value(N-1, N-2) + value(N-1, N-1)));
+		}
+	}
+}
+
+void Physics::setBnd(Boundary b, Grid& x, int first, int last) {
+	if (b == Boundary::Periodic && (first != 0 || last != x.size()))
+		throw std::invalid_argument("periodic boundaries can only be set on the complete grid");
+	withStorage(x.precision(), [&](auto storage) {
+		withBoundary(b, [&](auto policy) {
+			withShape(x.size(), [&](auto shape) {
+				setBndWith<decltype(storage), decltype(policy), decltype(shape)>(x, first, last);
+			}, FixedSizes());
+		});
+	});
+}
+
+// Number of threads used by the red-black relaxation, the pool is kept alive between the calls
+void Physics::setThreads(int threads) {
+	if (threads <= 1)
+		_pool.reset();
+	else if (!_pool || _pool->threads() != threads)
+		_pool.reset(new ThreadPool(threads));
+}
+
+// Split the rows across the pool, or run them on the calling thread without one
+void Physics::parallelRows(int first, int last, const std::function<void(int, int)>& rows) {
+	if (_pool)
+		_pool->parallel_for(first, last, rows);
+	else
+		rows(first, last);
+}
+
+// Restrict the kernels to the active tiles, nullptr processes the complete grid
+void Physics::setActiveTiles(const ActiveTiles* tiles) {
+	_tiles = tiles;
+}
+
+// Call body(begin, end) for the interior elements of row j the kernels work on: the complete row, or with active
+// tiles every active span clipped to the interior
+template <typename Body>
+static void forEachSpan(const ActiveTiles* tiles, int N, int j, Body body) {
+	if (!tiles) {
+		body(1, N - 1);
+		return;
+	}
+	for (const TileSpan& span : tiles->spans(j)) {
+		int begin = std::max(span.begin, 1);
+		int end = std::min(span.end, N - 1);
+		if (begin < end)
+			body(begin, end);
+	}
+}
+
+// The residual of a cell at its Gauss Seidel update is proportional to the change it makes, (1 + 4a) times the change
+// for the diffusion and 4 times the change for the pressure. The solvers therefore only sum up the squares and the
+// maximum of the changes while they sweep, which costs no extra pass over the grid. The cells see different states of
+// their neighbours, so the sum overestimates the residual of the grid, see Physics::diffusionResidual.
+float Physics::relativeResidual(double residual_squares, float residual_max, double rhs_squares, float rhs_max) const {
+	double residual = _residual_norm == ResidualNorm::L2 ? std::sqrt(residual_squares) : residual_max;
+	double rhs = _residual_norm == ResidualNorm::L2 ? std::sqrt(rhs_squares) : rhs_max;
+	return static_cast<float>(rhs > 0 ? residual / rhs : residual);
+}
+
+// Dispatch to the relaxation scheme, both record the iterations used and the last residual
+void Physics::relax(Boundary b, Grid& x, Grid& x0, float a, int max_iterations) {
+	if (_relaxation == Relaxation::Spectral)
+		relaxSpectral(b, x, x0, a);
+	else if (_relaxation == Relaxation::RedBlack)
+		relaxRedBlack(b, x, x0, a, max_iterations);
+	else
+		relaxLexicographic(b, x, x0, a, max_iterations);
+}
+
+// The spectral solve is exact, it counts as one iteration without residual
+void Physics::relaxSpectral(Boundary b, Grid& x, Grid& x0, float a) {
+	if (b != Boundary::Periodic)
+		throw std::invalid_argument("the spectral diffusion needs a periodic domain");
+	_spectral.diffuse(x, x0, a, _pool.get());
+	_diffusion_iterations = 1;
+	_diffusion_residual = 0;
+}
+
+// Squares and maximum of the interior cells of the right hand side in one running sum
+template <typename Storage>
+static void rhsNorm(const ActiveTiles* tiles, const Grid& x0, double& rhs_squares, float& rhs_max) {
+	int N = x0.size();
+	rhs_squares = 0;
+	rhs_max = 0;
+	for (int j = 1; j < N - 1; j++) {
+		const typename Storage::Element* previous = x0.values<Storage>() + x0.index(0, j);
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				float value = Storage::load(previous[i]);
+				rhs_squares += static_cast<double>(value) * value;
+				rhs_max = std::max(rhs_max, std::fabs(value));
+			}
+		});
+	}
+}
+
+// One lexicographic sweep over the interior of a float solution
+template <typename S0, typename GridShape>
+static void lexicographicSweep(const ActiveTiles* tiles, Grid& x, const Grid& x0, float a, double& squares,
+		float& largest) {
+	int N = GridShape::size(x);
+	int S = GridShape::stride(x);
+	for (int j = 1; j < N - 1; j++) {
+		float* values = x.data() + j * S;
+		const typename S0::Element* previous = x0.values<S0>() + j * S;
+		float row_squares = 0;
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				float value = (S0::load(previous[i]) + a
+					*(values[i+1]
+						+values[i-1]
+						+values[i+S]
+						+values[i-S]
+					)) / (1 + 4 * a);
+				float change = value - values[i];
+				row_squares += change * change;
+				largest = std::max(largest, std::fabs(change));
+				values[i] = value;
+			}
+		});
+		squares += row_squares;
+	}
+}
+
+// The same sweep for a solution stored in reduced precision. The rows around the current one are converted to floats
+// in bulk, the row above keeps the values of this sweep. The change of a cell is measured after rounding to the
+// storage precision, so a cell the precision cannot move any more counts as converged.
+template <typename SX>
+static void lexicographicSweepConverted(const ActiveTiles* tiles, Grid& x, const Grid& x0, float a, double& squares,
+		float& largest) {
+	int N = x.size();
+	std::vector<float> rows(4 * N);
+	float* above = rows.data();
+	float* row = above + N;
+	float* below = row + N;
+	float* previous = below + N;
+	x.load(x.index(0, 0), N, row);
+	x.load(x.index(0, 1), N, below);
+	for (int j = 1; j < N - 1; j++) {
+		std::swap(above, row);
+		std::swap(row, below);
+		x.load(x.index(0, j + 1), N, below);
+		x0.load(x0.index(0, j), N, previous);
+		typename SX::Element* values = x.values<SX>() + x.index(0, j);
+		float row_squares = 0;
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				float value = (previous[i] + a
+					*(row[i+1]
+						+row[i-1]
+						+below[i]
+						+above[i]
+					)) / (1 + 4 * a);
+				typename SX::Element stored = SX::store(value);
+				float rounded = SX::load(stored);
+				float change = rounded - row[i];
+				row_squares += change * change;
+				largest = std::max(largest, std::fabs(change));
+				row[i] = rounded;
+				values[i] = stored;
+			}
+		});
+		squares += row_squares;
+	}
+}
+
+// Lexicographic Gauss Seidel, every cell uses the cells before it in the same iteration
+void Physics::relaxLexicographic(Boundary b, Grid& x, Grid& x0, float a, int max_iterations) {
+	double rhs_squares = 0;
+	float rhs_max = 0;
+	withStorage(x0.precision(), [&](auto storage) {
+		rhsNorm<decltype(storage)>(_tiles, x0, rhs_squares, rhs_max);
+	});
+
+	_diffusion_iterations = 0;
+	_diffusion_residual = 0;
 	// For the sake of inmproved speed, keep number of iterations low
-	for (int k = 0; k < number_of_iterations; k++) {
-		// Solve the implicit discretization of the density with the Gauss Seidel Solver
-		for (int j = 1; j < N - 1; j++) {
-				for (int i = 1; i < N - 1; i++) {
-						velocity[transform_coordinates(i, j, N)] = (previous_velocity[transform_coordinates(i, j, N)] + a 
-							*(velocity[transform_coordinates(i+1, j, N)]
-								+velocity[transform_coordinates(i-1, j, N)]
-								+velocity[transform_coordinates(i, j+1, N)]
-								+velocity[transform_coordinates(i, j-1, N)]
-							)) / (1 + 4 * a);
-				}
+	for (int k = 0; k < max_iterations; k++) {
+		double squares = 0;
+		float largest = 0;
+		// Solve the implicit discretization with the Gauss Seidel Solver
+		withStorage(x.precision(), [&](auto x_storage) {
+			typedef decltype(x_storage) SX;
+			if constexpr (std::is_same<SX, FloatStorage>::value) {
+				withStorage(x0.precision(), [&](auto x0_storage) {
+					withShape(x.size(), [&](auto shape) {
+						lexicographicSweep<decltype(x0_storage), decltype(shape)>(_tiles, x, x0, a, squares, largest);
+					}, FixedSizes());
+				});
+			} else {
+				lexicographicSweepConverted<SX>(_tiles, x, x0, a, squares, largest);
+			}
+		});
+		// Set the boundary conditions for the field
+		setBnd(b, x);
+
+		float c = 1 + 4 * a;
+		_diffusion_iterations = k + 1;
+		_diffusion_residual = relativeResidual(squares * c * c, largest * c, rhs_squares, rhs_max);
+		if (_diffusion_tolerance > 0 && _diffusion_residual <= _diffusion_tolerance)
+			break;
+	}
+}
+
+// Sum of squares and maximum of the absolute values of the interior cells of every row in [first, last)
+template <typename Storage>
+static void normRowsWith(const ActiveTiles* tiles, const Grid& x, int first, int last, double* row_squares,
+		float* row_max) {
+	int N = x.size();
+	for (int j = first; j < last; j++) {
+		const typename Storage::Element* values = x.values<Storage>() + x.index(0, j);
+		double squares = 0;
+		float largest = 0;
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				float value = Storage::load(values[i]);
+				squares += static_cast<double>(value) * value;
+				largest = std::max(largest, std::fabs(value));
+			}
+		});
+		row_squares[j] = squares;
+		row_max[j] = largest;
+	}
+}
+
+void Physics::normRows(const Grid& x, int first, int last, double* row_squares, float* row_max) const {
+	withStorage(x.precision(), [&](auto storage) {
+		normRowsWith<decltype(storage)>(_tiles, x, first, last, row_squares, row_max);
+	});
+}
+
+// One colour of a red-black sweep over the rows [first, last) of a float solution. Cells of one colour only read
+// cells of the other one.
+template <typename S0, typename GridShape>
+static void relaxRowsWith(const ActiveTiles* tiles, Grid& x, const Grid& x0, float a, int colour, int first, int last,
+		double* row_squares, float* row_max) {
+	int N = GridShape::size(x);
+	int S = GridShape::stride(x);
+	float c = 1 + 4 * a;
+	float* values = x.data();
+	const typename S0::Element* previous = x0.values<S0>();
+	for (int j = first; j < last; j++) {
+		float squares = 0;
+		float largest = 0;
+		// The cells of this colour are the ones with i of the parity of 1 + j + colour
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin + (1 + j + colour + begin) % 2; i < end; i += 2) {
+				int index = j * S + i;
+				float value = (S0::load(previous[index]) + a
+					*(values[index + 1]
+						+values[index - 1]
+						+values[index + S]
+						+values[index - S]
+					)) / c;
+				float change = value - values[index];
+				squares += change * change;
+				largest = std::max(largest, std::fabs(change));
+				values[index] = value;
+			}
+		});
+		row_squares[j] += squares;
+		row_max[j] = std::max(row_max[j], largest);
+	}
+}
+
+// relaxRowsWith for a solution stored in reduced precision. The neighbours are converted one cell at a time: the
+// same colour cells of the rows next to this one belong to other threads, which write them during this pass.
+template <typename SX, typename S0>
+static void relaxRowsConverted(const ActiveTiles* tiles, Grid& x, const Grid& x0, float a, int colour, int first,
+		int last, double* row_squares, float* row_max) {
+	int N = x.size();
+	int S = x.stride();
+	float c = 1 + 4 * a;
+	typename SX::Element* values = x.values<SX>();
+	const typename S0::Element* previous = x0.values<S0>();
+	for (int j = first; j < last; j++) {
+		float squares = 0;
+		float largest = 0;
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin + (1 + j + colour + begin) % 2; i < end; i += 2) {
+				int index = j * S + i;
+				float value = (S0::load(previous[index]) + a
+					*(SX::load(values[index + 1])
+						+SX::load(values[index - 1])
+						+SX::load(values[index + S])
+						+SX::load(values[index - S])
+					)) / c;
+				typename SX::Element stored = SX::store(value);
+				float change = SX::load(stored) - SX::load(values[index]);
+				squares += change * change;
+				largest = std::max(largest, std::fabs(change));
+				values[index] = stored;
+			}
+		});
+		row_squares[j] += squares;
+		row_max[j] = std::max(row_max[j], largest);
+	}
+}
+
+void Physics::relaxRows(Grid& x, const Grid& x0, float a, int colour, int first, int last, double* row_squares,
+		float* row_max) const {
+	withStorage(x.precision(), [&](auto x_storage) {
+		typedef decltype(x_storage) SX;
+		if constexpr (std::is_same<SX, FloatStorage>::value) {
+			withStorage(x0.precision(), [&](auto x0_storage) {
+				withShape(x.size(), [&](auto shape) {
+					relaxRowsWith<decltype(x0_storage), decltype(shape)>(_tiles, x, x0, a, colour, first, last,
+						row_squares, row_max);
+				}, FixedSizes());
+			});
+		} else {
+			withStorage(x0.precision(), [&](auto x0_storage) {
+				relaxRowsConverted<SX, decltype(x0_storage)>(_tiles, x, x0, a, colour, first, last, row_squares,
+					row_max);
+			});
 		}
-		// Set the boundary conditions for the velocities.
-		setBnd(b, velocity, N);
+	});
+}
+
+// Sum the rows in order, so the result does not depend on how the rows were split
+static void sumRows(const std::vector<double>& row_squares, const std::vector<float>& row_max, double& squares,
+		float& largest) {
+	squares = 0;
+	largest = 0;
+	for (std::size_t j = 0; j < row_squares.size(); j++) {
+		squares += row_squares[j];
+		largest = std::max(largest, row_max[j]);
 	}
 }
 
-// Diffuse the smoke density according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-void Physics::diffuse_density(int b, std::array<float, SIZE*SIZE>& density, std::array<float, SIZE*SIZE>& previous_density, float diffusion_coefficient, float dt, int number_of_iterations, int N) {
+// Red-black Gauss Seidel: first all cells with odd i + j (colour 0), then all cells with even i + j.
+// Cells of one colour only read cells of the other colour, so the rows can be updated in parallel.
+// The changes are summed up per row and the rows are added in order, so the residual and the number of iterations do
+// not depend on the number of threads.
+void Physics::relaxRedBlack(Boundary b, Grid& x, Grid& x0, float a, int max_iterations) {
+	int N = x.size();
+	float c = 1 + 4 * a;
+
+	std::vector<double> row_squares(N);
+	std::vector<float> row_max(N);
+	double rhs_squares;
+	float rhs_max;
+	parallelRows(1, N - 1, [&](int first, int last) {
+		normRows(x0, first, last, row_squares.data(), row_max.data());
+	});
+	sumRows(row_squares, row_max, rhs_squares, rhs_max);
+
+	_diffusion_iterations = 0;
+	_diffusion_residual = 0;
+	for (int k = 0; k < max_iterations; k++) {
+		std::fill(row_squares.begin(), row_squares.end(), 0.0);
+		std::fill(row_max.begin(), row_max.end(), 0.0f);
+		for (int colour = 0; colour < 2; colour++) {
+			parallelRows(1, N - 1, [&](int first, int last) {
+				relaxRows(x, x0, a, colour, first, last, row_squares.data(), row_max.data());
+			});
+		}
+		// Set the boundary conditions once both colours are updated
+		setBnd(b, x);
+
+		double squares;
+		float largest;
+		sumRows(row_squares, row_max, squares, largest);
+		_diffusion_iterations = k + 1;
+		_diffusion_residual = relativeResidual(squares * c * c, largest * c, rhs_squares, rhs_max);
+		if (_diffusion_tolerance > 0 && _diffusion_residual <= _diffusion_tolerance)
+			break;
+	}
+}
+
+// Viscous diffusion of a velocity component or diffusion of the smoke density, only the coefficient and the boundary
+// differ between the fields
+void Physics::diffuse(Boundary b, Grid& x, Grid& x0, float diffusion_coefficient, float dt, int number_of_iterations) {
+	int N = x.size();
 	float a = dt * diffusion_coefficient * (N - 2) * (N - 2);
-	// For the sake of inmproved speed, keep number of iterations low
-	for (int k = 0; k < number_of_iterations; k++) {
-		// Solve the implicit discretization of the density with the Gauss Seidel Solver
-		for (int j = 1; j < N - 1; j++) {
-				for (int i = 1; i < N - 1; i++) {
-						density[transform_coordinates(i, j, N)] = (previous_density[transform_coordinates(i, j, N)] + a 
-							*(density[transform_coordinates(i+1, j, N)]
-								+density[transform_coordinates(i-1, j, N)]
-								+density[transform_coordinates(i, j+1, N)]
-								+density[transform_coordinates(i, j-1, N)]
-							)) / (1 + 4 * a);
-				}
+	relax(domainBoundary(_domain, b), x, x0, a, number_of_iterations);
+}
+
+// Number of fields Physics::advect interpolates in one pass
+static const int MAX_ADVECTED_FIELDS = 4;
+
+// Interval the backtrace is clamped to. In a closed box [0.5, N - 1.5], so the interpolation stencil always lies
+// inside the grid and no further clamping of the indices is needed. In a periodic domain the backtrace is first
+// wrapped into [1, N - 1) (the interior cells, see wrap) and may then interpolate between the last interior column
+// and the ghost column, which holds the first interior column.
+template <bool Wrap>
+static float highestBacktrace(int N) {
+	return Wrap ? std::nextafter(N - 1.0f, 0.0f) : N - 1.5f;
+}
+
+// Move a position of a periodic domain into [1, N - 1), n = N - 2 is the period
+static inline float wrap(float x, float n) {
+	return x - n * std::floor((x - 1) / n);
+}
+
+// Bilinear interpolation of all fields at the backtraced positions of the cells [i, end) of row j
+template <bool Wrap>
+static int advectScalar(AdvectedField* fields, int count, const float* vx, const float* vy,
+		float dtx, float dty, int N, int S, int j, int i, int end) {
+	const float low = 0.5f;
+	const float high = highestBacktrace<Wrap>(N);
+	const float n = N - 2;
+	for (; i < end; i++) {
+		int index = j * S + i;
+		float x = i - dtx * vx[index];
+		float y = j - dty * vy[index];
+		if constexpr (Wrap) {
+			x = wrap(x, n);
+			y = wrap(y, n);
+		}
+		x = std::min(std::max(x, low), high);
+		y = std::min(std::max(y, low), high);
+
+		// The positions are positive, so truncation is the same as floorf
+		int i0 = static_cast<int>(x);
+		int j0 = static_cast<int>(y);
+		float s1 = x - i0;
+		float s0 = 1.0f - s1;
+		float t1 = y - j0;
+		float t0 = 1.0f - t1;
+
+		int source = j0 * S + i0;
+		for (int f = 0; f < count; f++) {
+			const float* d0 = fields[f].d0.data();
+			fields[f].d.data()[index] =
+				s0 * (t0 * d0[source] + t1 * d0[source + S]) +
+				s1 * (t0 * d0[source + 1] + t1 * d0[source + S + 1]);
 		}
-		// Set the boundary conditions for the velocities.
-		setBnd(b, density, N);
 	}
+	return i;
 }
 
-// Self-Advection of the velocity in x and y direction according to the Navier Stokes PDE
-// Self-Advection is the movement of the velocity field along itself
-void Physics::advect_velocity(int b, std::array<float, SIZE*SIZE>& velocity, std::array<float, SIZE*SIZE>& previous_velocity, std::array<float, SIZE*SIZE>& previous_velocity_x, std::array<float, SIZE*SIZE>& previous_velocity_y, float dt, int N) {
-// Interpolation coordinates
-	float i0, i1, j0, j1;
-    
+// advectScalar for fields and velocities stored in any precision, every value is converted when it is loaded and stored
+template <bool Wrap>
+static int advectConverted(AdvectedField* fields, int count, const Grid& vx, const Grid& vy,
+		float dtx, float dty, int N, int S, int j, int i, int end) {
+	const float low = 0.5f;
+	const float high = highestBacktrace<Wrap>(N);
+	const float n = N - 2;
+	for (; i < end; i++) {
+		int index = j * S + i;
+		float x = i - dtx * vx.load(index);
+		float y = j - dty * vy.load(index);
+		if constexpr (Wrap) {
+			x = wrap(x, n);
+			y = wrap(y, n);
+		}
+		x = std::min(std::max(x, low), high);
+		y = std::min(std::max(y, low), high);
+
+		int i0 = static_cast<int>(x);
+		int j0 = static_cast<int>(y);
+		float s1 = x - i0;
+		float s0 = 1.0f - s1;
+		float t1 = y - j0;
+		float t0 = 1.0f - t1;
+
+		int source = j0 * S + i0;
+		for (int f = 0; f < count; f++) {
+			const Grid& d0 = fields[f].d0;
+			fields[f].d.store(index,
+				s0 * (t0 * d0.load(source) + t1 * d0.load(source + S)) +
+				s1 * (t0 * d0.load(source + 1) + t1 * d0.load(source + S + 1)));
+		}
+	}
+	return i;
+}
+
+#if defined(__AVX512F__)
+// Loads, gathers and stores of 16 values of a field in any precision. The 16 bit gathers read 32 bits at the address of
+// every element and keep the lower half, GridArena::layoutBytes leaves room for the element after the last one.
+static inline __m512 load16(const Grid& grid, int index) {
+	switch (grid.precision()) {
+		case Precision::Half:
+			return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(grid.values<HalfStorage>() + index)));
+		case Precision::BFloat16:
+			return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(grid.values<BFloat16Storage>() + index))), 16));
+		default:
+			return _mm512_loadu_ps(grid.data() + index);
+	}
+}
+
+static inline __m512 gather16(const Grid& grid, __m512i indices) {
+	switch (grid.precision()) {
+		case Precision::Half:
+			return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(_mm512_i32gather_epi32(indices, grid.values<HalfStorage>(), 2)));
+		case Precision::BFloat16:
+			return _mm512_castsi512_ps(_mm512_slli_epi32(
+				_mm512_i32gather_epi32(indices, grid.values<BFloat16Storage>(), 2), 16));
+		default:
+			return _mm512_i32gather_ps(indices, grid.data(), 4);
+	}
+}
+
+// Round to the nearest bfloat16 (ties to even) like floatToBFloat16
+static inline void store16(Grid& grid, int index, __m512 values) {
+	switch (grid.precision()) {
+		case Precision::Half:
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(grid.values<HalfStorage>() + index),
+				_mm512_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+			break;
+		case Precision::BFloat16: {
+			__m512i bits = _mm512_castps_si512(values);
+			__m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+			bits = _mm512_add_epi32(bits, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(grid.values<BFloat16Storage>() + index),
+				_mm512_cvtepi32_epi16(_mm512_srli_epi32(bits, 16)));
+			break;
+		}
+		default:
+			_mm512_storeu_ps(grid.data() + index, values);
+	}
+}
+
+// Same as advectScalar for 16 cells at once, returns the first cell that is left for the scalar loop
+template <bool Wrap>
+static int advectVector(AdvectedField* fields, int count, const Grid& vx, const Grid& vy,
+		float dtx, float dty, int N, int S, int j, int i, int end) {
+	const __m512 low = _mm512_set1_ps(0.5f);
+	const __m512 high = _mm512_set1_ps(highestBacktrace<Wrap>(N));
+	const __m512 period = _mm512_set1_ps(N - 2.0f);
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 offsets = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512i row = _mm512_set1_epi32(S);
+	const __m512 y_cell = _mm512_set1_ps(static_cast<float>(j));
+	for (; i + 16 <= end; i += 16) {
+		int index = j * S + i;
+		__m512 x = _mm512_sub_ps(_mm512_add_ps(_mm512_set1_ps(static_cast<float>(i)), offsets),
+			_mm512_mul_ps(_mm512_set1_ps(dtx), load16(vx, index)));
+		__m512 y = _mm512_sub_ps(y_cell, _mm512_mul_ps(_mm512_set1_ps(dty), load16(vy, index)));
+		if constexpr (Wrap) {
+			const int floor = _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC;
+			x = _mm512_sub_ps(x, _mm512_mul_ps(period, _mm512_roundscale_ps(_mm512_div_ps(_mm512_sub_ps(x, one), period), floor)));
+			y = _mm512_sub_ps(y, _mm512_mul_ps(period, _mm512_roundscale_ps(_mm512_div_ps(_mm512_sub_ps(y, one), period), floor)));
+		}
+		x = _mm512_min_ps(_mm512_max_ps(x, low), high);
+		y = _mm512_min_ps(_mm512_max_ps(y, low), high);
+
+		__m512i i0 = _mm512_cvttps_epi32(x);
+		__m512i j0 = _mm512_cvttps_epi32(y);
+		__m512 s1 = _mm512_sub_ps(x, _mm512_cvtepi32_ps(i0));
+		__m512 s0 = _mm512_sub_ps(one, s1);
+		__m512 t1 = _mm512_sub_ps(y, _mm512_cvtepi32_ps(j0));
+		__m512 t0 = _mm512_sub_ps(one, t1);
+
+		__m512i source = _mm512_add_epi32(_mm512_mullo_epi32(j0, row), i0);
+		__m512i below = _mm512_add_epi32(source, row);
+		for (int f = 0; f < count; f++) {
+			const Grid& d0 = fields[f].d0;
+			__m512 a = gather16(d0, source);
+			__m512 b = gather16(d0, _mm512_add_epi32(source, _mm512_set1_epi32(1)));
+			__m512 c = gather16(d0, below);
+			__m512 d = gather16(d0, _mm512_add_epi32(below, _mm512_set1_epi32(1)));
+			__m512 left = _mm512_add_ps(_mm512_mul_ps(t0, a), _mm512_mul_ps(t1, c));
+			__m512 right = _mm512_add_ps(_mm512_mul_ps(t0, b), _mm512_mul_ps(t1, d));
+			store16(fields[f].d, index, _mm512_add_ps(_mm512_mul_ps(s0, left), _mm512_mul_ps(s1, right)));
+		}
+	}
+	return i;
+}
+#elif defined(__AVX2__)
+// Loads, gathers and stores of 8 values of a field in any precision, see load16
+static inline __m256 load8(const Grid& grid, int index) {
+	switch (grid.precision()) {
+		case Precision::Half: {
+#if defined(__F16C__)
+			return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(grid.values<HalfStorage>() + index)));
+#else
+			float values[8];
+			grid.load(index, 8, values);
+			return _mm256_loadu_ps(values);
+#endif
+		}
+		case Precision::BFloat16:
+			return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(grid.values<BFloat16Storage>() + index))), 16));
+		default:
+			return _mm256_loadu_ps(grid.data() + index);
+	}
+}
+
+static inline __m256 gather8(const Grid& grid, __m256i indices) {
+	switch (grid.precision()) {
+		case Precision::Half: {
+			__m256i words = _mm256_and_si256(_mm256_i32gather_epi32(
+				reinterpret_cast<const int*>(grid.values<HalfStorage>()), indices, 2), _mm256_set1_epi32(0xffff));
+			__m128i halves = _mm_packus_epi32(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+#if defined(__F16C__)
+			return _mm256_cvtph_ps(halves);
+#else
+			std::uint16_t packed[8];
+			float values[8];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(packed), halves);
+			halvesToFloats(packed, values, 8);
+			return _mm256_loadu_ps(values);
+#endif
+		}
+		case Precision::BFloat16:
+			return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_i32gather_epi32(
+				reinterpret_cast<const int*>(grid.values<BFloat16Storage>()), indices, 2), 16));
+		default:
+			return _mm256_i32gather_ps(grid.data(), indices, 4);
+	}
+}
+
+static inline void store8(Grid& grid, int index, __m256 values) {
+	switch (grid.precision()) {
+		case Precision::Half: {
+#if defined(__F16C__)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(grid.values<HalfStorage>() + index),
+				_mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+#else
+			float unpacked[8];
+			_mm256_storeu_ps(unpacked, values);
+			grid.store(index, 8, unpacked);
+#endif
+			break;
+		}
+		case Precision::BFloat16: {
+			__m256i bits = _mm256_castps_si256(values);
+			__m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+			bits = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff))), 16);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(grid.values<BFloat16Storage>() + index),
+				_mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1)));
+			break;
+		}
+		default:
+			_mm256_storeu_ps(grid.data() + index, values);
+	}
+}
+
+// Same as advectScalar for 8 cells at once, returns the first cell that is left for the scalar loop
+template <bool Wrap>
+static int advectVector(AdvectedField* fields, int count, const Grid& vx, const Grid& vy,
+		float dtx, float dty, int N, int S, int j, int i, int end) {
+	const __m256 low = _mm256_set1_ps(0.5f);
+	const __m256 high = _mm256_set1_ps(highestBacktrace<Wrap>(N));
+	const __m256 period = _mm256_set1_ps(N - 2.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 offsets = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i row = _mm256_set1_epi32(S);
+	const __m256 y_cell = _mm256_set1_ps(static_cast<float>(j));
+	for (; i + 8 <= end; i += 8) {
+		int index = j * S + i;
+		__m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), offsets),
+			_mm256_mul_ps(_mm256_set1_ps(dtx), load8(vx, index)));
+		__m256 y = _mm256_sub_ps(y_cell, _mm256_mul_ps(_mm256_set1_ps(dty), load8(vy, index)));
+		if constexpr (Wrap) {
+			x = _mm256_sub_ps(x, _mm256_mul_ps(period, _mm256_floor_ps(_mm256_div_ps(_mm256_sub_ps(x, one), period))));
+			y = _mm256_sub_ps(y, _mm256_mul_ps(period, _mm256_floor_ps(_mm256_div_ps(_mm256_sub_ps(y, one), period))));
+		}
+		x = _mm256_min_ps(_mm256_max_ps(x, low), high);
+		y = _mm256_min_ps(_mm256_max_ps(y, low), high);
+
+		__m256i i0 = _mm256_cvttps_epi32(x);
+		__m256i j0 = _mm256_cvttps_epi32(y);
+		__m256 s1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i0));
+		__m256 s0 = _mm256_sub_ps(one, s1);
+		__m256 t1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(j0));
+		__m256 t0 = _mm256_sub_ps(one, t1);
+
+		__m256i source = _mm256_add_epi32(_mm256_mullo_epi32(j0, row), i0);
+		__m256i below = _mm256_add_epi32(source, row);
+		for (int f = 0; f < count; f++) {
+			const Grid& d0 = fields[f].d0;
+			__m256 a = gather8(d0, source);
+			__m256 b = gather8(d0, _mm256_add_epi32(source, _mm256_set1_epi32(1)));
+			__m256 c = gather8(d0, below);
+			__m256 d = gather8(d0, _mm256_add_epi32(below, _mm256_set1_epi32(1)));
+			__m256 left = _mm256_add_ps(_mm256_mul_ps(t0, a), _mm256_mul_ps(t1, c));
+			__m256 right = _mm256_add_ps(_mm256_mul_ps(t0, b), _mm256_mul_ps(t1, d));
+			store8(fields[f].d, index, _mm256_add_ps(_mm256_mul_ps(s0, left), _mm256_mul_ps(s1, right)));
+		}
+	}
+	return i;
+}
+#endif
+
+// Interpolate the fields at the backtraced positions of the interior cells of the rows [first, last)
+void Physics::advectRows(AdvectedField* fields, int count, const Grid& vx, const Grid& vy, float dt, int first,
+		int last) const {
+	int N = vx.size();
+	int S = vx.stride();
+
 	// Calculate the time step size in x and y directions
 	float dtx = dt * (N - 2);
 	float dty = dt * (N - 2);
 
-	// Interpolation weights
-	float s0, s1, t0, t1;
-
-	// Temporary variables
-	float tmp1, tmp2, x, y;
+	// The scalar loop only converts if one of the fields is stored in reduced precision
+	bool converted = vx.precision() != Precision::Float || vy.precision() != Precision::Float;
+	for (int f = 0; f < count; f++)
+		converted = converted || fields[f].d.precision() != Precision::Float || fields[f].d0.precision() != Precision::Float;
 
-	// Convert integer N, i and j to float for calculations purpose
-	float Nfloat = N;
-    
-	for(int j = 1; j < N - 1; j++) { 
-		for(int i = 1; i < N - 1; i++) {
-				// Calculate the interpolated in x and y position
-				x = i - dtx * previous_velocity_x[transform_coordinates(i, j, N)];
-				y = j -  dty * previous_velocity_y[transform_coordinates(i, j, N)];
-			
-				// Check if interpoland is within grid boundaries
-				if(x < 0.5f) x = 0.5f; 
-				if(x > Nfloat + 0.5f) x = Nfloat + 0.5f; 
-				i0 = ::floorf(x); 
-				i1 = i0 + 1.0f;
-				if(y < 0.5f) y = 0.5f; 
-				if(y > Nfloat + 0.5f) y = Nfloat + 0.5f; 
-				j0 = ::floorf(y);
-				j1 = j0 + 1.0f; 
-
-	            // Calculate the interpolation weights
-				s1 = x - i0; 
-				s0 = 1.0f - s1; 
-				t1 = y - j0; 
-				t0 = 1.0f - t1;
-			
-				// Convert the interpolated positions to integer indices
-				int i0i = i0;
-				int i1i = i1;
-				int j0i = j0;
-				int j1i = j1;
-			
-			// Update the density according to interpolation
-			velocity[transform_coordinates(i, j, N)] = 
-				s0 * (t0 * previous_velocity[transform_coordinates(i0i, j0i, N)] + t1 * previous_velocity[transform_coordinates(i0i, j1i, N)]) +
-				s1 * (t0 * previous_velocity[transform_coordinates(i1i, j0i, N)] + t1 * previous_velocity[transform_coordinates(i1i, j1i, N)]);
+	// The kernels are instantiated with and without the periodic wrap of the backtrace
+	auto rows = [&](auto periodic) {
+		constexpr bool Wrap = decltype(periodic)::value;
+		for (int j = first; j < last; j++) {
+			forEachSpan(_tiles, N, j, [&](int begin, int end) {
+				int i = begin;
+#if defined(__AVX512F__) || defined(__AVX2__)
+				i = advectVector<Wrap>(fields, count, vx, vy, dtx, dty, N, S, j, i, end);
+#endif
+				if (converted)
+					advectConverted<Wrap>(fields, count, vx, vy, dtx, dty, N, S, j, i, end);
+				else
+					advectScalar<Wrap>(fields, count, vx.data(), vy.data(), dtx, dty, N, S, j, i, end);
+			});
 		}
+	};
+	if (_domain == Domain::Periodic)
+		rows(std::true_type());
+	else
+		rows(std::false_type());
+}
+
+// Semi-Lagrangian advection of several fields along the same velocity field.
+// The backtrace is computed once per cell and all fields are interpolated in the same pass.
+void Physics::advect(std::initializer_list<AdvectedField> fields, Grid& vx, Grid& vy, float dt) {
+	int N = vx.size();
+	int count = static_cast<int>(fields.size());
+	if (count > MAX_ADVECTED_FIELDS)
+		throw std::invalid_argument("Physics::advect moves at most four fields at once");
+	AdvectedField list[MAX_ADVECTED_FIELDS];
+	std::copy(fields.begin(), fields.end(), list);
+
+	if (_advection != AdvectionScheme::SemiLagrangian) {
+		advectCorrected(list, count, vx, vy, dt);
+		return;
 	}
-	setBnd(b, velocity, N);
+
+	parallelRows(1, N - 1, [&](int first, int last) {
+		advectRows(list, count, vx, vy, dt, first, last);
+	});
+
+	for (int f = 0; f < count; f++)
+		setBnd(domainBoundary(_domain, list[f].b), list[f].d);
 }
 
-// Advection of the smoke in the velocity field according to the smoke density PDE (see Jos Stam, Figure 1, equation 2)
-void Physics::advect_density(int b, std::array<float, SIZE*SIZE>& density, std::array<float, SIZE*SIZE>& previous_density, std::array<float, SIZE*SIZE>& velocity_x, std::array<float, SIZE*SIZE>& velocity_y, float dt, int N) {
-	// Interpolation coordinates
-	float i0, i1, j0, j1;
-    
-	// Calculate the time step size in x and y directions
+// Source of the last BFECC pass: d0 + (d0 - backward) / 2, written into backward
+static void correctSourceRows(Grid& backward, const Grid& d0, int first, int last) {
+	int N = d0.size();
+	std::vector<float> row(N);
+	for (int j = first; j < last; j++) {
+		d0.load(d0.index(0, j), N, row.data());
+		float* values = backward.data() + backward.index(0, j);
+		for (int i = 1; i < N - 1; i++)
+			values[i] = row[i] + 0.5f * (row[i] - values[i]);
+	}
+}
+
+// Limiter of the corrected schemes: the backtrace of every cell is computed once more like in advectScalar, and the
+// new value is clamped to the four values of d0 the first order scheme interpolates. With forward and backward
+// (MacCormack) the new value is forward + (d0 - backward) / 2, otherwise the value already in d (BFECC).
+template <typename SD, typename S0, bool Wrap>
+static void limitRows(const ActiveTiles* tiles, Grid& d, const Grid& d0, const Grid* forward, const Grid* backward,
+		const Grid& vx, const Grid& vy, float dt, int first, int last) {
+	int N = d.size();
+	int S = d.stride();
 	float dtx = dt * (N - 2);
 	float dty = dt * (N - 2);
+	const float low = 0.5f;
+	const float high = highestBacktrace<Wrap>(N);
+	const float n = N - 2;
+	typename SD::Element* values = d.values<SD>();
+	const typename S0::Element* source = d0.values<S0>();
+	std::vector<float> u(N);
+	std::vector<float> v(N);
+	for (int j = first; j < last; j++) {
+		vx.load(vx.index(0, j), N, u.data());
+		vy.load(vy.index(0, j), N, v.data());
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				int index = j * S + i;
+				float x = i - dtx * u[i];
+				float y = j - dty * v[i];
+				if constexpr (Wrap) {
+					x = wrap(x, n);
+					y = wrap(y, n);
+				}
+				x = std::min(std::max(x, low), high);
+				y = std::min(std::max(y, low), high);
+
+				int corner = static_cast<int>(y) * S + static_cast<int>(x);
+				float a = S0::load(source[corner]);
+				float b = S0::load(source[corner + 1]);
+				float c = S0::load(source[corner + S]);
+				float e = S0::load(source[corner + S + 1]);
+				float smallest = std::min(std::min(a, b), std::min(c, e));
+				float largest = std::max(std::max(a, b), std::max(c, e));
 
-	// Interpolation weights
-	float s0, s1, t0, t1;
+				float value = forward
+					? forward->data()[index] + 0.5f * (S0::load(source[index]) - backward->data()[index])
+					: SD::load(values[index]);
+				values[index] = SD::store(std::min(std::max(value, smallest), largest));
+			}
+		});
+	}
+}
 
-	// Temporary variables
-	float tmp1, tmp2, x, y;
+// Only the flags of the tiles are scanned and only the tiles that turned inactive are cleared, so the cost follows the
+// active area. A pass without tiles may have written everywhere.
+void Physics::clearAdvectionFields() {
+	int N = _advection_fields->size();
+	int tiles = (N + ActiveTiles::TILE - 1) / ActiveTiles::TILE;
+	if (static_cast<int>(_advection_written.size()) != tiles * tiles)
+		_advection_written.assign(tiles * tiles, 0);
+	if (!_tiles) {
+		std::fill(_advection_written.begin(), _advection_written.end(), 1);
+		return;
+	}
 
-	// Convert integer N, i and j to float for calculations purpose
-	float Nfloat = N;
-    
-	for(int j = 1; j < N - 1; j++) { 
-		for(int i = 1; i < N - 1; i++) {
-				// Calculate the interpolated in x and y position
-				x = i - dtx * velocity_x[transform_coordinates(i, j, N)];
-				y = j-  dty * velocity_y[transform_coordinates(i, j, N)];
-			
-				// Check if interpoland is within grid boundaries
-				if(x < 0.5f) x = 0.5f; 
-				if(x > Nfloat + 0.5f) x = Nfloat + 0.5f; 
-				i0 = ::floorf(x); 
-				i1 = i0 + 1.0f;
-				if(y < 0.5f) y = 0.5f; 
-				if(y > Nfloat + 0.5f) y = Nfloat + 0.5f; 
-				j0 = ::floorf(y);
-				j1 = j0 + 1.0f; 
-
-	            // Calculate the interpolation weights
-				s1 = x - i0; 
-				s0 = 1.0f - s1; 
-				t1 = y - j0; 
-				t0 = 1.0f - t1;
-			
-				// Convert the interpolated positions to integer indices
-				int i0i = i0;
-				int i1i = i1;
-				int j0i = j0;
-				int j1i = j1;
-			
-			// Update the density according to interpolation
-			density[transform_coordinates(i, j, N)] = 
-				s0 * (t0 * previous_density[transform_coordinates(i0i, j0i, N)] + t1 * previous_density[transform_coordinates(i0i, j1i, N)]) +
-				s1 * (t0 * previous_density[transform_coordinates(i1i, j0i, N)] + t1 * previous_density[transform_coordinates(i1i, j1i, N)]);
+	for (int ty = 0; ty < tiles; ty++) {
+		for (int tx = 0; tx < tiles; tx++) {
+			unsigned char& written = _advection_written[ty * tiles + tx];
+			if (_tiles->active(tx, ty)) {
+				written = 1;
+				continue;
+			}
+			if (!written)
+				continue;
+			int x0 = tx * ActiveTiles::TILE;
+			int count = std::min(ActiveTiles::TILE, N - x0);
+			for (int field = 0; field < _advection_fields->fields(); field++) {
+				Grid grid = _advection_fields->field(field);
+				for (int y = ty * ActiveTiles::TILE; y < std::min((ty + 1) * ActiveTiles::TILE, N); y++)
+					grid.zero(grid.index(x0, y), count);
+			}
+			written = 0;
 		}
 	}
-	setBnd(b, density, N);
 }
 
-// Force mass conservation and ensure that the velocity field remains divergence-free.
-void Physics::project(std::array<float, SIZE*SIZE>& vx, std::array<float, SIZE*SIZE>& vy, std::array<float, SIZE*SIZE>& p, std::array<float, SIZE*SIZE>& div, int N) {
-	
-	// Get the divergence via stencil matrix
-	float h = 1 / N;
-	for (int j = 1; j < N - 1; j++) {
+// Both schemes start with a forward pass into the first intermediate field and a backward pass (-dt) of its result
+// into the second one, the round trip error is d0 - backward. The intermediate fields get the boundary of their field
+// before the next pass reads them.
+void Physics::advectCorrected(AdvectedField* fields, int count, const Grid& vx, const Grid& vy, float dt) {
+	int N = vx.size();
+	if (!_advection_fields || _advection_fields->size() != N)
+		_advection_fields.reset(new GridArena(N, 2 * MAX_ADVECTED_FIELDS));
+
+	clearAdvectionFields();
+
+	AdvectedField forward[MAX_ADVECTED_FIELDS];
+	AdvectedField backward[MAX_ADVECTED_FIELDS];
+	for (int f = 0; f < count; f++) {
+		Grid ahead = _advection_fields->field(2 * f);
+		Grid back = _advection_fields->field(2 * f + 1);
+		forward[f] = {fields[f].b, ahead, fields[f].d0};
+		backward[f] = {fields[f].b, back, ahead};
+	}
+	auto boundaries = [&](AdvectedField* list) {
+		for (int f = 0; f < count; f++)
+			setBnd(domainBoundary(_domain, list[f].b), list[f].d);
+	};
+
+	parallelRows(1, N - 1, [&](int first, int last) {
+		advectRows(forward, count, vx, vy, dt, first, last);
+	});
+	boundaries(forward);
+	parallelRows(1, N - 1, [&](int first, int last) {
+		advectRows(backward, count, vx, vy, -dt, first, last);
+	});
+	boundaries(backward);
+
+	bool bfecc = _advection == AdvectionScheme::BFECC;
+	if (bfecc) {
+		AdvectedField corrected[MAX_ADVECTED_FIELDS];
+		for (int f = 0; f < count; f++) {
+			parallelRows(1, N - 1, [&](int first, int last) {
+				correctSourceRows(backward[f].d, fields[f].d0, first, last);
+			});
+			corrected[f] = {fields[f].b, fields[f].d, backward[f].d};
+		}
+		boundaries(backward);
+		parallelRows(1, N - 1, [&](int first, int last) {
+			advectRows(corrected, count, vx, vy, dt, first, last);
+		});
+	}
+
+	for (int f = 0; f < count; f++) {
+		const Grid* ahead = bfecc ? nullptr : &forward[f].d;
+		const Grid* back = bfecc ? nullptr : &backward[f].d;
+		withStorage(fields[f].d.precision(), [&](auto d_storage) {
+			withStorage(fields[f].d0.precision(), [&](auto d0_storage) {
+				auto limit = [&](auto periodic) {
+					parallelRows(1, N - 1, [&](int first, int last) {
+						limitRows<decltype(d_storage), decltype(d0_storage), decltype(periodic)::value>(_tiles,
+							fields[f].d, fields[f].d0, ahead, back, vx, vy, dt, first, last);
+					});
+				};
+				if (_domain == Domain::Periodic)
+					limit(std::true_type());
+				else
+					limit(std::false_type());
+			});
+		});
+	}
+
+	boundaries(fields);
+}
+
+// Divergence of the interior cells of the rows [first, last) and its norms per row, h is the width of one interior cell.
+// Also clears the pressure of these rows, unless the solve starts from the previous pressure.
+// The pressure and the divergence are always float, the velocity may be stored in any precision.
+template <typename SU, typename SV>
+static void divergenceRowsWith(bool warm_start, const Grid& vx, const Grid& vy, Grid& p, Grid& div, int first, int last,
+		double* row_squares, float* row_max) {
+	int N = vx.size();
+	int S = vx.stride();
+	float h = 1.0f / (N - 2);
+	for (int j = first; j < last; j++) {
+		const typename SU::Element* u = vx.values<SU>() + vx.index(0, j);
+		const typename SV::Element* v = vy.values<SV>() + vy.index(0, j);
+		float* d = &div[div.index(0, j)];
+		float* q = &p[p.index(0, j)];
+		double squares = 0;
+		float largest = 0;
 		for (int i = 1; i < N - 1; i++) {
-			div[transform_coordinates(i, j, N)] = -0.5f*h*(
-					vx[transform_coordinates(i+1, j, N)]
-					-vx[transform_coordinates(i-1, j, N)]
-					+vy[transform_coordinates(i, j+1, N)]
-					-vy[transform_coordinates(i, j-1, N)]
-				)/N;
+			d[i] = -0.5f*h*(
+					SU::load(u[i+1])
+					-SU::load(u[i-1])
+					+SV::load(v[i+S])
+					-SV::load(v[i-S])
+				);
+			squares += static_cast<double>(d[i]) * d[i];
+			largest = std::max(largest, std::fabs(d[i]));
 			
-			// Initialize the pressure array
-			p[transform_coordinates(i, j, N)] = 0;
+			// Initialize the pressure array, unless the solve starts from the previous pressure
+			if (!warm_start)
+				q[i] = 0;
 		}
+		row_squares[j] = squares;
+		row_max[j] = largest;
 	}
+}
 
-	// Set boundary condition for divergence
-	setBnd(0, div, N); 
-	// Reset boundary condition
-	setBnd(0, p, N);
+void Physics::divergenceRows(const Grid& vx, const Grid& vy, Grid& p, Grid& div, int first, int last,
+		double* row_squares, float* row_max) const {
+	withStorage(vx.precision(), [&](auto u_storage) {
+		withStorage(vy.precision(), [&](auto v_storage) {
+			divergenceRowsWith<decltype(u_storage), decltype(v_storage)>(_warm_start, vx, vy, p, div, first, last,
+				row_squares, row_max);
+		});
+	});
+}
+
+// One colour of a red-black pressure sweep over the rows [first, last), the residual of a cell is 4 times its change
+template <typename GridShape>
+static void pressureRowsWith(Grid& p, const Grid& div, int colour, int first, int last, double* row_squares,
+		float* row_max) {
+	int N = GridShape::size(p);
+	int S = GridShape::stride(p);
+	for (int j = first; j < last; j++) {
+		float* q = &p[p.index(0, j)];
+		const float* d = &div[div.index(0, j)];
+		float squares = 0;
+		float largest = 0;
+		for (int i = 1 + (j + colour) % 2; i < N - 1; i += 2) {
+			float value = (d[i] +
+				(q[i+1]
+					+q[i-1]
+					+q[i+S]
+					+q[i-S]
+				))/4;
+			float change = value - q[i];
+			squares += change * change;
+			largest = std::max(largest, std::fabs(change));
+			q[i] = value;
+		}
+		row_squares[j] += squares;
+		row_max[j] = std::max(row_max[j], largest);
+	}
+}
+
+void Physics::pressureRows(Grid& p, const Grid& div, int colour, int first, int last, double* row_squares,
+		float* row_max) const {
+	withShape(p.size(), [&](auto shape) {
+		pressureRowsWith<decltype(shape)>(p, div, colour, first, last, row_squares, row_max);
+	}, FixedSizes());
+}
 
-	// Solve the PDE for the pressure distribution   
+// One lexicographic Gauss Seidel sweep of the pressure, the residual of a cell is 4 times its change. The boundary is
+// set after every row, so the next rows already see it.
+template <typename Policy, typename GridShape>
+static void pressureSweep(Grid& p, const Grid& div, double& squares, float& largest) {
+	int N = GridShape::size(p);
+	int S = GridShape::stride(p);
 	for (int j = 1; j < N - 1; j++) {
+		float* q = p.data() + j * S;
+		const float* d = div.data() + j * S;
+		float row_squares = 0;
 		for (int i = 1; i < N - 1; i++) { 
-				p[transform_coordinates(i, j, N)] = (div[transform_coordinates(i, j, N)] +
-					(p[transform_coordinates(i+1, j, N)]
-						+p[transform_coordinates(i-1, j, N)]
-						+p[transform_coordinates(i, j+1, N)]
-						+p[transform_coordinates(i, j-1, N)]
+				float value = (d[i] +
+					(q[i+1]
+						+q[i-1]
+						+q[i+S]
+						+q[i-S]
 					))/4;
+				float change = value - q[i];
+				row_squares += change * change;
+				largest = std::max(largest, std::fabs(change));
+				q[i] = value;
 		}
+		squares += row_squares;
 		// Set boundary condition for pressure inside loop to be consistent with boundary conditions
-		setBnd(0, p, N);
+		setBndWith<FloatStorage, Policy, GridShape>(p, 0, N);
 	}
-	
-	// Use the calculated results from the pressure discretization to get the velovities in x and y
-	for (int j = 1; j < N - 1; j++) {
-		for (int i = 1; i < N - 1; i++) {
-			vx[transform_coordinates(i, j, N)] -= 0.5f * (p[transform_coordinates(i+1, j, N)] - p[transform_coordinates(i-1, j, N)]) * N;
-			vy[transform_coordinates(i, j, N)] -= 0.5f * (p[transform_coordinates(i, j+1, N)] - p[transform_coordinates(i, j-1, N)]) * N;
-		}
-        }
-		// Set boundary conditions for the density in x and y
-    	setBnd(1, vx, N);
-    	setBnd(2, vy, N);
 }
 
+// Subtract the pressure gradient from the velocity in the rows [first, last)
+template <typename SU, typename SV>
+static void gradientRowsWith(const ActiveTiles* tiles, Grid& vx, Grid& vy, const Grid& p, int first, int last) {
+	int N = vx.size();
+	int S = vx.stride();
+	float h = 1.0f / (N - 2);
+	// With active tiles the velocity outside of them stays zero, the quiet regions do not respond to the pressure
+	for (int j = first; j < last; j++) {
+		typename SU::Element* u = vx.values<SU>() + vx.index(0, j);
+		typename SV::Element* v = vy.values<SV>() + vy.index(0, j);
+		const float* q = &p[p.index(0, j)];
+		forEachSpan(tiles, N, j, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				u[i] = SU::store(SU::load(u[i]) - 0.5f * (q[i+1] - q[i-1]) / h);
+				v[i] = SV::store(SV::load(v[i]) - 0.5f * (q[i+S] - q[i-S]) / h);
+			}
+		});
+	}
+}
 
+void Physics::gradientRows(Grid& vx, Grid& vy, const Grid& p, int first, int last) const {
+	withStorage(vx.precision(), [&](auto u_storage) {
+		withStorage(vy.precision(), [&](auto v_storage) {
+			gradientRowsWith<decltype(u_storage), decltype(v_storage)>(_tiles, vx, vy, p, first, last);
+		});
+	});
+}
+
+// Force mass conservation and ensure that the velocity field remains divergence-free.
+void Physics::project(Grid& vx, Grid& vy, Grid& p, Grid& div) {
+	int N = vx.size();
+	Boundary scalar = domainBoundary(_domain, Boundary::Scalar);
+	if (_projection_solver == ProjectionSolver::Multigrid && scalar == Boundary::Periodic)
+		throw std::invalid_argument("the multigrid projection does not support periodic boundaries");
+
+	// The spectral projection works on the velocity alone and leaves the pressure and the divergence untouched
+	if (_projection_solver == ProjectionSolver::Spectral) {
+		if (scalar != Boundary::Periodic)
+			throw std::invalid_argument("the spectral projection needs a periodic domain");
+		_spectral.project(vx, vy, _pool.get());
+		_projection_iterations = 1;
+		_projection_residual = 0;
+		return;
+	}
+	
+	// Get the divergence via stencil matrix
+	std::vector<double> row_squares(N);
+	std::vector<float> row_max(N);
+	double div_squares;
+	float div_max;
+	parallelRows(1, N - 1, [&](int first, int last) {
+		divergenceRows(vx, vy, p, div, first, last, row_squares.data(), row_max.data());
+	});
+	sumRows(row_squares, row_max, div_squares, div_max);
+
+	// Set boundary condition for divergence
+	setBnd(scalar, div); 
+	// Reset boundary condition
+	setBnd(scalar, p);
+
+	if (_projection_solver == ProjectionSolver::Multigrid) {
+		// Solve the PDE for the pressure distribution down to the residual tolerance
+		Multigrid::Result result = _multigrid.solve(p, div);
+		_projection_iterations = result.iterations;
+		_projection_residual = result.residual;
+		setBnd(scalar, p);
+	} else if (_projection_solver == ProjectionSolver::RedBlack) {
+		// Red-black sweeps split across the thread pool, the boundary is set once both colours are updated
+		_projection_iterations = 0;
+		_projection_residual = 0;
+		for (int k = 0; k < _projection_sweeps; k++) {
+			std::fill(row_squares.begin(), row_squares.end(), 0.0);
+			std::fill(row_max.begin(), row_max.end(), 0.0f);
+			for (int colour = 0; colour < 2; colour++) {
+				parallelRows(1, N - 1, [&](int first, int last) {
+					pressureRows(p, div, colour, first, last, row_squares.data(), row_max.data());
+				});
+			}
+			setBnd(scalar, p);
+
+			double squares;
+			float largest;
+			sumRows(row_squares, row_max, squares, largest);
+			_projection_iterations = k + 1;
+			_projection_residual = relativeResidual(squares * 16, largest * 4, div_squares, div_max);
+			if (_projection_tolerance > 0 && _projection_residual <= _projection_tolerance)
+				break;
+		}
+	} else {
+		// Solve the PDE for the pressure distribution, the residual of a cell is 4 times the change of its pressure
+		_projection_iterations = 0;
+		_projection_residual = 0;
+		for (int k = 0; k < _projection_sweeps; k++) {
+			double squares = 0;
+			float largest = 0;
+			withBoundary(scalar, [&](auto policy) {
+				withShape(N, [&](auto shape) {
+					pressureSweep<decltype(policy), decltype(shape)>(p, div, squares, largest);
+				}, FixedSizes());
+			});
+			_projection_iterations = k + 1;
+			_projection_residual = relativeResidual(squares * 16, largest * 4, div_squares, div_max);
+			if (_projection_tolerance > 0 && _projection_residual <= _projection_tolerance)
+				break;
+		}
+	}
+	
+	// Use the calculated results from the pressure discretization to get the velovities in x and y
+	parallelRows(1, N - 1, [&](int first, int last) {
+		gradientRows(vx, vy, p, first, last);
+	});
+	// Set boundary conditions for the density in x and y
+	setBnd(domainBoundary(_domain, Boundary::VelocityX), vx);
+	setBnd(domainBoundary(_domain, Boundary::VelocityY), vy);
+}
@@ -0,0 +1,134 @@
+#include "../header/profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+Profiler::Profiler() : _origin(std::chrono::steady_clock::now()), _tracing(false), _max_events(0) {}
+
+bool Profiler::enabled() {
+#ifdef FLUIDSIM_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+Profiler& Profiler::instance() {
+	static Profiler profiler;
+	return profiler;
+}
+
+double Profiler::now() const {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _origin).count();
+}
+
+// Threads are numbered in the order in which they first record something
+std::size_t Profiler::threadId() {
+	static std::atomic<std::size_t> next(0);
+	thread_local std::size_t id = next++;
+	return id;
+}
+
+void Profiler::add(const char* name, double value, bool timed) {
+	auto stage = std::find_if(_stages.begin(), _stages.end(), [&](const Stage& s) { return s.name == name; });
+	if (stage == _stages.end()) {
+		_stages.push_back({name, timed, 0, 0, {}});
+		stage = _stages.end() - 1;
+		stage->window.reserve(WINDOW);
+	}
+	if (stage->window.size() < WINDOW)
+		stage->window.push_back(value);
+	else
+		stage->window[stage->count % WINDOW] = value;
+	stage->count++;
+	stage->last = value;
+}
+
+void Profiler::recordDuration(const char* name, double start, double duration) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	add(name, duration, true);
+	if (_tracing && _events.size() < _max_events)
+		_events.push_back({name, start, duration, threadId()});
+}
+
+void Profiler::record(const char* name, double value) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	add(name, value, false);
+}
+
+std::vector<std::pair<std::string, Profiler::Statistics>> Profiler::statistics() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<std::pair<std::string, Statistics>> result;
+	for (const Stage& stage : _stages) {
+		std::vector<double> samples = stage.window;
+		Statistics statistics = {stage.count, 0, 0, 0, stage.last};
+		if (!samples.empty()) {
+			statistics.min = *std::min_element(samples.begin(), samples.end());
+			double sum = 0;
+			for (double sample : samples)
+				sum += sample;
+			statistics.mean = sum / samples.size();
+			std::size_t rank = (samples.size() * 99) / 100;
+			std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+			statistics.p99 = samples[rank];
+		}
+		result.emplace_back(stage.name, statistics);
+	}
+	return result;
+}
+
+// One line per stage, durations converted from microseconds to milliseconds
+void Profiler::report(std::ostream& out) {
+	std::vector<bool> timed;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (const Stage& stage : _stages)
+			timed.push_back(stage.timed);
+	}
+	std::vector<std::pair<std::string, Statistics>> stages = statistics();
+
+	out << std::left << std::setw(30) << "stage" << std::right
+		<< std::setw(10) << "count" << std::setw(12) << "min" << std::setw(12) << "mean" << std::setw(12) << "p99" << "\n";
+	for (std::size_t k = 0; k < stages.size(); k++) {
+		const Statistics& s = stages[k].second;
+		double scale = timed[k] ? 1e-3 : 1.0;
+		out << std::left << std::setw(30) << stages[k].first << std::right
+			<< std::setw(10) << s.count
+			<< std::setw(12) << s.min * scale << std::setw(12) << s.mean * scale << std::setw(12) << s.p99 * scale
+			<< (timed[k] ? "  ms" : "") << "\n";
+	}
+	out.flush();
+}
+
+void Profiler::setTracing(bool tracing, std::size_t max_events) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_tracing = tracing;
+	_max_events = max_events;
+	if (tracing)
+		_events.reserve(std::min<std::size_t>(max_events, 65536));
+}
+
+// Complete events ("ph": "X") with start and duration in microseconds
+void Profiler::writeTrace(const std::string& path) {
+	std::ofstream out(path);
+	if (!out)
+		throw std::runtime_error("cannot write trace file '" + path + "'");
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	for (std::size_t k = 0; k < _events.size(); k++) {
+		const TraceEvent& event = _events[k];
+		out << "{\"name\":\"" << event.name << "\",\"cat\":\"solver\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+			<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}"
+			<< (k + 1 < _events.size() ? ",\n" : "\n");
+	}
+	out << "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void Profiler::reset() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stages.clear();
+	_events.clear();
+}
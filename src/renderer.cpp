@@ -0,0 +1,108 @@
+#include "../header/renderer.h"
+#include <algorithm>
+#include <cmath>
+
+Renderer::Renderer(int size, int scale)
+	: _size(size), _scale(scale), _colormap(Density), _velocity_range(2.0f), _vorticity_range(20.0f),
+	  _pixels(static_cast<std::size_t>(size) * size * 4, 255),
+	  _transform(0, static_cast<float>(scale), 0,
+	             static_cast<float>(scale), 0, 0,
+	             0, 0, 1),
+	  _particles(sf::Points) {
+	_texture.create(size, size);
+	_sprite.setTexture(_texture, true);
+}
+
+// The colormaps below are plain loops over one row without branches, so the compiler can vectorize them.
+// Every pixel is opaque, the window is overwritten completely by the sprite.
+
+// Green with the density as intensity, clamped to [0, 255]
+void Renderer::mapDensity(const Grid& density) {
+	for (int y = 0; y < _size; y++) {
+		const float* d = &density[density.index(0, y)];
+		std::uint8_t* pixel = &_pixels[static_cast<std::size_t>(y) * _size * 4];
+		for (int x = 0; x < _size; x++) {
+			float value = std::min(std::max(d[x], 0.0f), 255.0f);
+			pixel[4 * x + 0] = 0;
+			pixel[4 * x + 1] = static_cast<std::uint8_t>(value);
+			pixel[4 * x + 2] = 0;
+			pixel[4 * x + 3] = 255;
+		}
+	}
+}
+
+// Blue at rest, red at _velocity_range and above
+void Renderer::mapVelocityMagnitude(const Grid& vx, const Grid& vy) {
+	float scale = 255.0f / _velocity_range;
+	for (int y = 0; y < _size; y++) {
+		const float* u = &vx[vx.index(0, y)];
+		const float* v = &vy[vy.index(0, y)];
+		std::uint8_t* pixel = &_pixels[static_cast<std::size_t>(y) * _size * 4];
+		for (int x = 0; x < _size; x++) {
+			float value = std::min(std::sqrt(u[x] * u[x] + v[x] * v[x]) * scale, 255.0f);
+			pixel[4 * x + 0] = static_cast<std::uint8_t>(value);
+			pixel[4 * x + 1] = 0;
+			pixel[4 * x + 2] = static_cast<std::uint8_t>(255.0f - value);
+			pixel[4 * x + 3] = 255;
+		}
+	}
+}
+
+// Curl of the velocity with central differences, red for positive and blue for negative values.
+// The boundary cells have no curl and stay black.
+void Renderer::mapVorticity(const Grid& vx, const Grid& vy) {
+	std::fill(_pixels.begin(), _pixels.end(), 0);
+	int S = vx.stride();
+	float scale = 255.0f * 0.5f * (_size - 2) / _vorticity_range;
+	for (int y = 0; y < _size; y++) {
+		std::uint8_t* pixel = &_pixels[static_cast<std::size_t>(y) * _size * 4];
+		for (int x = 0; x < _size; x++)
+			pixel[4 * x + 3] = 255;
+	}
+	for (int y = 1; y < _size - 1; y++) {
+		const float* u = &vx[vx.index(0, y)];
+		const float* v = &vy[vy.index(0, y)];
+		std::uint8_t* pixel = &_pixels[static_cast<std::size_t>(y) * _size * 4];
+		for (int x = 1; x < _size - 1; x++) {
+			float curl = ((v[x + 1] - v[x - 1]) - (u[x + S] - u[x - S])) * scale;
+			curl = std::min(std::max(curl, -255.0f), 255.0f);
+			pixel[4 * x + 0] = static_cast<std::uint8_t>(std::max(curl, 0.0f));
+			pixel[4 * x + 2] = static_cast<std::uint8_t>(std::max(-curl, 0.0f));
+		}
+	}
+}
+
+// Map the fields with the current colormap and upload the pixels into the texture
+void Renderer::update(const Grid& density, const Grid& vx, const Grid& vy) {
+	switch (_colormap) {
+		case VelocityMagnitude:
+			mapVelocityMagnitude(vx, vy);
+			break;
+		case Vorticity:
+			mapVorticity(vx, vy);
+			break;
+		default:
+			mapDensity(density);
+			break;
+	}
+	_texture.update(_pixels.data());
+}
+
+// The cell (i, j) is the pixel [i, i + 1) x [j, j + 1) of the sprite, so a particle at (x, y) is drawn at
+// (x + 0.5, y + 0.5). The vertex array keeps its memory, so the points are only rewritten.
+void Renderer::updateParticles(const float* x, const float* y, std::size_t count) {
+	_particles.resize(count);
+	for (std::size_t k = 0; k < count; k++) {
+		sf::Vertex& vertex = _particles[k];
+		vertex.position = sf::Vector2f(x[k] + 0.5f, y[k] + 0.5f);
+		vertex.color = sf::Color(255, 255, 255, 160);
+	}
+}
+
+// Draw the texture and the particles into the window with one draw call each
+void Renderer::draw(sf::RenderWindow& window) {
+	sf::RenderStates states(_transform);
+	window.draw(_sprite, states);
+	if (_particles.getVertexCount() > 0)
+		window.draw(_particles, states);
+}
@@ -1,13 +1,49 @@
 #include "../header/simulation.h"
 
 // Creating a window where we run the simulation
-// Logic(_dt, _diff, _viscosity)
-Simulation::Simulation() : logic(Logic(0.1f, 0.0f, 0.0005f)) {
+// Logic(_size, _dt, _diff, _viscosity)
+Simulation::Simulation() : logic(SIZE, 0.1f, 0.0f, 0.0005f), renderer(SIZE, SCALE), snapshots(SIZE), running(false) {
+	// The tracer particles fade out like the smoke instead of filling the box
+	logic.particles().setLifetime(30.0f);
 	window.create(sf::VideoMode(SIZE*SCALE, SIZE*SCALE), "Euler fluid simulation", sf::Style::Titlebar | sf::Style::Close);
 }
 
-// Running the simulation
+// Solver thread: applies the queued input, makes a step and publishes the result until the window is closed
+void Simulation::solve() {
+	std::vector<InputEvent> events;
+	long step = 0;
+	while (running.load(std::memory_order_relaxed)) {
+		inputs.drain(events);
+		for (const InputEvent& event : events) {
+			if (event.type == InputEvent::Density)
+				logic.addDensity(event.x, event.y, event.amount_x);
+			else if (event.type == InputEvent::Particles)
+				logic.addParticles(event.x, event.y, static_cast<int>(event.amount_x));
+			else
+				logic.addVelocity(event.x, event.y, event.amount_x, event.amount_y);
+		}
+
+		// Makes a step in the fluid simulation
+		logic.step();
+
+		// Let's the density in the window reduce over time which is equivalent to flow of density outside 
+		// of the window. Without the fading, the density increases continously
+		logic.fadeDensity();
+
+		// Hand the completed step over to the render thread once it has taken the previous one, so the simulation
+		// advances one step per displayed frame however fast the solver is
+		snapshots.back().capture(logic, step++);
+		snapshots.waitUntilConsumed();
+		snapshots.publish();
+	}
+}
+
+// Running the simulation: the solver runs on its own thread, this thread only handles
+// the window, records the input and draws the newest completed step
 void Simulation::run() {
+	running = true;
+	std::thread solver(&Simulation::solve, this);
+
 	// Checks the current mouse position and safes it in previousMouse and currentMouse
 	// for comparison with mouse movement later on
 	sf::Vector2i previousMouse = sf::Mouse::getPosition(window);
@@ -21,6 +57,15 @@ void Simulation::run() {
 				case sf::Event::Closed:
 					window.close();
 					break;
+				// Keys 1, 2 and 3 switch between density, velocity magnitude and vorticity
+				case sf::Event::KeyPressed:
+					if (e.key.code == sf::Keyboard::Num1)
+						renderer.setColormap(Renderer::Density);
+					else if (e.key.code == sf::Keyboard::Num2)
+						renderer.setColormap(Renderer::VelocityMagnitude);
+					else if (e.key.code == sf::Keyboard::Num3)
+						renderer.setColormap(Renderer::Vorticity);
+					break;
 				default:
 					break;
 			}
@@ -28,7 +73,11 @@ void Simulation::run() {
 
 		// If left mouse button is pressed, the density at the respective location is increased by 200
 		if (sf::Mouse::isButtonPressed(sf::Mouse::Left))			
-			logic.addDensity(currentMouse.y/SCALE, currentMouse.x/SCALE, 200);
+			inputs.push({InputEvent::Density, static_cast<float>(currentMouse.y/SCALE), static_cast<float>(currentMouse.x/SCALE), 200, 0});
+
+		// The right mouse button seeds 20 tracer particles per frame at the respective location
+		if (sf::Mouse::isButtonPressed(sf::Mouse::Right))
+			inputs.push({InputEvent::Particles, static_cast<float>(currentMouse.y/SCALE), static_cast<float>(currentMouse.x/SCALE), 20, 0});
 
 		// Get's new mouse positions and subtracts the old mouse positions to get a ratio of velocity
 		// the mouse is dragged over the windowdow
@@ -38,21 +87,27 @@ void Simulation::run() {
 		float amountY = currentMouse.y - previousMouse.y;
 
 		// Adds velocity to spots where the mouse is dragged over with the velocity of the mouse movement 
-		logic.addVelocity(currentMouse.y/SCALE, currentMouse.x/SCALE, amountY / 10, amountX / 10);
+		if (amountX != 0 || amountY != 0)
+			inputs.push({InputEvent::Velocity, static_cast<float>(currentMouse.y/SCALE), static_cast<float>(currentMouse.x/SCALE), amountY / 10, amountX / 10});
 		
 		// Resets the current mouse position
 		previousMouse = currentMouse;
 
-		// Makes a step in the fluid simulationulation and updates the rendering
-		logic.step();
-		logic.render(window);
-
-		// Let's the density in the windowdow reduce over time which is equivalent to flow of density outside 
-		// of the windowdow. Without the fading, the density increases continously
-		logic.fadeDensity(SIZE*SIZE);
-		
-		// Updates the visualization
-		window.display();
+		// Updates the visualization with the newest step. While the solver is still busy the window keeps the previous
+		// frame and this thread only polls the input again after a short pause.
+		if (snapshots.consume()) {
+			const FieldSnapshot& frame = snapshots.front();
+			renderer.update(frame.density, frame.velocity_x, frame.velocity_y);
+			renderer.updateParticles(frame.particles_x.data(), frame.particles_y.data(), frame.particles_x.size());
+			window.clear();
+			renderer.draw(window);
+			window.display();
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
 	}
-}
 
+	running = false;
+	snapshots.stop();
+	solver.join();
+}
@@ -0,0 +1,72 @@
+#include "../header/snapshot.h"
+#include <algorithm>
+
+FieldSnapshot::FieldSnapshot(int size) : arena(size, 3), step(-1) {
+	density = arena.field(0);
+	velocity_x = arena.field(1);
+	velocity_y = arena.field(2);
+}
+
+// Copy the current state of the logic into the snapshot, all fields have the same layout. The snapshot is always float,
+// reduced precision fields are converted.
+void FieldSnapshot::capture(const Logic& logic, long step_number) {
+	logic.density().load(0, density.elements(), density.data());
+	logic.velocity_x().load(0, velocity_x.elements(), velocity_x.data());
+	logic.velocity_y().load(0, velocity_y.elements(), velocity_y.data());
+	const Particles& particles = logic.particles();
+	particles_x.assign(particles.x(), particles.x() + particles.count());
+	particles_y.assign(particles.y(), particles.y() + particles.count());
+	step = step_number;
+}
+
+SnapshotBuffer::SnapshotBuffer(int size) : _back(0), _front(1), _middle(2), _stopped(false) {
+	_slots.reserve(3);
+	for (int k = 0; k < 3; k++)
+		_slots.emplace_back(size);
+}
+
+// Swap the written slot with the middle one and mark the middle one as fresh.
+// The release order makes the written fields visible to the renderer before the flag.
+void SnapshotBuffer::publish() {
+	_back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+// Swap the read slot with the middle one if the middle one holds a new frame
+bool SnapshotBuffer::consume() {
+	if ((_middle.load(std::memory_order_acquire) & FRESH) == 0)
+		return false;
+	_front = _middle.exchange(_front, std::memory_order_acq_rel) & ~FRESH;
+
+	// Taking the lock orders the notification after the check of a solver that is about to wait
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+	_consumed.notify_one();
+	return true;
+}
+
+void SnapshotBuffer::waitUntilConsumed() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_consumed.wait(lock, [&]() {
+		return _stopped || (_middle.load(std::memory_order_acquire) & FRESH) == 0;
+	});
+}
+
+void SnapshotBuffer::stop() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopped = true;
+	}
+	_consumed.notify_one();
+}
+
+void InputQueue::push(const InputEvent& event) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_events.push_back(event);
+}
+
+void InputQueue::drain(std::vector<InputEvent>& events) {
+	events.clear();
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::swap(events, _events);
+}
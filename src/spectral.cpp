@@ -0,0 +1,185 @@
+#include "../header/spectral.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// Edge length of the blocks of the transposition, 32 x 32 complex values stay in the L1 cache
+static const int BLOCK = 32;
+
+// Call body(first, last) for chunks of [begin, end) on the pool, or once without a pool
+static void parallel(ThreadPool* pool, int begin, int end, const std::function<void(int, int)>& body) {
+	if (pool)
+		pool->parallel_for(begin, end, body);
+	else
+		body(begin, end);
+}
+
+// Transpose the n x n matrix source into target, block by block so that both are read and written in cache lines
+static void transpose(const std::complex<float>* source, std::complex<float>* target, int n, ThreadPool* pool) {
+	int blocks = (n + BLOCK - 1) / BLOCK;
+	parallel(pool, 0, blocks, [&](int first, int last) {
+		for (int bj = first * BLOCK; bj < std::min(last * BLOCK, n); bj += BLOCK) {
+			for (int bi = 0; bi < n; bi += BLOCK) {
+				for (int j = bj; j < std::min(bj + BLOCK, n); j++) {
+					for (int i = bi; i < std::min(bi + BLOCK, n); i++)
+						target[i * n + j] = source[j * n + i];
+				}
+			}
+		}
+	});
+}
+
+Spectral::Spectral() : _n(0) {}
+
+bool Spectral::supports(int size) {
+	return size > 2 && FFT::supports(size - 2);
+}
+
+void Spectral::build(int size) {
+	if (size - 2 == _n)
+		return;
+	if (!supports(size))
+		throw std::invalid_argument("the spectral solvers need a grid of 2^k + 2 cells, not " + std::to_string(size));
+	_n = size - 2;
+	_fft = FFT(_n);
+	_data.assign(static_cast<std::size_t>(_n) * _n, 0.0f);
+	_spectrum.assign(static_cast<std::size_t>(_n) * _n, 0.0f);
+	_cos.resize(_n);
+	_sin.resize(_n);
+	// sin(pi) is exactly zero, so that the projection recognizes the frequencies without central difference
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < _n; k++) {
+		_cos[k] = static_cast<float>(std::cos(2 * pi * k / _n));
+		_sin[k] = 2 * k == _n ? 0.0f : static_cast<float>(std::sin(2 * pi * k / _n));
+	}
+}
+
+// Transform the rows, transpose, transform the rows of the transposed matrix
+void Spectral::forward(ThreadPool* pool) {
+	parallel(pool, 0, _n, [&](int first, int last) {
+		for (int j = first; j < last; j++)
+			_fft.forward(&_data[static_cast<std::size_t>(j) * _n]);
+	});
+	transpose(_data.data(), _spectrum.data(), _n, pool);
+	parallel(pool, 0, _n, [&](int first, int last) {
+		for (int kx = first; kx < last; kx++)
+			_fft.forward(&_spectrum[static_cast<std::size_t>(kx) * _n]);
+	});
+}
+
+void Spectral::inverse(ThreadPool* pool) {
+	parallel(pool, 0, _n, [&](int first, int last) {
+		for (int kx = first; kx < last; kx++)
+			_fft.inverse(&_spectrum[static_cast<std::size_t>(kx) * _n]);
+	});
+	transpose(_spectrum.data(), _data.data(), _n, pool);
+	parallel(pool, 0, _n, [&](int first, int last) {
+		for (int j = first; j < last; j++)
+			_fft.inverse(&_data[static_cast<std::size_t>(j) * _n]);
+	});
+}
+
+// The rows are converted in bulk, so fields of every precision are supported
+void Spectral::load(const Grid& x, bool imaginary, ThreadPool* pool) {
+	parallel(pool, 0, _n, [&](int first, int last) {
+		std::vector<float> row(_n);
+		for (int j = first; j < last; j++) {
+			x.load(x.index(1, j + 1), _n, row.data());
+			std::complex<float>* values = &_data[static_cast<std::size_t>(j) * _n];
+			for (int i = 0; i < _n; i++) {
+				if (imaginary)
+					values[i].imag(row[i]);
+				else
+					values[i] = row[i];
+			}
+		}
+	});
+}
+
+// Every interior row is stored with its ghost cells, then the ghost rows copy the opposite interior rows including
+// their ghost cells, the same values PeriodicBoundary writes
+void Spectral::store(Grid& x, bool imaginary, ThreadPool* pool) {
+	int N = _n + 2;
+	float scale = 1.0f / (static_cast<float>(_n) * _n);
+	parallel(pool, 0, _n, [&](int first, int last) {
+		std::vector<float> row(N);
+		for (int j = first; j < last; j++) {
+			const std::complex<float>* values = &_data[static_cast<std::size_t>(j) * _n];
+			for (int i = 0; i < _n; i++)
+				row[i + 1] = scale * (imaginary ? values[i].imag() : values[i].real());
+			row[0] = row[_n];
+			row[_n + 1] = row[1];
+			x.store(x.index(0, j + 1), N, row.data());
+		}
+	});
+	std::vector<float> row(N);
+	x.load(x.index(0, _n), N, row.data());
+	x.store(x.index(0, 0), N, row.data());
+	x.load(x.index(0, 1), N, row.data());
+	x.store(x.index(0, N - 1), N, row.data());
+}
+
+void Spectral::diffuse(Grid& x, const Grid& x0, float a, ThreadPool* pool) {
+	build(x.size());
+	load(x0, false, pool);
+	forward(pool);
+
+	parallel(pool, 0, _n, [&](int first, int last) {
+		for (int kx = first; kx < last; kx++) {
+			std::complex<float>* values = &_spectrum[static_cast<std::size_t>(kx) * _n];
+			for (int ky = 0; ky < _n; ky++)
+				values[ky] /= 1 + a * (4 - 2 * _cos[kx] - 2 * _cos[ky]);
+		}
+	});
+
+	inverse(pool);
+	store(x, false, pool);
+}
+
+// Spectra of real fields are conjugate symmetric, so U(k) = (Z(k) + conj Z(-k)) / 2 and V(k) = (Z(k) - conj Z(-k)) / 2i
+// separate the two components of Z = U + iV. Every pair k, -k is projected together. The frequencies with k = -k have
+// sin(kx) = sin(ky) = 0, the central differences cannot see them and they stay unchanged.
+void Spectral::project(Grid& vx, Grid& vy, ThreadPool* pool) {
+	build(vx.size());
+	load(vx, false, pool);
+	load(vy, true, pool);
+	forward(pool);
+
+	int n = _n;
+	parallel(pool, 0, n, [&](int first, int last) {
+		for (int kx = first; kx < last; kx++) {
+			int mx = (n - kx) % n;
+			for (int ky = 0; ky < n; ky++) {
+				int my = (n - ky) % n;
+				std::size_t k = static_cast<std::size_t>(kx) * n + ky;
+				std::size_t m = static_cast<std::size_t>(mx) * n + my;
+				if (k >= m)
+					continue;
+				float sx = _sin[kx];
+				float sy = _sin[ky];
+				float s = sx * sx + sy * sy;
+				if (s == 0)
+					continue;
+
+				std::complex<float> z = _spectrum[k];
+				std::complex<float> partner = std::conj(_spectrum[m]);
+				std::complex<float> u = 0.5f * (z + partner);
+				std::complex<float> difference = 0.5f * (z - partner);
+				std::complex<float> v(difference.imag(), -difference.real());
+
+				std::complex<float> along = (sx * u + sy * v) / s;
+				u -= sx * along;
+				v -= sy * along;
+
+				// Z(k) = U + iV and Z(-k) = conj U + i conj V
+				_spectrum[k] = std::complex<float>(u.real() - v.imag(), u.imag() + v.real());
+				_spectrum[m] = std::complex<float>(u.real() + v.imag(), v.real() - u.imag());
+			}
+		}
+	});
+
+	inverse(pool);
+	store(vx, false, pool);
+	store(vy, true, pool);
+}
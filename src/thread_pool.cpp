@@ -0,0 +1,79 @@
+#include "../header/thread_pool.h"
+#include <stdexcept>
+
+ThreadPool::ThreadPool(int threads)
+	: _body(nullptr), _begin(0), _end(0), _generation(0), _pending(0), _stop(false) {
+	if (threads < 1)
+		throw std::invalid_argument("ThreadPool needs at least one thread");
+	for (int k = 1; k < threads; k++)
+		_workers.emplace_back(&ThreadPool::work, this, k);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+	for (std::thread& worker : _workers)
+		worker.join();
+}
+
+// Chunks differ in size by at most one row
+void ThreadPool::chunk(int index, int& begin, int& end) const {
+	int count = _end - _begin;
+	int n = threads();
+	begin = _begin + static_cast<int>(static_cast<long>(count) * index / n);
+	end = _begin + static_cast<int>(static_cast<long>(count) * (index + 1) / n);
+}
+
+// Wait for the next loop, run the chunk of this worker and report back
+void ThreadPool::work(int index) {
+	unsigned long seen = 0;
+	while (true) {
+		const std::function<void(int, int)>* body;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&] { return _stop || _generation != seen; });
+			if (_stop)
+				return;
+			seen = _generation;
+			body = _body;
+		}
+
+		int begin, end;
+		chunk(index, begin, end);
+		if (begin < end)
+			(*body)(begin, end);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (--_pending == 0)
+			_done.notify_one();
+	}
+}
+
+void ThreadPool::parallel_for(int begin, int end, const std::function<void(int, int)>& body) {
+	if (_workers.empty() || end - begin < 2) {
+		if (begin < end)
+			body(begin, end);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_body = &body;
+		_begin = begin;
+		_end = end;
+		_pending = static_cast<int>(_workers.size());
+		_generation++;
+	}
+	_wake.notify_all();
+
+	int chunk_begin, chunk_end;
+	chunk(0, chunk_begin, chunk_end);
+	if (chunk_begin < chunk_end)
+		body(chunk_begin, chunk_end);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [&] { return _pending == 0; });
+}
@@ -0,0 +1,119 @@
+#include "../header/tiles.h"
+#include <algorithm>
+#include <cmath>
+
+const int ActiveTiles::TILE;
+
+ActiveTiles::ActiveTiles(int size, float threshold) : _size(size), _threshold(threshold), _radius(0) {
+	_tiles = (size + TILE - 1) / TILE;
+	_active.assign(_tiles * _tiles, 1);
+	_hot.assign(_tiles * _tiles, 0);
+	_touched.assign(_tiles * _tiles, 0);
+	_grown.assign(_tiles * _tiles, 0);
+	_spans.resize(_tiles);
+	buildSpans();
+}
+
+void ActiveTiles::touch(int x, int y) {
+	x = std::min(std::max(x, 0), _size - 1);
+	y = std::min(std::max(y, 0), _size - 1);
+	_touched[(y / TILE) * _tiles + x / TILE] = 1;
+}
+
+// Compare the squares, the speed is only needed as a square root for the largest one.
+// Every row of the tile is converted to floats first, the fields may be stored in reduced precision.
+bool ActiveTiles::scan(int tx, int ty, const Grid& density, const Grid& vx, const Grid& vy, float& speed) const {
+	float limit = _threshold * _threshold;
+	float largest = 0;
+	bool hot = false;
+	int x_begin = tx * TILE;
+	int width = std::min(_size, x_begin + TILE) - x_begin;
+	int y_end = std::min(_size, (ty + 1) * TILE);
+	float d[TILE];
+	float u[TILE];
+	float v[TILE];
+	for (int y = ty * TILE; y < y_end; y++) {
+		density.load(density.index(x_begin, y), width, d);
+		vx.load(vx.index(x_begin, y), width, u);
+		vy.load(vy.index(x_begin, y), width, v);
+		for (int x = 0; x < width; x++) {
+			float squares = u[x] * u[x] + v[x] * v[x];
+			largest = std::max(largest, squares);
+			hot = hot || std::fabs(d[x]) > _threshold || squares > limit;
+		}
+	}
+	speed = std::sqrt(largest);
+	return hot;
+}
+
+void ActiveTiles::update(const Grid& density, const Grid& vx, const Grid& vy, float dt, std::initializer_list<Grid> fields) {
+	// Inactive tiles are zero, so only the active ones and those that received sources can be hot
+	float speed = 0;
+	for (int ty = 0; ty < _tiles; ty++) {
+		for (int tx = 0; tx < _tiles; tx++) {
+			int tile = ty * _tiles + tx;
+			float tile_speed = 0;
+			_hot[tile] = (_active[tile] || _touched[tile]) && scan(tx, ty, density, vx, vy, tile_speed);
+			speed = std::max(speed, tile_speed);
+		}
+	}
+
+	// The advection traces back dt * (N - 2) * speed elements (see Physics::advect), one more tile is the halo that
+	// catches what the diffusion spreads
+	float reach = dt * (_size - 2) * speed;
+	_radius = std::min(_tiles, static_cast<int>(std::ceil(reach / TILE)) + 1);
+
+	// Grow the hot tiles by the radius, first along x and then along y
+	for (int ty = 0; ty < _tiles; ty++) {
+		for (int tx = 0; tx < _tiles; tx++) {
+			int first = std::max(0, tx - _radius);
+			int last = std::min(_tiles - 1, tx + _radius);
+			const unsigned char* row = &_hot[ty * _tiles];
+			_grown[ty * _tiles + tx] = std::any_of(row + first, row + last + 1, [](unsigned char hot) { return hot != 0; });
+		}
+	}
+	for (int ty = 0; ty < _tiles; ty++) {
+		int first = std::max(0, ty - _radius);
+		int last = std::min(_tiles - 1, ty + _radius);
+		for (int tx = 0; tx < _tiles; tx++) {
+			unsigned char active = 0;
+			for (int k = first; k <= last && !active; k++)
+				active = _grown[k * _tiles + tx];
+			int tile = ty * _tiles + tx;
+
+			// The kernels skip inactive tiles from now on, so whatever is left below the threshold is cleared
+			if ((_active[tile] || _touched[tile]) && !active) {
+				int x_begin = tx * TILE;
+				int x_end = std::min(_size, x_begin + TILE);
+				int y_end = std::min(_size, (ty + 1) * TILE);
+				for (Grid field : fields) {
+					for (int y = ty * TILE; y < y_end; y++)
+						field.zero(field.index(x_begin, y), x_end - x_begin);
+				}
+			}
+			_active[tile] = active;
+		}
+	}
+	std::fill(_touched.begin(), _touched.end(), 0);
+	buildSpans();
+}
+
+// Neighbouring active tiles of a row merge into one span, so the kernels run over long contiguous rows
+void ActiveTiles::buildSpans() {
+	_active_count = 0;
+	for (int ty = 0; ty < _tiles; ty++) {
+		std::vector<TileSpan>& spans = _spans[ty];
+		spans.clear();
+		for (int tx = 0; tx < _tiles; tx++) {
+			if (!_active[ty * _tiles + tx])
+				continue;
+			_active_count++;
+			int begin = tx * TILE;
+			int end = std::min(_size, begin + TILE);
+			if (!spans.empty() && spans.back().end == begin)
+				spans.back().end = end;
+			else
+				spans.push_back({begin, end});
+		}
+	}
+}
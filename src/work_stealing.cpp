@@ -0,0 +1,81 @@
+#include "../header/work_stealing.h"
+#include <exception>
+#include <thread>
+#include <utility>
+
+WorkStealingPool::WorkStealingPool(int threads) : _threads(threads < 1 ? 1 : threads), _steals(0) {
+	for (int k = 0; k < _threads; k++)
+		_queues.emplace_back(new Queue());
+}
+
+// Own tasks first, then the back of the fullest other deque. No task is added during a run, so once every deque is
+// empty the thread is done.
+bool WorkStealingPool::next(int thread, std::function<void(int)>& task) {
+	{
+		Queue& own = *_queues[thread];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.front());
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	while (true) {
+		// The sizes are only a hint, the victim may have run out before it is locked
+		int victim = -1;
+		std::size_t most = 0;
+		for (int k = 0; k < _threads; k++) {
+			if (k == thread)
+				continue;
+			std::lock_guard<std::mutex> lock(_queues[k]->mutex);
+			if (_queues[k]->tasks.size() > most) {
+				most = _queues[k]->tasks.size();
+				victim = k;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		Queue& other = *_queues[victim];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty()) {
+			task = std::move(other.tasks.back());
+			other.tasks.pop_back();
+			_steals++;
+			return true;
+		}
+	}
+}
+
+void WorkStealingPool::run(std::vector<std::function<void(int)>> tasks) {
+	_steals = 0;
+	for (std::size_t k = 0; k < tasks.size(); k++)
+		_queues[k % _threads]->tasks.push_back(std::move(tasks[k]));
+
+	// Work until no deque holds a task any more. Tasks that throw are recorded, the thread continues with the next one
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	auto work = [&](int thread) {
+		std::function<void(int)> task;
+		while (next(thread, task)) {
+			try {
+				task(thread);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int k = 1; k < _threads; k++)
+		workers.emplace_back(work, k);
+	work(0);
+	for (std::thread& worker : workers)
+		worker.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}